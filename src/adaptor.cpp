@@ -36,5 +36,6 @@ Adaptor::Adaptor(QObject *parent)
     qDBusRegisterMetaType<QList<CommHistory::MessagePart> >();
     qDBusRegisterMetaType<CommHistory::Group>();
     qDBusRegisterMetaType<QList<CommHistory::Group> >();
+    qDBusRegisterMetaType<QList<QByteArray> >();
     setAutoRelaySignals(true);
 }
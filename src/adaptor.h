@@ -42,16 +42,32 @@ public:
 Q_SIGNALS:
     void eventsAdded(const QList<CommHistory::Event> &events);
 
+    // Deprecated: only sent when enabled with
+    // UpdatesEmitter::setFullEventUpdates(). Clients should listen to
+    // eventPropertiesUpdated(), which carries the same changes.
     void eventsUpdated(const QList<CommHistory::Event> &events);
 
+    // Events encoded with Event::encodeProperties(), carrying only the
+    // modified properties, and the previous state of the event if they
+    // change its group, start time, direction, read or draft state
+    void eventPropertiesUpdated(const QList<QByteArray> &events);
+
     void eventDeleted(int id);
 
+    // Deleted events with their group, start time, direction, read and
+    // draft state, encoded with Event::encodeProperties(); sent after
+    // eventDeleted() for the same events
+    void eventsDeleted(const QList<QByteArray> &events);
+
     void groupsAdded(const QList<CommHistory::Group> &groups);
 
     void groupsUpdated(const QList<int> &groupIds);
 
     void groupsUpdatedFull(const QList<CommHistory::Group> &groups);
 
+    // All events of the groups were marked as read
+    void groupsMarkedRead(const QList<int> &groupIds);
+
     void groupsDeleted(const QList<int> &groupIds);
 };
 
@@ -31,8 +31,10 @@
 #include "eventmodel_p.h"
 #include "callmodel.h"
 #include "callmodel_p.h"
+#include "eventcolumnstore.h"
 #include "event.h"
 #include "commonutils.h"
+#include "constants.h"
 #include "contactlistener.h"
 #include "debug.h"
 
@@ -71,9 +73,18 @@ CallModelPrivate::CallModelPrivate( EventModel *model )
         , eventType( CallEvent::UnknownCallType )
         , referenceTime( QDateTime() )
         , hasBeenFetched( false )
+        , databaseGrouping( false )
+        , groupedQuery( false )
+        , groupItemsValid( false )
 {
     contactChangesEnabled = true;
     propertyMask -= unusedProperties;
+    updateSubscriptions();
+}
+
+QStringList CallModelPrivate::subscriptionPaths() const
+{
+    return QStringList() << COMM_HISTORY_CALLS_PATH << COMM_HISTORY_UNSORTED_PATH;
 }
 
 bool CallModelPrivate::eventMatchesFilter( const Event &event ) const
@@ -137,44 +148,43 @@ void CallModelPrivate::eventsReceivedSlot(int start, int end, QList<CommHistory:
     while (i.hasNext()) {
         Event event = i.next();
 
-        bool replaced = false;
-        QModelIndex index;
-        for (int row = 0; row < eventRootItem->childCount(); row++) {
-            if (belongToSameGroup(eventRootItem->eventAt(row), event)
-                || eventRootItem->eventAt(row).id() == event.id()) {
-                DEBUG() << "replacing row" << row;
-                replaced = true;
-                index = q->createIndex(row, 0, eventRootItem->child(row));
-
-                eventRootItem->child(row)->setEvent(event);
-                QModelIndex bottom = q->createIndex(row,
-                                                    EventModel::NumberOfColumns - 1,
-                                                    eventRootItem->child(row));
-                emit q->dataChanged(index, bottom);
-                updatedGroups.remove(DatabaseIOPrivate::makeCallGroupURI(event));
-
-                // if we had an audio and video call group for the same
-                // contact and the latest audio call gets upgraded (or
-                // vice versa), there may now be two rows for the same
-                // group, so we have to remove the other one.
-                for (int dupe = index.row() + 1; dupe < eventRootItem->childCount(); dupe++) {
-                    Event e = eventRootItem->eventAt(dupe);
-                    if (belongToSameGroup(e, event)) {
-                        DEBUG() << Q_FUNC_INFO << "remove" << dupe << e.toString();
-                        emit q->beginRemoveRows(QModelIndex(), dupe, dupe);
-                        eventRootItem->removeAt(dupe);
-                        emit q->endRemoveRows();
-                        break;
-                    }
-                }
-                break;
-            }
-        }
+        // The first row of the event's group, or the row of the event
+        // itself if its group has changed
+        EventTreeItem *groupItem = findGroupItem(groupKey(event));
+        EventTreeItem *item = groupItem;
+        EventTreeItem *eventItem = eventRootItem->findItem(event.id());
+        if (eventItem && eventItem->parent() == eventRootItem
+            && (!item || eventItem->row() < item->row()))
+            item = eventItem;
 
-        if (!replaced) {
+        if (item) {
+            int row = item->row();
+            DEBUG() << "replacing row" << row;
+            QModelIndex index = q->createIndex(row, 0, item);
+
+            item->setEvent(event);
+            QModelIndex bottom = q->createIndex(row,
+                                                EventModel::NumberOfColumns - 1,
+                                                item);
+            emit q->dataChanged(index, bottom);
+            updatedGroups.remove(DatabaseIOPrivate::makeCallGroupURI(event));
+
+            // if we had an audio and video call group for the same
+            // contact and the latest audio call gets upgraded (or
+            // vice versa), there may now be two rows for the same
+            // group, so we have to remove the other one.
+            if (groupItem && groupItem != item && groupItem->row() > row) {
+                int dupe = groupItem->row();
+                DEBUG() << Q_FUNC_INFO << "remove" << dupe << groupItem->event().toString();
+                emit q->beginRemoveRows(QModelIndex(), dupe, dupe);
+                eventRootItem->removeAt(dupe);
+                emit q->endRemoveRows();
+            }
+            invalidateGroupItems();
+        } else {
             // didn't find an old row to overwrite -> insert new row in the appropriate spot
             if (!event.contacts().isEmpty()) {
-                contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), event.contacts());
+                contactCache->insert(event.localUid(), event.remoteUid(), event.contacts());
             }
 
             int row;
@@ -186,6 +196,7 @@ void CallModelPrivate::eventsReceivedSlot(int start, int end, QList<CommHistory:
             q->beginInsertRows(QModelIndex(), row, row);
             eventRootItem->insertChildAt(row, new EventTreeItem(event, eventRootItem));
             q->endInsertRows();
+            invalidateGroupItems();
 
             updatedGroups.remove(DatabaseIOPrivate::makeCallGroupURI(event));
         }
@@ -194,17 +205,20 @@ void CallModelPrivate::eventsReceivedSlot(int start, int end, QList<CommHistory:
     if (!updatedGroups.isEmpty()) {
         DEBUG() << Q_FUNC_INFO << "remaining call groups:" << updatedGroups;
         // no results for call group means it has been emptied, remove from list
-        foreach (QString group, updatedGroups.values()) {
-            for (int row = 0; row < eventRootItem->childCount(); row++) {
-                if (DatabaseIOPrivate::makeCallGroupURI(eventRootItem->eventAt(row)) == group) {
-                    DEBUG() << Q_FUNC_INFO << "remove" << row << eventRootItem->eventAt(row).toString();
-                    emit q->beginRemoveRows(QModelIndex(), row, row);
-                    eventRootItem->removeAt(row);
-                    emit q->endRemoveRows();
-                    break;
-                }
-            }
+        QList<int> emptiedRows;
+        for (int row = 0; row < eventRootItem->childCount() && !updatedGroups.isEmpty(); row++) {
+            if (updatedGroups.remove(DatabaseIOPrivate::makeCallGroupURI(eventRootItem->eventAt(row))))
+                emptiedRows.prepend(row);
+        }
+
+        foreach (int row, emptiedRows) {
+            DEBUG() << Q_FUNC_INFO << "remove" << row << eventRootItem->eventAt(row).toString();
+            emit q->beginRemoveRows(QModelIndex(), row, row);
+            eventRootItem->removeAt(row);
+            emit q->endRemoveRows();
         }
+        if (!emptiedRows.isEmpty())
+            invalidateGroupItems();
     }
 }
 
@@ -236,6 +250,46 @@ bool CallModelPrivate::belongToSameGroup( const Event &e1, const Event &e2 )
     return false;
 }
 
+QString CallModelPrivate::groupKey( const Event &event ) const
+{
+    QString key = DatabaseIOPrivate::makeCallGroupURI(event);
+
+    if (sortBy == CallModel::SortByTime || sortBy == CallModel::SortByContactAndType) {
+        key += QLatin1Char('!') + QString::number(event.direction());
+        if (event.isMissedCall())
+            key += QLatin1String("!missed");
+    }
+
+    return key;
+}
+
+EventTreeItem *CallModelPrivate::findGroupItem( const QString &key )
+{
+    if (!groupItemsValid) {
+        groupItems.clear();
+        groupItems.reserve(eventRootItem->childCount());
+        // Backwards, so that the first row of a group is kept
+        for (int row = eventRootItem->childCount() - 1; row >= 0; row--)
+            groupItems.insert(groupKey(eventRootItem->eventAt(row)), eventRootItem->child(row));
+        groupItemsValid = true;
+    }
+
+    return groupItems.value(key);
+}
+
+void CallModelPrivate::invalidateGroupItems()
+{
+    groupItemsValid = false;
+    groupItems.clear();
+}
+
+void CallModelPrivate::clearEvents()
+{
+    invalidateGroupItems();
+    emptyGroups.clear();
+    EventModelPrivate::clearEvents();
+}
+
 int CallModelPrivate::calculateEventCount( EventTreeItem *item )
 {
     int count = -1;
@@ -283,6 +337,156 @@ int CallModelPrivate::calculateEventCount( EventTreeItem *item )
     return count;
 }
 
+uint CallModelPrivate::resultChunkSize() const
+{
+    // Only the time sorted tree continues groups across fillModel() calls
+    if (isInTreeMode && sortBy != CallModel::SortByTime)
+        return 0;
+
+    return EventModelPrivate::resultChunkSize();
+}
+
+bool CallModelPrivate::supportsColumnStorage() const
+{
+    // Grouping needs the events of the tree items
+    return !isInTreeMode;
+}
+
+Event::PropertySet CallModelPrivate::queryProperties() const
+{
+    Event::PropertySet properties = EventModelPrivate::queryProperties();
+    // computed by callGroupsJoin()
+    if (groupedQuery)
+        properties << Event::EventCount;
+    return properties;
+}
+
+bool CallModelPrivate::usesDatabaseGrouping() const
+{
+    return databaseGrouping && isInTreeMode
+        && (sortBy == CallModel::SortByContact || sortBy == CallModel::SortByContactAndType);
+}
+
+// Condition for the calls in the group of the Calls row of callGroupsJoin()
+static QString sameCallGroup(const char *table, bool byType, const QDateTime &referenceTime)
+{
+    QString condition = QString::fromLatin1("%1.type = %2 AND %1.callGroup = Calls.callGroup ")
+                        .arg(QLatin1String(table)).arg(Event::CallEvent);
+    if (byType)
+        condition += QString::fromLatin1("AND %1.direction = Calls.direction AND %1.isMissedCall = Calls.isMissedCall ")
+                     .arg(QLatin1String(table));
+    if (!referenceTime.isNull())
+        condition += QString::fromLatin1("AND %1.startTime >= %2 ")
+                     .arg(QLatin1String(table)).arg(referenceTime.toTime_t());
+    return condition;
+}
+
+QString CallModelPrivate::callGroupsJoin() const
+{
+    bool byType = sortBy == CallModel::SortByContactAndType;
+
+    // Same as calculateEventCount(): all calls of a missed group when
+    // grouped by type, otherwise the missed calls since the latest call
+    // that was not missed
+    QString eventCount;
+    if (byType) {
+        eventCount = QLatin1String("CASE WHEN Calls.isMissedCall THEN COUNT(*) ELSE 0 END");
+    } else {
+        eventCount = QString::fromLatin1(
+            "(SELECT COUNT(*) FROM Events AS Missed WHERE %1AND Missed.isMissedCall = 1 "
+            "AND Missed.startTime > IFNULL((SELECT MAX(Answered.startTime) FROM Events AS Answered "
+            "WHERE %2AND Answered.isMissedCall = 0), -1))")
+            .arg(sameCallGroup("Missed", false, referenceTime))
+            .arg(sameCallGroup("Answered", false, referenceTime));
+    }
+
+    QString calls = QString::fromLatin1("Calls.type = %1 ").arg(Event::CallEvent);
+    if (!referenceTime.isNull())
+        calls += QString::fromLatin1("AND Calls.startTime >= %1 ").arg(referenceTime.toTime_t());
+
+    return QString::fromLatin1(
+        "JOIN ( "
+        "SELECT (SELECT Latest.id FROM Events AS Latest WHERE %1"
+        "ORDER BY Latest.startTime DESC, Latest.id DESC LIMIT 1) AS lastEventId, "
+        "%2 AS eventCount "
+        "FROM Events AS Calls WHERE %3"
+        "GROUP BY Calls.callGroup%4 "
+        ") AS CallGroups ON (CallGroups.lastEventId = Events.id) ")
+        .arg(sameCallGroup("Latest", byType, referenceTime))
+        .arg(eventCount)
+        .arg(calls)
+        .arg(QLatin1String(byType ? ", Calls.direction, Calls.isMissedCall" : ""));
+}
+
+bool CallModelPrivate::isUnfetchedGroup( const QModelIndex &index ) const
+{
+    if (!groupedQuery || !index.isValid())
+        return false;
+
+    EventTreeItem *item = static_cast<EventTreeItem *>(index.internalPointer());
+    return item && item->parent() == eventRootItem && item->childCount() == 0
+        && !emptyGroups.contains(groupKey(item->event()));
+}
+
+bool CallModelPrivate::fetchGroup( EventTreeItem *item )
+{
+    Q_Q(CallModel);
+
+    const Event &event = item->event();
+    // no event counts for the calls of a group
+    Event::PropertySet properties = EventModelPrivate::queryProperties();
+
+    QString statement = DatabaseIOPrivate::eventQueryBase(properties);
+    statement += QString::fromLatin1("WHERE type=%1 AND callGroup=:callGroup ").arg(Event::CallEvent);
+    if (sortBy == CallModel::SortByContactAndType) {
+        statement += QString::fromLatin1("AND direction=%1 AND isMissedCall=%2 ")
+                     .arg(event.direction()).arg(event.isMissedCall() ? 1 : 0);
+    }
+    if (!referenceTime.isNull())
+        statement += QString::fromLatin1("AND startTime >= %1 ").arg(referenceTime.toTime_t());
+    statement += "ORDER BY startTime DESC, id DESC";
+
+    QSqlQuery query = DatabaseIOPrivate::instance()->createQuery();
+    query.setForwardOnly(true);
+    if (!query.prepare(statement)) {
+        qWarning() << "Failed to execute query";
+        qWarning() << query.lastError();
+        qWarning() << query.lastQuery();
+        return false;
+    }
+
+    query.bindValue(":callGroup", DatabaseIOPrivate::makeCallGroupURI(event));
+    if (!query.exec()) {
+        qWarning() << "Failed to execute query";
+        qWarning() << query.lastError();
+        qWarning() << query.lastQuery();
+        return false;
+    }
+
+    DatabaseIOPrivate::EventProjection projection = DatabaseIOPrivate::eventProjection(properties);
+    QList<Event> events;
+    while (query.next()) {
+        Event e;
+        DatabaseIOPrivate::readEventResult(query, e, projection);
+        setContactFromCache(e);
+        events.append(e);
+    }
+    query.finish();
+
+    // e.g. calls before the reference time; the group is fetched anyway
+    if (events.isEmpty()) {
+        emptyGroups.insert(groupKey(event));
+        return true;
+    }
+
+    q->beginInsertRows(q->createIndex(item->row(), 0, item), 0, events.count() - 1);
+    foreach (const Event &e, events)
+        item->appendChild(new EventTreeItem(e, item));
+    q->endInsertRows();
+
+    return true;
+}
+
 bool CallModelPrivate::fillModel( int start, int end, QList<CommHistory::Event> events )
 {
     Q_UNUSED( start );
@@ -345,45 +549,44 @@ bool CallModelPrivate::fillModel( int start, int end, QList<CommHistory::Event>
             case CallModel::SortByContactAndType:
             {
                 QList<EventTreeItem *> topLevelItems;
-                // get the first event and save it as top level item
-                Event event = events.first();
-                EventTreeItem *parent = new EventTreeItem(event);
-                topLevelItems.append(parent);
-                parent->appendChild(new EventTreeItem(event, parent));
-                if (!event.contacts().isEmpty())
-                    contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), event.contacts());
-
-                for (int i = 1; i < events.count(); i++) {
-                    Event event = events.at(i);
+                QHash<QString, EventTreeItem *> groups;
+
+                foreach (const Event &event, events) {
                     if (!event.contacts().isEmpty())
-                        contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), event.contacts());
-
-                    bool found = false;
-                    for (int i = 0; i < topLevelItems.count() && !found; ++i) {
-                        // ignore matching events because the already existing
-                        // entry has to be more recent
-                        if (belongToSameGroup(topLevelItems.at(i)->event(), event)) {
-                            topLevelItems.at(i)->appendChild(new EventTreeItem(event, topLevelItems.at(i)));
-                            found = true;
-                        }
-                    }
+                        contactCache->insert(event.localUid(), event.remoteUid(), event.contacts());
 
-                    if (!found) {
+                    // events are newest first, so the existing top level
+                    // entry of a group is always more recent
+                    EventTreeItem *&parent = groups[groupKey(event)];
+                    if (!parent) {
                         parent = new EventTreeItem(event);
                         topLevelItems.append(parent);
-                        parent->appendChild(new EventTreeItem(event, parent));
                     }
+                    // when grouped in the database, the calls of the
+                    // group are fetched on demand by fetchGroup()
+                    if (!groupedQuery)
+                        parent->appendChild(new EventTreeItem(event, parent));
                 }
 
                 // save top level items into the model
-                q->beginInsertRows( QModelIndex(), 0, topLevelItems.count() - 1);
+                int first = eventRootItem->childCount();
+                q->beginInsertRows( QModelIndex(), first, first + topLevelItems.count() - 1);
                 foreach ( EventTreeItem *item, topLevelItems )
                 {
-                    item->event().setEventCount(calculateEventCount(item));
+                    // event counts of database groups come with the query
+                    if (!groupedQuery)
+                        item->event().setEventCount(calculateEventCount(item));
                     eventRootItem->appendChild( item );
                 }
                 q->endInsertRows();
 
+                if (first == 0) {
+                    groupItems = groups;
+                    groupItemsValid = true;
+                } else {
+                    invalidateGroupItems();
+                }
+
                 break;
             }
             /*
@@ -412,7 +615,7 @@ bool CallModelPrivate::fillModel( int start, int end, QList<CommHistory::Event>
 
                 foreach (Event event, events) {
                     if (!event.contacts().isEmpty())
-                        contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), event.contacts());
+                        contactCache->insert(event.localUid(), event.remoteUid(), event.contacts());
 
                     if (last && last->event().eventCount() == -1
                         && belongToSameGroup(event, last->event())) {
@@ -490,7 +693,7 @@ void CallModelPrivate::addToModel( Event &event )
     }
 
     if (!event.contacts().isEmpty()) {
-        contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), event.contacts());
+        contactCache->insert(event.localUid(), event.remoteUid(), event.contacts());
     } else {
         setContactFromCache(event);
     }
@@ -501,16 +704,11 @@ void CallModelPrivate::addToModel( Event &event )
         case CallModel::SortByContactAndType:
         {
             // find match, update count if needed, move to top
-            int matchingRow = -1;
-            for (int i = 0; i < eventRootItem->childCount(); i++) {
-                if (belongToSameGroup(eventRootItem->child(i)->event(), event)) {
-                    matchingRow = i;
-                    break;
-                }
-            }
+            const QString key(groupKey(event));
+            EventTreeItem *matchingItem = findGroupItem(key);
 
-            if (matchingRow != -1) {
-                EventTreeItem *matchingItem = eventRootItem->child(matchingRow);
+            if (matchingItem) {
+                int matchingRow = matchingItem->row();
 
                 if (matchingItem->event().direction() == event.direction()
                     && matchingItem->event().isMissedCall() == event.isMissedCall())
@@ -519,7 +717,9 @@ void CallModelPrivate::addToModel( Event &event )
                     event.setEventCount(1);
 
                 matchingItem->setEvent(event);
-                matchingItem->prependChild(new EventTreeItem(event, matchingItem));
+                // an unfetched group reads the new call with the others
+                if (!groupedQuery || matchingItem->childCount() || emptyGroups.remove(key))
+                    matchingItem->prependChild(new EventTreeItem(event, matchingItem));
 
                 if (matchingRow == 0) {
                     // already at the top, update row
@@ -528,15 +728,20 @@ void CallModelPrivate::addToModel( Event &event )
                                                        eventRootItem->child(0)));
                 } else {
                     // move to top
-                    emit q->layoutAboutToBeChanged();
-                    eventRootItem->moveChild(matchingRow, 0);
-                    emit q->layoutChanged();
+                    if (q->beginMoveRows(QModelIndex(), matchingRow, matchingRow, QModelIndex(), 0)) {
+                        eventRootItem->moveChild(matchingRow, 0);
+                        q->endMoveRows();
+                    }
+                    emit q->dataChanged(q->createIndex(0, 0, eventRootItem->child(0)),
+                                        q->createIndex(0, CallModel::NumberOfColumns - 1,
+                                                       eventRootItem->child(0)));
                 }
             } else {
                 // no match, insert new row at top
                 emit q->beginInsertRows(QModelIndex(), 0, 0);
                 event.setEventCount(1);
                 eventRootItem->prependChild(new EventTreeItem(event));
+                groupItems.insert(key, eventRootItem->child(0));
                 emit q->endInsertRows();
             }
 
@@ -604,6 +809,16 @@ void CallModelPrivate::addToModel( Event &event )
     }
 }
 
+void CallModelPrivate::addEventsToModel( QList<Event> &events )
+{
+    if (!isInTreeMode)
+        return EventModelPrivate::addEventsToModel(events);
+
+    // calls are regrouped one by one
+    for (int i = 0; i < events.count(); i++)
+        addToModel(events[i]);
+}
+
 void CallModelPrivate::eventsAddedSlot( const QList<Event> &events )
 {
     DEBUG() << __PRETTY_FUNCTION__ << events.count();
@@ -620,6 +835,8 @@ void CallModelPrivate::eventsUpdatedSlot( const QList<Event> &events )
     // reimp from EventModelPrivate, plus additional isVideoCall processing
     foreach (const Event &event, events) {
         DEBUG() << Q_FUNC_INFO << "updated" << event.toString();
+        if (columnStore && columnStore->findRow(event.id()) >= 0)
+            materializeColumns();
         QModelIndex index = findEvent(event.id());
         Event e = event;
 
@@ -633,13 +850,17 @@ void CallModelPrivate::eventsUpdatedSlot( const QList<Event> &events )
         EventTreeItem *item = static_cast<EventTreeItem *>(index.internalPointer());
         if (item) {
             Event oldEvent = item->event();
-            if (oldEvent.isVideoCall() != event.isVideoCall()) {
+            if (event.validProperties().contains(Event::Headers)
+                && oldEvent.isVideoCall() != event.isVideoCall()) {
                 // Video call status up/downgraded; refetch both video-
                 // and non-video-versions for the call group and process
                 // the results in eventsReceived
                 updatedGroups.insert(DatabaseIOPrivate::makeCallGroupURI(oldEvent));
                 updatedGroups.insert(DatabaseIOPrivate::makeCallGroupURI(event));
             } else {
+                // the group of a top level item may change
+                if (item->parent() == eventRootItem)
+                    invalidateGroupItems();
                 modifyInModel(e);
             }
         }
@@ -670,26 +891,22 @@ QModelIndex CallModelPrivate::findEvent( int id ) const
         return EventModelPrivate::findEvent(id);
     }
 
-    for ( int row = 0; row < eventRootItem->childCount(); row++ )
+    // Top level items are preferred over the grouped events
+    EventTreeItem *item = eventRootItem->findItem( id );
+    if ( !item )
     {
-        // check top level item
-        if ( eventRootItem->child( row )->event().id() == id )
-        {
-            return q->createIndex( row, 0, eventRootItem->child( row ) );
-        }
-        // loop through all grouped events
-        EventTreeItem *currentGroup = eventRootItem->child( row );
-        for ( int column = 0; column < currentGroup->childCount(); column++ )
-        {
-            if ( currentGroup->child( column )->event().id() == id )
-            {
-                return q->createIndex( row, column, currentGroup->child( column ) );
-            }
-        }
+        // id was not found, return invalid index
+        return QModelIndex();
     }
 
-    // id was not found, return invalid index
-    return QModelIndex();
+    // Grouped events are addressed by the row of their group and their
+    // position in it
+    EventTreeItem *parent = item->parent();
+    if ( parent == eventRootItem )
+    {
+        return q->createIndex( item->row(), 0, item );
+    }
+    return q->createIndex( parent->row(), item->row(), item );
 }
 
 void CallModelPrivate::deleteFromModel( int id )
@@ -718,6 +935,7 @@ void CallModelPrivate::deleteFromModel( int id )
     // if event is a top level item ( i.e. the whole group ), then delete it
     if ( index.column() == 0 )
     {
+        invalidateGroupItems();
         int row = index.row();
         bool isRegroupingNeeded = false;
         // regrouping is needed/possible only if sorting is SortByTime...
@@ -854,6 +1072,18 @@ void CallModel::setFilterAccount(const QString &localUid)
     d->filterLocalUid = localUid;
 }
 
+void CallModel::setDatabaseGrouping(bool enabled)
+{
+    Q_D(CallModel);
+    d->databaseGrouping = enabled;
+}
+
+bool CallModel::databaseGrouping() const
+{
+    Q_D(const CallModel);
+    return d->databaseGrouping;
+}
+
 void CallModel::resetFilters()
 {
     Q_D(CallModel);
@@ -874,33 +1104,37 @@ bool CallModel::getEvents()
     endResetModel();
     d->countedUids.clear();
     d->updatedGroups.clear();
+    d->groupedQuery = d->usesDatabaseGrouping();
 
-    QString q = DatabaseIOPrivate::eventQueryBase();
-    q += QString::fromLatin1("WHERE type=%1 ").arg(Event::CallEvent);
+    QString q = DatabaseIOPrivate::eventQueryBase(d->queryProperties());
 
-    if (!d->isInTreeMode) {
-        if (d->eventType == CallEvent::ReceivedCallType) {
-            q += QString::fromLatin1("AND direction=%1 AND isMissedCall=0 ").arg(Event::Inbound);
-        } else if (d->eventType == CallEvent::MissedCallType) {
-            q += QString::fromLatin1("AND direction=%1 AND isMissedCall=1 ").arg(Event::Inbound);
-        } else if (d->eventType == CallEvent::DialedCallType) {
-            q += QString::fromLatin1("AND direction=%1 ").arg(Event::Outbound);
-        }
+    if (d->groupedQuery) {
+        // only the latest call of each group, see setDatabaseGrouping()
+        q += d->callGroupsJoin();
+    } else {
+        q += QString::fromLatin1("WHERE type=%1 ").arg(Event::CallEvent);
+
+        if (!d->isInTreeMode) {
+            if (d->eventType == CallEvent::ReceivedCallType) {
+                q += QString::fromLatin1("AND direction=%1 AND isMissedCall=0 ").arg(Event::Inbound);
+            } else if (d->eventType == CallEvent::MissedCallType) {
+                q += QString::fromLatin1("AND direction=%1 AND isMissedCall=1 ").arg(Event::Inbound);
+            } else if (d->eventType == CallEvent::DialedCallType) {
+                q += QString::fromLatin1("AND direction=%1 ").arg(Event::Outbound);
+            }
 
-        if (!d->filterLocalUid.isEmpty())
-            q += QString::fromLatin1("AND localUid=:filterLocalUid ");
-    }
+            if (!d->filterLocalUid.isEmpty())
+                q += QString::fromLatin1("AND localUid=:filterLocalUid ");
+        }
 
-    if (!d->referenceTime.isNull()) {
-        q += QString::fromLatin1("AND startTime >= %1 ").arg(d->referenceTime.toTime_t());
+        if (!d->referenceTime.isNull()) {
+            q += QString::fromLatin1("AND startTime >= %1 ").arg(d->referenceTime.toTime_t());
+        }
     }
 
     q += "ORDER BY startTime DESC, id DESC";
 
     QSqlQuery query = DatabaseIOPrivate::instance()->createQuery();
-    if (!d->filterLocalUid.isEmpty())
-        query.bindValue(":filterLocalUid", d->filterLocalUid);
-
     if (!query.prepare(q)) {
         qWarning() << "Failed to execute query";
         qWarning() << query.lastError();
@@ -908,6 +1142,9 @@ bool CallModel::getEvents()
         return false;
     }
 
+    if (!d->isInTreeMode && !d->filterLocalUid.isEmpty())
+        query.bindValue(":filterLocalUid", d->filterLocalUid);
+
     return d->executeQuery(query);
 }
 
@@ -979,6 +1216,8 @@ bool CallModel::modifyEvent( Event &event )
     events << event;
 
     QModelIndex index = d->findEvent(event.id());
+    if (d->isUnfetchedGroup(index))
+        d->fetchGroup(static_cast<EventTreeItem *>(index.internalPointer()));
     if (index.isValid()) {
         EventTreeItem *item = static_cast<EventTreeItem *>(index.internalPointer());
         if (item) {
@@ -1017,6 +1256,8 @@ bool CallModel::deleteEvent( int id )
         case SortByTime :
         {
             EventTreeItem *item = d->eventRootItem->child( index.row() );
+            if (d->isUnfetchedGroup(index) && !d->fetchGroup(item))
+                return false;
 
             if (!d->database()->transaction())
                 return false;
@@ -1058,4 +1299,32 @@ bool CallModel::deleteEvent( Event &event )
     return deleteEvent( event.id() );
 }
 
+bool CallModel::hasChildren( const QModelIndex &parent ) const
+{
+    Q_D(const CallModel);
+
+    if (d->isUnfetchedGroup(parent))
+        return true;
+
+    return EventModel::hasChildren(parent);
+}
+
+bool CallModel::canFetchMore( const QModelIndex &parent ) const
+{
+    Q_D(const CallModel);
+
+    if (parent.isValid())
+        return d->isUnfetchedGroup(parent);
+
+    return EventModel::canFetchMore(parent);
+}
+
+void CallModel::fetchMore( const QModelIndex &parent )
+{
+    Q_D(CallModel);
+
+    if (d->isUnfetchedGroup(parent))
+        d->fetchGroup(static_cast<EventTreeItem *>(parent.internalPointer()));
+}
+
 }
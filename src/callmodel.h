@@ -151,6 +151,21 @@ public:
      */
     void resetFilters();
 
+    /*!
+     * \brief Group calls in the database
+     *
+     * If enabled, calls sorted by SortByContact or SortByContactAndType
+     * in tree mode are grouped by the database, and getEvents() reads
+     * only the latest call and the event count of each group. The calls
+     * of a group are read when its row is expanded with fetchMore().
+     * Disabled by default.
+     * getEvents() must be called after this function to have effect.
+     *
+     * \param enabled If true, group calls in the database.
+     */
+    void setDatabaseGrouping(bool enabled);
+    bool databaseGrouping() const;
+
     /*!
      * \brief Resets model and fetch call events.
      *
@@ -205,6 +220,12 @@ public:
 
     virtual bool deleteEvent( Event &event );
 
+    virtual bool hasChildren( const QModelIndex &parent = QModelIndex() ) const;
+
+    virtual bool canFetchMore( const QModelIndex &parent ) const;
+
+    virtual void fetchMore( const QModelIndex &parent );
+
 private:
     Q_DECLARE_PRIVATE(CallModel);
 };
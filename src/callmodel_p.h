@@ -49,15 +49,66 @@ public:
     bool eventMatchesFilter( const Event &event ) const;
 
     bool acceptsEvent( const Event &event ) const;
+    QStringList subscriptionPaths() const;
 
     int calculateEventCount( EventTreeItem *item );
 
     bool fillModel( int start, int end, QList<CommHistory::Event> events );
 
+    uint resultChunkSize() const;
+
+    bool supportsColumnStorage() const;
+
+    Event::PropertySet queryProperties() const;
+
+    /*!
+     * True if getEvents() would group calls in the database: tree mode
+     * sorted by contact with database grouping enabled.
+     */
+    bool usesDatabaseGrouping() const;
+
+    /*!
+     * Join of the event query that selects the latest call and the event
+     * count of each call group.
+     */
+    QString callGroupsJoin() const;
+
+    /*!
+     * True if index is a top level row of a query grouped in the
+     * database whose calls have not been fetched yet.
+     */
+    bool isUnfetchedGroup( const QModelIndex &index ) const;
+
+    /*!
+     * Reads the calls of a group grouped in the database and inserts
+     * them as children of item.
+     */
+    bool fetchGroup( EventTreeItem *item );
+
     bool belongToSameGroup( const Event &e1, const Event &e2 );
 
+    /*!
+     * Key of the call group of an event with the current sorting: the
+     * call group of the database, plus direction and missed status
+     * when those separate groups. Events that belongToSameGroup() have
+     * the same key.
+     */
+    QString groupKey( const Event &event ) const;
+
+    /*!
+     * Top level item of the group with a key when sorting by contact,
+     * or 0 if there is none. Uses groupItems, which is rebuilt on
+     * demand after rows have been removed.
+     */
+    EventTreeItem *findGroupItem( const QString &key );
+    void invalidateGroupItems();
+
+    void clearEvents();
+
     void addToModel( Event &event );
 
+    void addEventsToModel( QList<Event> &events );
+
     void eventsAddedSlot( const QList<Event> &events );
 
     void eventsUpdatedSlot( const QList<Event> &events );
@@ -91,6 +142,16 @@ public:
     bool hasBeenFetched;
     QSet<QString> countedUids;
     QSet<QString> updatedGroups;
+    bool databaseGrouping;
+    // the current contents were grouped in the database
+    bool groupedQuery;
+    // groupKey() of top level items whose fetchGroup() found no calls
+    QSet<QString> emptyGroups;
+
+    // groupKey() -> top level item, in SortByContact and
+    // SortByContactAndType tree modes
+    QHash<QString, EventTreeItem *> groupItems;
+    bool groupItemsValid;
 };
 
 }
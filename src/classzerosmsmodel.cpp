@@ -54,6 +54,17 @@ public:
             emit q->newMessage(event.messageToken(), event.freeText());
         }
     }
+
+    virtual void addEventsToModel(QList<Event> &events)
+    {
+        Q_Q(ClassZeroSMSModel);
+
+        EventModelPrivate::addEventsToModel(events);
+        foreach (const Event &event, events) {
+            if (acceptsEvent(event))
+                emit q->newMessage(event.messageToken(), event.freeText());
+        }
+    }
 };
 
 LIBCOMMHISTORY_EXPORT ClassZeroSMSModel::ClassZeroSMSModel(QObject *parent)
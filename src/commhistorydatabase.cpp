@@ -21,11 +21,17 @@
 ******************************************************************************/
 
 #include "commhistorydatabase.h"
+#include "databaseio_p.h"
+#include "event.h"
+#include "fieldencoding.h"
 #include <QDir>
 #include <QFile>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QStringList>
 
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
 #include <QDesktopServices>
@@ -44,13 +50,54 @@ static const char *db_setup[] = {
 };
 static int db_setup_count = sizeof(db_setup) / sizeof(*db_setup);
 
+// Settings of the database file, which must be made before journal_mode
+// is set on a new database
+static const char *db_create[] = {
+    // Free pages are released in the background, see DatabaseMaintenance
+    "PRAGMA auto_vacuum = INCREMENTAL"
+};
+static int db_create_count = sizeof(db_create) / sizeof(*db_create);
+
+// SQLite tuning applied to every connection. The profile is chosen by
+// COMMHISTORY_DATABASE_PROFILE or the "profile" key of the settings file
+// (commhistory/database.conf in the user config directory), and single
+// values can be overridden in the settings file. Negative values and an
+// empty synchronous mode leave the SQLite default in place.
+struct TuningProfile {
+    const char *name;
+    qint64 mmapSize;        // bytes
+    int cacheSize;          // pages if positive, KiB if below -1
+    const char *synchronous;
+    int walAutoCheckpoint;  // pages
+    int pageSize;           // bytes, only for new databases
+};
+
+static const TuningProfile db_profiles[] = {
+    // name           mmapSize    cacheSize  synchronous  walAutoCheckpoint pageSize
+    { "default",      32 << 20,   -8192,     "NORMAL",    1000,             4096 },
+    { "lowmem",       0,          -1024,     "NORMAL",    500,              4096 },
+    { "performance",  256 << 20,  -32768,    "NORMAL",    4000,             4096 },
+    // SQLite defaults, as used before profiles were introduced
+    { "sqlite",       -1,         -1,        "",          -1,               -1 }
+};
+static int db_profiles_count = sizeof(db_profiles) / sizeof(*db_profiles);
+
+struct DatabaseTuning {
+    QString profile;
+    qint64 mmapSize;
+    int cacheSize;
+    QString synchronous;
+    int walAutoCheckpoint;
+    int pageSize;
+};
+
 static const char *db_schema[] = {
     "PRAGMA encoding = \"UTF-16\"",
 
     "CREATE TABLE Groups ( "
     "  id INTEGER PRIMARY KEY AUTOINCREMENT, "
     "  localUid TEXT, "
-    "  remoteUids TEXT, "
+    "  remoteUids BLOB, "
     "  type INTEGER, "
     "  chatName TEXT, "
     "  lastModified INTEGER UNSIGNED "
@@ -83,7 +130,7 @@ static const char *db_schema[] = {
     "  validityPeriod INTEGER, "
     "  contentLocation TEXT, "
     "  messageParts TEXT, "
-    "  headers TEXT, "
+    "  headers BLOB, "
     "  readStatus INTEGER, "
     "  reportRead INTEGER, "
     "  reportedReadRequested INTEGER, "
@@ -99,6 +146,134 @@ static const char *db_schema[] = {
 };
 static int db_schema_count = sizeof(db_schema) / sizeof(*db_schema);
 
+// Per-group event statistics, maintained by triggers on Events. lastEventId
+// refers to the most recent event by (startTime, id).
+static const char *db_groupStats[] = {
+    "CREATE TABLE IF NOT EXISTS GroupStats ( "
+    "  groupId INTEGER PRIMARY KEY, "
+    "  total INTEGER NOT NULL DEFAULT 0, "
+    "  unread INTEGER NOT NULL DEFAULT 0, "
+    "  sent INTEGER NOT NULL DEFAULT 0, "
+    "  lastEventId INTEGER, "
+    "  lastEventTime INTEGER, "
+    "  FOREIGN KEY(groupId) REFERENCES Groups(id) ON DELETE CASCADE "
+    ")",
+
+    "CREATE TRIGGER IF NOT EXISTS groupStats_groupInsert AFTER INSERT ON Groups "
+    "BEGIN "
+    "  INSERT OR IGNORE INTO GroupStats (groupId) VALUES (new.id); "
+    "END",
+
+    "CREATE TRIGGER IF NOT EXISTS groupStats_eventInsert AFTER INSERT ON Events "
+    "WHEN new.groupId IS NOT NULL "
+    "BEGIN "
+    "  UPDATE GroupStats SET "
+    "    total = total + 1, "
+    "    unread = unread + IFNULL(new.isRead = 0, 0), "
+    "    sent = sent + IFNULL(new.direction = 2, 0) "
+    "  WHERE groupId = new.groupId; "
+    "  UPDATE GroupStats SET lastEventId = new.id, lastEventTime = new.startTime "
+    "  WHERE groupId = new.groupId AND (lastEventId IS NULL "
+    "    OR (lastEventTime IS NULL AND new.startTime IS NOT NULL) "
+    "    OR new.startTime > lastEventTime "
+    "    OR (new.startTime IS lastEventTime AND new.id > lastEventId)); "
+    "END",
+
+    "CREATE TRIGGER IF NOT EXISTS groupStats_eventDelete AFTER DELETE ON Events "
+    "WHEN old.groupId IS NOT NULL "
+    "BEGIN "
+    "  UPDATE GroupStats SET "
+    "    total = total - 1, "
+    "    unread = unread - IFNULL(old.isRead = 0, 0), "
+    "    sent = sent - IFNULL(old.direction = 2, 0) "
+    "  WHERE groupId = old.groupId; "
+    "  UPDATE GroupStats SET "
+    "    lastEventId = (SELECT id FROM Events WHERE groupId = old.groupId "
+    "                   ORDER BY startTime DESC, id DESC LIMIT 1), "
+    "    lastEventTime = (SELECT startTime FROM Events WHERE groupId = old.groupId "
+    "                     ORDER BY startTime DESC, id DESC LIMIT 1) "
+    "  WHERE groupId = old.groupId AND lastEventId = old.id; "
+    "END",
+
+    // Handled as removal from the old group followed by insertion into the new one
+    "CREATE TRIGGER IF NOT EXISTS groupStats_eventUpdate AFTER UPDATE OF groupId, isRead, direction, startTime ON Events "
+    "WHEN old.groupId IS NOT new.groupId OR old.isRead IS NOT new.isRead "
+    "  OR old.direction IS NOT new.direction OR old.startTime IS NOT new.startTime "
+    "BEGIN "
+    "  UPDATE GroupStats SET "
+    "    total = total - 1, "
+    "    unread = unread - IFNULL(old.isRead = 0, 0), "
+    "    sent = sent - IFNULL(old.direction = 2, 0) "
+    "  WHERE groupId = old.groupId; "
+    "  UPDATE GroupStats SET "
+    "    lastEventId = (SELECT id FROM Events WHERE groupId = old.groupId "
+    "                   ORDER BY startTime DESC, id DESC LIMIT 1), "
+    "    lastEventTime = (SELECT startTime FROM Events WHERE groupId = old.groupId "
+    "                     ORDER BY startTime DESC, id DESC LIMIT 1) "
+    "  WHERE groupId = old.groupId AND lastEventId = old.id; "
+    "  UPDATE GroupStats SET "
+    "    total = total + 1, "
+    "    unread = unread + IFNULL(new.isRead = 0, 0), "
+    "    sent = sent + IFNULL(new.direction = 2, 0) "
+    "  WHERE groupId = new.groupId; "
+    "  UPDATE GroupStats SET lastEventId = new.id, lastEventTime = new.startTime "
+    "  WHERE groupId = new.groupId AND (lastEventId IS NULL "
+    "    OR (lastEventTime IS NULL AND new.startTime IS NOT NULL) "
+    "    OR new.startTime > lastEventTime "
+    "    OR (new.startTime IS lastEventTime AND new.id > lastEventId)); "
+    "END"
+};
+static int db_groupStats_count = sizeof(db_groupStats) / sizeof(*db_groupStats);
+
+static const char *db_rebuildGroupStats[] = {
+    "DELETE FROM GroupStats",
+
+    "INSERT INTO GroupStats (groupId, total, unread, sent, lastEventId, lastEventTime) "
+    "SELECT "
+    "  Groups.id, "
+    "  IFNULL(EventCount.total, 0), "
+    "  IFNULL(EventCount.unread, 0), "
+    "  IFNULL(EventCount.sent, 0), "
+    "  LastEvent.id, "
+    "  LastEvent.startTime "
+    "FROM Groups "
+    "LEFT JOIN ( "
+    "  SELECT "
+    "    groupId, "
+    "    COUNT(id) AS total, "
+    "    COUNT(NULLIF(isRead = 0, 0)) AS unread, "
+    "    COUNT(NULLIF(direction = 2, 0)) AS sent "
+    "  FROM Events GROUP BY groupId "
+    ") AS EventCount ON (EventCount.groupId = Groups.id) "
+    "LEFT JOIN Events AS LastEvent ON (LastEvent.id = ( "
+    "  SELECT id FROM Events "
+    "  WHERE groupId = Groups.id "
+    "  ORDER BY startTime DESC, id DESC "
+    "  LIMIT 1 "
+    ") )"
+};
+static int db_rebuildGroupStats_count = sizeof(db_rebuildGroupStats) / sizeof(*db_rebuildGroupStats);
+
+// Indexes for the event queries of the models, superseding the single
+// column indexes of the original schema
+static const char *db_eventIndexes[] = {
+    "DROP INDEX IF EXISTS events_remoteUid",
+    "DROP INDEX IF EXISTS events_type",
+    "DROP INDEX IF EXISTS events_groupId",
+
+    // ConversationModel
+    "CREATE INDEX IF NOT EXISTS events_groupId_endTime ON Events (groupId, endTime DESC, id DESC)",
+    // GroupStats last event
+    "CREATE INDEX IF NOT EXISTS events_groupId_startTime ON Events (groupId, startTime DESC, id DESC)",
+    // CallModel, all calls
+    "CREATE INDEX IF NOT EXISTS events_type_startTime ON Events (type, startTime DESC, id DESC)",
+    // CallModel, filtered by call type
+    "CREATE INDEX IF NOT EXISTS events_type_direction_missed ON Events (type, direction, isMissedCall, startTime DESC, id DESC)",
+    // RecentContactsModel and lookups by remote UID
+    "CREATE INDEX IF NOT EXISTS events_remoteUid_localUid ON Events (remoteUid, localUid, startTime)"
+};
+static int db_eventIndexes_count = sizeof(db_eventIndexes) / sizeof(*db_eventIndexes);
+
 static bool execute(QSqlDatabase &database, const QString &statement)
 {
     QSqlQuery query(database);
@@ -112,30 +287,340 @@ static bool execute(QSqlDatabase &database, const QString &statement)
     }
 }
 
+static bool executeAll(QSqlDatabase &database, const char **statements, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        if (!execute(database, QLatin1String(statements[i])))
+            return false;
+    }
+    return true;
+}
+
 static bool prepareDatabase(QSqlDatabase &database)
 {
     if (!database.transaction())
         return false;
 
-    bool error = false;
-    for (int i = 0; i < db_schema_count; ++i) {
-        QSqlQuery query(database);
+    if (!executeAll(database, db_schema, db_schema_count)) {
+        qWarning() << "Table creation failed";
+        database.rollback();
+        return false;
+    }
 
-        if (!query.exec(QLatin1String(db_schema[i]))) {
-            qWarning() << "Table creation failed";
-            qWarning() << query.lastError();
-            qWarning() << db_schema[i];
-            error = true;
-            break;
+    return database.commit();
+}
+
+static bool migrateGroupStats(QSqlDatabase &database)
+{
+    return executeAll(database, db_groupStats, db_groupStats_count)
+        && executeAll(database, db_rebuildGroupStats, db_rebuildGroupStats_count);
+}
+
+static bool migrateEventIndexes(QSqlDatabase &database)
+{
+    return executeAll(database, db_eventIndexes, db_eventIndexes_count);
+}
+
+// Converts a text column of all rows to the binary format of fieldencoding.h
+template<typename Decode, typename Encode>
+static bool convertTextColumn(QSqlDatabase &database, const QString &table, const QString &column,
+                              Decode decode, Encode encode)
+{
+    QSqlQuery select(database);
+    select.setForwardOnly(true);
+    if (!select.exec(QString::fromLatin1("SELECT id, %1 FROM %2 WHERE typeof(%1) = 'text'").arg(column).arg(table))) {
+        qWarning() << "Query failed";
+        qWarning() << select.lastError();
+        qWarning() << select.lastQuery();
+        return false;
+    }
+
+    QList<QPair<int, QByteArray> > rows;
+    while (select.next())
+        rows.append(qMakePair(select.value(0).toInt(), encode(decode(select.value(1).toString()))));
+    select.finish();
+
+    QSqlQuery update(database);
+    if (!update.prepare(QString::fromLatin1("UPDATE %1 SET %2 = :value WHERE id = :id").arg(table).arg(column))) {
+        qWarning() << "Failed to prepare query";
+        qWarning() << update.lastError();
+        return false;
+    }
+
+    for (int i = 0; i < rows.size(); i++) {
+        update.bindValue(QLatin1String(":value"), rows[i].second);
+        update.bindValue(QLatin1String(":id"), rows[i].first);
+        if (!update.exec()) {
+            qWarning() << "Query failed";
+            qWarning() << update.lastError();
+            qWarning() << update.lastQuery();
+            return false;
         }
     }
 
-    if (error) {
-        database.rollback();
+    return true;
+}
+
+static QHash<QString, QString> decodeTextHeaders(const QString &text)
+{
+    QHash<QString, QString> headers;
+    foreach (const QString &header, text.split(QChar('\x1c'))) {
+        QStringList fields = header.split(QChar('\x1d'));
+        if (fields.size() == 2)
+            headers.insert(fields.value(0), fields.value(1));
+    }
+    return headers;
+}
+
+static QStringList decodeTextRemoteUids(const QString &text)
+{
+    return text.split(QChar('\n'));
+}
+
+static bool migrateBinaryFields(QSqlDatabase &database)
+{
+    return convertTextColumn(database, QLatin1String("Events"), QLatin1String("headers"),
+                             decodeTextHeaders, CommHistory::encodeStringHash)
+        && convertTextColumn(database, QLatin1String("Groups"), QLatin1String("remoteUids"),
+                             decodeTextRemoteUids, CommHistory::encodeStringList);
+}
+
+static bool hasColumn(QSqlDatabase &database, const QString &table, const QString &column, bool &result)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QString::fromLatin1("PRAGMA table_info(%1)").arg(table))) {
+        qWarning() << "Query failed";
+        qWarning() << query.lastError();
+        qWarning() << query.lastQuery();
         return false;
-    } else {
-        return database.commit();
     }
+
+    // The second column of table_info is the column name
+    result = false;
+    while (query.next()) {
+        if (query.value(1).toString() == column)
+            result = true;
+    }
+    return true;
+}
+
+// Stores the call group of each call, for grouping calls in the database
+static bool migrateCallGroups(QSqlDatabase &database)
+{
+    // ALTER TABLE can not be repeated, e.g. after the version was reset
+    bool exists = false;
+    if (!hasColumn(database, QLatin1String("Events"), QLatin1String("callGroup"), exists))
+        return false;
+    if (!exists && !execute(database, QLatin1String("ALTER TABLE Events ADD COLUMN callGroup TEXT")))
+        return false;
+
+    QSqlQuery select(database);
+    select.setForwardOnly(true);
+    if (!select.exec(QString::fromLatin1("SELECT id, localUid, remoteUid, headers FROM Events WHERE type = %1")
+                     .arg(CommHistory::Event::CallEvent))) {
+        qWarning() << "Query failed";
+        qWarning() << select.lastError();
+        qWarning() << select.lastQuery();
+        return false;
+    }
+
+    QList<QPair<int, QString> > rows;
+    while (select.next()) {
+        CommHistory::Event event;
+        event.setType(CommHistory::Event::CallEvent);
+        event.setLocalUid(select.value(1).toString());
+        event.setRemoteUid(select.value(2).toString());
+        event.setEncodedHeaders(select.value(3).toByteArray());
+        rows.append(qMakePair(select.value(0).toInt(), CommHistory::DatabaseIOPrivate::makeCallGroupURI(event)));
+    }
+    select.finish();
+
+    QSqlQuery update(database);
+    if (!update.prepare(QLatin1String("UPDATE Events SET callGroup = :callGroup WHERE id = :id"))) {
+        qWarning() << "Failed to prepare query";
+        qWarning() << update.lastError();
+        return false;
+    }
+
+    for (int i = 0; i < rows.size(); i++) {
+        update.bindValue(QLatin1String(":callGroup"), rows[i].second);
+        update.bindValue(QLatin1String(":id"), rows[i].first);
+        if (!update.exec()) {
+            qWarning() << "Query failed";
+            qWarning() << update.lastError();
+            qWarning() << update.lastQuery();
+            return false;
+        }
+    }
+
+    // CallModel, grouped in the database
+    return execute(database, QLatin1String("CREATE INDEX IF NOT EXISTS events_type_callGroup "
+                                           "ON Events (type, callGroup, startTime DESC, id DESC)"));
+}
+
+// Schema changes applied on top of db_schema, in order. The database
+// version (PRAGMA user_version) is the number of migrations applied.
+// Append new migrations to the end; never reorder or remove them.
+typedef bool (*Migration)(QSqlDatabase &database);
+static const Migration db_migrations[] = {
+    migrateGroupStats,
+    migrateEventIndexes,
+    migrateBinaryFields,
+    migrateCallGroups
+};
+static int db_migrations_count = sizeof(db_migrations) / sizeof(*db_migrations);
+
+// Databases created before incremental vacuum was enabled in db_create
+// never return free pages to the file system. Changing auto_vacuum
+// takes a VACUUM, which can not run in a transaction, so this is checked
+// on every open rather than being a versioned migration. A failure,
+// e.g. while another connection is busy, is retried on the next open.
+static bool enableIncrementalVacuum(QSqlDatabase &database)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QLatin1String("PRAGMA auto_vacuum")) || !query.next()) {
+        qWarning() << "Failed to query auto_vacuum";
+        qWarning() << query.lastError();
+        return false;
+    }
+
+    // 2 is INCREMENTAL
+    if (query.value(0).toInt() == 2)
+        return true;
+    query.finish();
+
+    QElapsedTimer timer;
+    timer.start();
+    if (!execute(database, QLatin1String("PRAGMA auto_vacuum = INCREMENTAL"))
+            || !execute(database, QLatin1String("VACUUM"))) {
+        qWarning() << "Failed to enable incremental vacuum";
+        return false;
+    }
+
+    qWarning() << "Enabled incremental vacuum for commhistory database in"
+               << timer.elapsed() << "ms";
+    return true;
+}
+
+static int databaseVersion(QSqlDatabase &database)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QLatin1String("PRAGMA user_version")) || !query.next()) {
+        qWarning() << "Failed to query database version";
+        qWarning() << query.lastError();
+        return -1;
+    }
+    return query.value(0).toInt();
+}
+
+static bool migrateDatabase(QSqlDatabase &database)
+{
+    // Connections to an up to date database don't take the write lock
+    int version = databaseVersion(database);
+    if (version < 0)
+        return false;
+
+    while (version < db_migrations_count) {
+        QElapsedTimer timer;
+        timer.start();
+
+        // Other connections and processes may migrate at the same time; the
+        // version is read again under the write lock, so each step runs once
+        if (!execute(database, QLatin1String("BEGIN IMMEDIATE")))
+            return false;
+
+        version = databaseVersion(database);
+        if (version < 0) {
+            execute(database, QLatin1String("ROLLBACK"));
+            return false;
+        }
+
+        if (version >= db_migrations_count) {
+            execute(database, QLatin1String("ROLLBACK"));
+            break;
+        }
+
+        if (!db_migrations[version](database)
+                || !execute(database, QString::fromLatin1("PRAGMA user_version = %1").arg(version + 1))) {
+            qWarning() << "Failed to migrate database to version" << version + 1;
+            execute(database, QLatin1String("ROLLBACK"));
+            return false;
+        }
+
+        if (!execute(database, QLatin1String("COMMIT"))) {
+            execute(database, QLatin1String("ROLLBACK"));
+            return false;
+        }
+
+        version++;
+        qWarning() << "Migrated commhistory database to version" << version
+                   << "in" << timer.elapsed() << "ms";
+    }
+
+    if (version > db_migrations_count) {
+        qWarning() << "Database version" << version << "is newer than supported version"
+                   << db_migrations_count;
+    }
+
+    return true;
+}
+
+static DatabaseTuning loadTuning()
+{
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope,
+                       QLatin1String("commhistory"), QLatin1String("database"));
+
+    QString name = QString::fromLocal8Bit(qgetenv("COMMHISTORY_DATABASE_PROFILE"));
+    if (name.isEmpty())
+        name = settings.value(QLatin1String("profile")).toString();
+
+    const TuningProfile *profile = &db_profiles[0];
+    if (!name.isEmpty()) {
+        int i = 0;
+        for (; i < db_profiles_count; i++) {
+            if (name == QLatin1String(db_profiles[i].name))
+                break;
+        }
+
+        if (i < db_profiles_count)
+            profile = &db_profiles[i];
+        else
+            qWarning() << "Unknown commhistory database profile" << name << "- using" << profile->name;
+    }
+
+    DatabaseTuning tuning;
+    tuning.profile = QLatin1String(profile->name);
+    tuning.mmapSize = settings.value(QLatin1String("mmapSize"), profile->mmapSize).toLongLong();
+    tuning.cacheSize = settings.value(QLatin1String("cacheSize"), profile->cacheSize).toInt();
+    tuning.synchronous = settings.value(QLatin1String("synchronous"), QLatin1String(profile->synchronous)).toString();
+    tuning.walAutoCheckpoint = settings.value(QLatin1String("walAutoCheckpoint"), profile->walAutoCheckpoint).toInt();
+    tuning.pageSize = settings.value(QLatin1String("pageSize"), profile->pageSize).toInt();
+    return tuning;
+}
+
+static const DatabaseTuning &databaseTuning()
+{
+    static const DatabaseTuning tuning = loadTuning();
+    return tuning;
+}
+
+static QStringList tuningStatements(const DatabaseTuning &tuning)
+{
+    QStringList statements;
+    if (tuning.mmapSize >= 0)
+        statements << QString::fromLatin1("PRAGMA mmap_size = %1").arg(tuning.mmapSize);
+    if (tuning.cacheSize != -1)
+        statements << QString::fromLatin1("PRAGMA cache_size = %1").arg(tuning.cacheSize);
+    if (!tuning.synchronous.isEmpty())
+        statements << QString::fromLatin1("PRAGMA synchronous = %1").arg(tuning.synchronous);
+    if (tuning.walAutoCheckpoint >= 0)
+        statements << QString::fromLatin1("PRAGMA wal_autocheckpoint = %1").arg(tuning.walAutoCheckpoint);
+    return statements;
+}
+
+QString CommHistoryDatabase::tuningProfile()
+{
+    return databaseTuning().profile;
 }
 
 QSqlDatabase CommHistoryDatabase::open(const QString &databaseName)
@@ -164,6 +649,24 @@ QSqlDatabase CommHistoryDatabase::open(const QString &databaseName)
         qWarning() << "Opened commhistory database:" << databaseFile;
     }
 
+    const DatabaseTuning &tuning = databaseTuning();
+
+    if (!exists) {
+        QStringList statements;
+        if (tuning.pageSize > 0)
+            statements << QString::fromLatin1("PRAGMA page_size = %1").arg(tuning.pageSize);
+        for (int i = 0; i < db_create_count; i++)
+            statements << QLatin1String(db_create[i]);
+
+        foreach (const QString &statement, statements) {
+            if (!execute(database, statement)) {
+                database.close();
+                QFile::remove(databaseFile);
+                return database;
+            }
+        }
+    }
+
     for (int i = 0; i < db_setup_count; i++) {
         if (!execute(database, QLatin1String(db_setup[i]))) {
             database.close();
@@ -173,11 +676,21 @@ QSqlDatabase CommHistoryDatabase::open(const QString &databaseName)
         }
     }
 
-    if (!exists && !prepareDatabase(database)) {
+    // Tuning is not essential; a rejected value only costs performance
+    foreach (const QString &statement, tuningStatements(tuning))
+        execute(database, statement);
+
+    if ((!exists && !prepareDatabase(database)) || !migrateDatabase(database)) {
         database.close();
-        QFile::remove(databaseFile);
+        if (!exists)
+            QFile::remove(databaseFile);
+        return database;
     }
 
+    // Not essential either; without it the file only does not shrink
+    if (exists)
+        enableIncrementalVacuum(database);
+
     return database;
 }
 
@@ -194,3 +707,7 @@ QSqlQuery CommHistoryDatabase::prepare(const char *statement, const QSqlDatabase
     return query;
 }
 
+bool CommHistoryDatabase::rebuildGroupStats(QSqlDatabase &database)
+{
+    return executeAll(database, db_rebuildGroupStats, db_rebuildGroupStats_count);
+}
@@ -30,6 +30,18 @@ class CommHistoryDatabase
 public:
     static QSqlDatabase open(const QString &databaseName);
     static QSqlQuery prepare(const char *statement, const QSqlDatabase &database);
+
+    /*!
+     * Name of the SQLite tuning profile applied to opened connections.
+     * See db_profiles in commhistorydatabase.cpp.
+     */
+    static QString tuningProfile();
+
+    /*!
+     * Recalculates the GroupStats table from Events. Must be called
+     * within a transaction.
+     */
+    static bool rebuildGroupStats(QSqlDatabase &database);
 };
 
 #endif
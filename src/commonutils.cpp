@@ -28,6 +28,8 @@
 
 #include <QString>
 #include <QSettings>
+#include <QCache>
+#include <QMutex>
 
 namespace {
 
@@ -51,11 +53,48 @@ int phoneNumberMatchLength()
     return numberMatchLength;
 }
 
-}
+// Normalized and minimized forms of recently used remote uids. Matching is
+// done in the inner loops of call grouping and contact resolving, usually
+// with a small set of addresses, and the conversions are expensive.
+const int NUMBER_CACHE_SIZE = 1024;
 
-namespace CommHistory {
+struct NumberCache
+{
+    NumberCache()
+        : normalized(NUMBER_CACHE_SIZE),
+          minimized(NUMBER_CACHE_SIZE)
+    {
+    }
 
-LIBCOMMHISTORY_EXPORT QString normalizePhoneNumber(const QString &number)
+    QMutex mutex;
+    QCache<QString, QString> normalized;
+    QCache<QString, QString> minimized;
+};
+
+Q_GLOBAL_STATIC(NumberCache, numberCache)
+
+QString cachedNumber(QCache<QString, QString> NumberCache::*forms, const QString &number,
+                     QString (*convert)(const QString &))
+{
+    NumberCache *cache = numberCache();
+    if (!cache)
+        return convert(number);
+
+    {
+        QMutexLocker locker(&cache->mutex);
+        const QString *result = (cache->*forms).object(number);
+        if (result)
+            return *result;
+    }
+
+    QString result = convert(number);
+
+    QMutexLocker locker(&cache->mutex);
+    (cache->*forms).insert(number, new QString(result));
+    return result;
+}
+
+QString convertNormalized(const QString &number)
 {
     // Validate the number, and retain the dial string
     QtContactsSqliteExtensions::NormalizePhoneNumberFlags flags(QtContactsSqliteExtensions::ValidatePhoneNumber |
@@ -64,8 +103,25 @@ LIBCOMMHISTORY_EXPORT QString normalizePhoneNumber(const QString &number)
     return QtContactsSqliteExtensions::normalizePhoneNumber(number, flags);
 }
 
+QString convertMinimized(const QString &number)
+{
+    return QtContactsSqliteExtensions::minimizePhoneNumber(number, phoneNumberMatchLength());
+}
+
+}
+
+namespace CommHistory {
+
+LIBCOMMHISTORY_EXPORT QString normalizePhoneNumber(const QString &number)
+{
+    return cachedNumber(&NumberCache::normalized, number, convertNormalized);
+}
+
 LIBCOMMHISTORY_EXPORT bool remoteAddressMatch(const QString &uid, const QString &match)
 {
+    if (uid == match)
+        return true;
+
     QString phone = normalizePhoneNumber(uid);
 
     // IM
@@ -111,7 +167,7 @@ LIBCOMMHISTORY_EXPORT bool remoteAddressMatch(const QStringList &uids, const QSt
 
 LIBCOMMHISTORY_EXPORT QString makeShortNumber(const QString &number)
 {
-    return QtContactsSqliteExtensions::minimizePhoneNumber(number, phoneNumberMatchLength());
+    return cachedNumber(&NumberCache::minimized, number, convertMinimized);
 }
 
 }
@@ -29,13 +29,23 @@ namespace CommHistory {
 #define COMM_HISTORY_SERVICE_NAME  QLatin1String("com.nokia.commhistory")
 #define COMM_HISTORY_OBJECT_PATH   QLatin1String("/CommHistoryModel")
 
+// Added and updated events are also sent on these paths with the feed
+// interface, so that models can listen to only the changes they show
+#define COMM_HISTORY_FEED_INTERFACE QLatin1String("com.nokia.commhistory.feed")
+#define COMM_HISTORY_CALLS_PATH    QLatin1String("/CommHistoryModel/calls")
+#define COMM_HISTORY_GROUP_PATH    QLatin1String("/CommHistoryModel/groups/%1")
+#define COMM_HISTORY_UNSORTED_PATH QLatin1String("/CommHistoryModel/unsorted")
+
 #define EVENTS_ADDED_SIGNAL        QLatin1String("eventsAdded")
 #define EVENTS_UPDATED_SIGNAL      QLatin1String("eventsUpdated")
+#define EVENT_PROPERTIES_UPDATED_SIGNAL QLatin1String("eventPropertiesUpdated")
 #define EVENT_DELETED_SIGNAL       QLatin1String("eventDeleted")
+#define EVENTS_DELETED_SIGNAL      QLatin1String("eventsDeleted")
 
 #define GROUPS_ADDED_SIGNAL        QLatin1String("groupsAdded")
 #define GROUPS_UPDATED_SIGNAL      QLatin1String("groupsUpdated")
 #define GROUPS_UPDATED_FULL_SIGNAL QLatin1String("groupsUpdatedFull")
+#define GROUPS_MARKED_READ_SIGNAL  QLatin1String("groupsMarkedRead")
 #define GROUPS_DELETED_SIGNAL      QLatin1String("groupsDeleted")
 
 } /* namespace CommHistory */
@@ -0,0 +1,241 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include "contactcache.h"
+#include "commonutils.h"
+#include "debug.h"
+
+using namespace CommHistory;
+
+namespace {
+
+// Unknown numbers are queried again after this
+const int DEFAULT_UNKNOWN_TIMEOUT = 5 * 60 * 1000;
+
+}
+
+QWeakPointer<ContactCache> ContactCache::m_instance;
+
+ContactCache::ContactCache()
+    : QObject(0),
+      m_unknownTimeout(DEFAULT_UNKNOWN_TIMEOUT)
+{
+    m_clock.start();
+}
+
+ContactCache::~ContactCache()
+{
+}
+
+QSharedPointer<ContactCache> ContactCache::instance()
+{
+    QSharedPointer<ContactCache> result;
+    if (!m_instance) {
+        result = QSharedPointer<ContactCache>(new ContactCache());
+        m_instance = result.toWeakRef();
+    } else {
+        result = m_instance.toStrongRef();
+    }
+
+    return result;
+}
+
+ContactCache::Key ContactCache::key(const QString &localUid, const QString &remoteUid)
+{
+    if (!CommHistory::normalizePhoneNumber(remoteUid).isEmpty())
+        return qMakePair(QString(), CommHistory::makeShortNumber(remoteUid));
+
+    return qMakePair(localUid, remoteUid.toLower());
+}
+
+QSet<ContactCache::Key> ContactCache::addressKeys(const QList<ContactAddress> &contactAddresses)
+{
+    QSet<Key> keys;
+    foreach (const ContactAddress &address, contactAddresses)
+        keys.insert(key(address.localUid, address.remoteUid));
+    return keys;
+}
+
+void ContactCache::startListening()
+{
+    if (m_listener)
+        return;
+
+    DEBUG() << Q_FUNC_INFO;
+
+    m_listener = ContactListener::instance();
+    connect(m_listener.data(),
+            SIGNAL(contactUpdated(quint32, const QString&, const QList<ContactAddress>&)),
+            this,
+            SLOT(slotContactUpdated(quint32, const QString&, const QList<ContactAddress>&)));
+    connect(m_listener.data(),
+            SIGNAL(contactRemoved(quint32)),
+            this,
+            SLOT(slotContactRemoved(quint32)));
+    connect(m_listener.data(),
+            SIGNAL(contactUnknown(const QPair<QString, QString>&)),
+            this,
+            SLOT(slotContactUnknown(const QPair<QString, QString>&)));
+}
+
+bool ContactCache::isListening() const
+{
+    return !m_listener.isNull();
+}
+
+QList<Event::Contact> ContactCache::contacts(const QString &localUid, const QString &remoteUid) const
+{
+    QHash<Key, Entry>::const_iterator it = m_entries.constFind(key(localUid, remoteUid));
+    if (it == m_entries.constEnd())
+        return QList<Event::Contact>();
+
+    return it->contacts;
+}
+
+void ContactCache::insert(const QString &localUid, const QString &remoteUid,
+                          const QList<Event::Contact> &contacts)
+{
+    if (contacts.isEmpty())
+        return;
+
+    Key k = key(localUid, remoteUid);
+    Entry &entry = m_entries[k];
+
+    foreach (const Event::Contact &contact, entry.contacts) {
+        if (!contacts.contains(contact))
+            m_contactKeys.remove(contact.first, k);
+    }
+
+    entry.contacts = contacts;
+    entry.state = Entry::Resolved;
+
+    foreach (const Event::Contact &contact, contacts) {
+        if (!m_contactKeys.contains(contact.first, k))
+            m_contactKeys.insert(contact.first, k);
+    }
+}
+
+void ContactCache::resolve(const QString &localUid, const QString &remoteUid)
+{
+    if (!m_listener)
+        return;
+
+    Key k = key(localUid, remoteUid);
+    QHash<Key, Entry>::iterator it = m_entries.find(k);
+    if (it != m_entries.end()) {
+        if (it->state != Entry::Unknown
+            || m_clock.elapsed() - it->unknownSince < m_unknownTimeout)
+            return;
+    } else {
+        it = m_entries.insert(k, Entry());
+    }
+
+    it->state = Entry::Pending;
+    m_listener->resolveContact(localUid, remoteUid);
+}
+
+void ContactCache::setUnknownTimeout(int msecs)
+{
+    m_unknownTimeout = msecs;
+}
+
+int ContactCache::unknownTimeout() const
+{
+    return m_unknownTimeout;
+}
+
+void ContactCache::removeContact(const Key &key, quint32 localId)
+{
+    QHash<Key, Entry>::iterator it = m_entries.find(key);
+    if (it == m_entries.end())
+        return;
+
+    QList<Event::Contact> &contacts(it->contacts);
+    for (int i = 0; i < contacts.count(); i++) {
+        if (static_cast<quint32>(contacts.at(i).first) == localId) {
+            contacts.removeAt(i);
+            break;
+        }
+    }
+
+    // Resolved again when next requested
+    if (contacts.isEmpty())
+        m_entries.erase(it);
+}
+
+void ContactCache::slotContactUpdated(quint32 localId,
+                                      const QString &contactName,
+                                      const QList<ContactAddress> &contactAddresses)
+{
+    QSet<Key> keys = addressKeys(contactAddresses);
+
+    // Addresses the contact no longer has
+    foreach (const Key &k, m_contactKeys.values(localId)) {
+        if (!keys.contains(k)) {
+            removeContact(k, localId);
+            m_contactKeys.remove(localId, k);
+        }
+    }
+
+    // Only addresses that have been requested are stored
+    foreach (const Key &k, keys) {
+        QHash<Key, Entry>::iterator it = m_entries.find(k);
+        if (it == m_entries.end())
+            continue;
+
+        QList<Event::Contact> &contacts(it->contacts);
+        int i = 0;
+        for (; i < contacts.count(); i++) {
+            if (static_cast<quint32>(contacts.at(i).first) == localId) {
+                contacts[i].second = contactName;
+                break;
+            }
+        }
+        if (i == contacts.count()) {
+            contacts.append(Event::Contact(localId, contactName));
+            m_contactKeys.insert(localId, k);
+        }
+        it->state = Entry::Resolved;
+    }
+
+    emit contactUpdated(localId, contactName, contactAddresses);
+}
+
+void ContactCache::slotContactRemoved(quint32 localId)
+{
+    foreach (const Key &k, m_contactKeys.values(localId))
+        removeContact(k, localId);
+    m_contactKeys.remove(localId);
+
+    emit contactRemoved(localId);
+}
+
+void ContactCache::slotContactUnknown(const QPair<QString, QString> &address)
+{
+    QHash<Key, Entry>::iterator it = m_entries.find(key(address.first, address.second));
+    if (it != m_entries.end() && it->contacts.isEmpty()) {
+        it->state = Entry::Unknown;
+        it->unknownSince = m_clock.elapsed();
+    }
+
+    emit contactUnknown(address);
+}
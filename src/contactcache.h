@@ -0,0 +1,144 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_CONTACTCACHE_H
+#define COMMHISTORY_CONTACTCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QSharedPointer>
+#include <QElapsedTimer>
+
+#include "event.h"
+#include "contactlistener.h"
+
+namespace CommHistory {
+
+/*!
+ * \class ContactCache
+ *
+ * Contacts of (local uid, remote uid) addresses, shared by all models of
+ * the process. Addresses are normalized with key(), so that the different
+ * forms of a phone number share an entry. Contact changes reported by
+ * ContactListener update only the entries of the changed contact, and are
+ * then forwarded with the same signals.
+ *
+ * Addresses that could not be resolved are remembered for unknownTimeout()
+ * milliseconds, during which resolve() does not query them again.
+ */
+class LIBCOMMHISTORY_EXPORT ContactCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef QPair<QString, QString> Key;
+    typedef ContactListener::ContactAddress ContactAddress;
+
+    /*!
+     * \returns The shared cache. It is released when the last reference
+     * is dropped.
+     */
+    static QSharedPointer<ContactCache> instance();
+
+    ~ContactCache();
+
+    /*!
+     * Normalized cache key of an address. Phone numbers are reduced to
+     * their last digits and match on any local uid; other addresses are
+     * compared case insensitively.
+     */
+    static Key key(const QString &localUid, const QString &remoteUid);
+    static QSet<Key> addressKeys(const QList<ContactAddress> &contactAddresses);
+
+    /*!
+     * Start listening to contact changes. Until then, resolve() does
+     * nothing and the cache only holds contacts given with insert().
+     */
+    void startListening();
+    bool isListening() const;
+
+    /*!
+     * Contacts of an address, empty if not resolved (yet).
+     */
+    QList<Event::Contact> contacts(const QString &localUid, const QString &remoteUid) const;
+
+    /*!
+     * Store the contacts of an address, for example from an event
+     * that was resolved by its sender.
+     */
+    void insert(const QString &localUid, const QString &remoteUid,
+                const QList<Event::Contact> &contacts);
+
+    /*!
+     * Request the contacts of an address, unless it is resolved, being
+     * resolved or recently found to be unknown. The result is reported
+     * with contactUpdated() or contactUnknown().
+     */
+    void resolve(const QString &localUid, const QString &remoteUid);
+
+    void setUnknownTimeout(int msecs);
+    int unknownTimeout() const;
+
+Q_SIGNALS:
+    void contactUpdated(quint32 localId,
+                        const QString &contactName,
+                        const QList<ContactAddress> &contactAddresses);
+    void contactRemoved(quint32 localId);
+    void contactUnknown(const QPair<QString, QString> &address);
+
+private Q_SLOTS:
+    void slotContactUpdated(quint32 localId,
+                            const QString &contactName,
+                            const QList<ContactAddress> &contactAddresses);
+    void slotContactRemoved(quint32 localId);
+    void slotContactUnknown(const QPair<QString, QString> &address);
+
+private:
+    ContactCache();
+
+    struct Entry {
+        enum State { Pending, Resolved, Unknown };
+
+        Entry() : state(Pending), unknownSince(0) {}
+
+        QList<Event::Contact> contacts;
+        State state;
+        qint64 unknownSince;
+    };
+
+    void removeContact(const Key &key, quint32 localId);
+
+    static QWeakPointer<ContactCache> m_instance;
+
+    QSharedPointer<ContactListener> m_listener;
+    QHash<Key, Entry> m_entries;
+    // contact id -> keys of the entries that contain it
+    QMultiHash<quint32, Key> m_contactKeys;
+    QElapsedTimer m_clock;
+    int m_unknownTimeout;
+};
+
+}
+
+#endif
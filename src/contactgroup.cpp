@@ -337,14 +337,17 @@ bool ContactGroup::markAsRead()
         return false;
 
     QList<Group> updated;
+    QList<int> updatedIds;
     foreach (GroupObject *group, d->groups) {
         if (group->unreadMessages()) {
             group->setUnreadMessages(0);
             updated.append(group->toGroup());
+            updatedIds.append(group->id());
         }
     }
 
-    emit UpdatesEmitter::instance()->groupsUpdatedFull(updated);
+    UpdatesEmitter::instance()->queueGroupsMarkedRead(updatedIds);
+    UpdatesEmitter::instance()->queueGroupsUpdatedFull(updated);
     return true;
 }
 
@@ -372,7 +375,7 @@ bool ContactGroup::deleteGroups()
     if (!database->commit())
         return false;
 
-    emit UpdatesEmitter::instance()->groupsDeleted(ids);
+    UpdatesEmitter::instance()->queueGroupsDeleted(ids);
     return true;
 }
 
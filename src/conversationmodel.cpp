@@ -28,6 +28,7 @@
 #include "eventmodel_p.h"
 #include "conversationmodel.h"
 #include "conversationmodel_p.h"
+#include "updatesemitter.h"
 #include "constants.h"
 #include "commhistorydatabase.h"
 #include "databaseio_p.h"
@@ -56,14 +57,13 @@ ConversationModelPrivate::ConversationModelPrivate(EventModel *model)
 
 {
     contactChangesEnabled = true;
-    QDBusConnection::sessionBus().connect(
-        QString(), QString(), "com.nokia.commhistory", "groupsUpdatedFull",
-        this, SLOT(groupsUpdatedFullSlot(const QList<CommHistory::Group> &)));
-    QDBusConnection::sessionBus().connect(
-        QString(), QString(), "com.nokia.commhistory", GROUPS_DELETED_SIGNAL,
-        this, SLOT(groupsDeletedSlot(const QList<int> &)));
+    connect(emitter.data(), SIGNAL(receivedGroupsUpdatedFull(const QList<CommHistory::Group> &)),
+            this, SLOT(groupsUpdatedFullSlot(const QList<CommHistory::Group> &)));
+    connect(emitter.data(), SIGNAL(receivedGroupsDeleted(const QList<int> &)),
+            this, SLOT(groupsDeletedSlot(const QList<int> &)));
     // remove call properties
     propertyMask -= unusedProperties;
+    updateSubscriptions();
 }
 
 void ConversationModelPrivate::groupsUpdatedFullSlot(const QList<CommHistory::Group> &groups)
@@ -153,6 +153,41 @@ bool ConversationModelPrivate::acceptsEvent(const Event &event) const
     return true;
 }
 
+void ConversationModelPrivate::eventsUpdatedSlot(const QList<Event> &events)
+{
+    // An update may move an event to a group that is not shown
+    QList<Event> updated;
+    foreach (const Event &event, events) {
+        if (event.validProperties().contains(Event::GroupId)
+            && !filterGroupIds.contains(event.groupId())
+            && findEvent(event.id()).isValid()) {
+            deleteFromModel(event.id());
+        } else {
+            updated.append(event);
+        }
+    }
+
+    EventModelPrivate::eventsUpdatedSlot(updated);
+}
+
+QStringList ConversationModelPrivate::subscriptionPaths() const
+{
+    QList<int> groupIds = filterGroupIds.toList();
+    qSort(groupIds);
+
+    QStringList paths;
+    foreach (int id, groupIds)
+        paths << QString(COMM_HISTORY_GROUP_PATH).arg(id);
+    paths << COMM_HISTORY_UNSORTED_PATH;
+    return paths;
+}
+
+bool ConversationModelPrivate::supportsColumnStorage() const
+{
+    // The next chunk is selected by the last event in the tree
+    return false;
+}
+
 bool ConversationModelPrivate::fillModel(int start, int end, QList<CommHistory::Event> events)
 {
     Q_UNUSED(start);
@@ -174,9 +209,14 @@ bool ConversationModelPrivate::fillModel(int start, int end, QList<CommHistory::
     return true;
 }
 
-QSqlQuery ConversationModelPrivate::buildQuery() const
+/* Events are read in (endTime, id) order, newest first. With a limit, only
+ * one chunk is read; the next chunk is selected by the key of the last event
+ * in the model instead of an OFFSET, so each chunk costs the same regardless
+ * of how far the model has been scrolled.
+ */
+QSqlQuery ConversationModelPrivate::buildQuery(uint limit, const Event *after) const
 {
-    QString q = DatabaseIOPrivate::eventQueryBase();
+    QString q = DatabaseIOPrivate::eventQueryBase(queryProperties());
 
     q += "WHERE Events.isDraft = 0 AND Events.isDeleted = 0 ";
 
@@ -196,18 +236,31 @@ QSqlQuery ConversationModelPrivate::buildQuery() const
         QStringList ids;
         foreach (int id, filterGroupIds)
             ids.append(QString::number(id));
-        q += "AND Events.groupId IN (" + ids.join(QLatin1String(",")) + ")";
+        q += "AND Events.groupId IN (" + ids.join(QLatin1String(",")) + ") ";
+    }
+
+    if (after) {
+        q += "AND (Events.endTime < :afterEndTime "
+             "OR (Events.endTime = :afterEndTimeEq AND Events.id < :afterId)) ";
     }
 
     q += "ORDER BY Events.endTime DESC, Events.id DESC";
 
-    QSqlQuery query = CommHistoryDatabase::prepare(q.toLatin1(), DatabaseIOPrivate::instance()->connection());
+    if (limit > 0)
+        q += QString::fromLatin1(" LIMIT %1").arg(limit);
+
+    QSqlQuery query = CommHistoryDatabase::prepare(q.toLatin1(), DatabaseIOPrivate::instance()->readConnection());
     if (!filterAccount.isEmpty())
         query.bindValue(":filterAccount", filterAccount);
     if (filterType != Event::UnknownType)
         query.bindValue(":filterType", filterType);
     if (filterDirection != Event::UnknownDirection)
         query.bindValue(":filterDirection", filterDirection);
+    if (after) {
+        query.bindValue(":afterEndTime", after->endTime().toTime_t());
+        query.bindValue(":afterEndTimeEq", after->endTime().toTime_t());
+        query.bindValue(":afterId", after->id());
+    }
 
     return query;
 }
@@ -243,10 +296,35 @@ void ConversationModelPrivate::extraReceivedSlot(QList<CommHistory::Event> event
     }
 }
 
+uint ConversationModelPrivate::currentChunkSize() const
+{
+    return (firstFetch && firstChunkSize > 0) ? firstChunkSize : chunkSize;
+}
+
 bool ConversationModelPrivate::isModelReady() const
 {
-    return activeQueries == 0
-           && eventsFilled < (firstFetch ? firstChunkSize : chunkSize);
+    if (activeQueries > 0)
+        return false;
+
+    // In streamed mode, a chunk that was not filled completely was the
+    // last one; a chunk size of 0 fetches everything in one query
+    if (queryMode != EventModel::StreamedAsyncQuery)
+        return true;
+
+    uint size = currentChunkSize();
+    return size == 0 || eventsFilled < size;
+}
+
+void ConversationModelPrivate::cancelQuery()
+{
+    EventModelPrivate::cancelQuery();
+
+    // Results of cancelled queries never arrive, so fetchMore() must not
+    // wait for them; the cancelled chunk may not have been the last one
+    if (activeQueries > 0) {
+        activeQueries = 0;
+        eventsFilled = currentChunkSize();
+    }
 }
 
 ConversationModel::ConversationModel(QObject *parent)
@@ -285,15 +363,26 @@ bool ConversationModel::getEvents(QList<int> groupIds)
     Q_D(ConversationModel);
 
     d->filterGroupIds = QSet<int>::fromList(groupIds);
+    d->updateSubscriptions();
 
     beginResetModel();
     d->clearEvents();
     endResetModel();
 
+    d->firstFetch = true;
+    d->eventsFilled = 0;
+    d->activeQueries = 0;
+
     if (groupIds.isEmpty())
         return true;
 
-    QSqlQuery query = d->buildQuery();
+    if (d->queryMode != EventModel::StreamedAsyncQuery) {
+        QSqlQuery query = d->buildQuery();
+        return d->executeQuery(query);
+    }
+
+    QSqlQuery query = d->buildQuery(d->currentChunkSize());
+    d->activeQueries++;
     return d->executeQuery(query);
 }
 
@@ -308,33 +397,20 @@ bool ConversationModel::canFetchMore(const QModelIndex &parent) const
 void ConversationModel::fetchMore(const QModelIndex &parent)
 {
     Q_UNUSED(parent);
+    Q_D(ConversationModel);
 
-    qWarning() << Q_FUNC_INFO << "NOT IMPLEMENTED";
-
-#if 0
     // isModelReady() is true when there are no more events to request
-    if (d->isModelReady() || d->eventRootItem->childCount() < 1)
+    if (d->isModelReady() || d->activeQueries > 0 || d->eventRootItem->childCount() < 1)
         return;
 
-    EventsQuery query = d->buildQuery();
+    Event last = d->eventRootItem->eventAt(d->eventRootItem->childCount() - 1);
 
-    Event &event = d->eventRootItem->eventAt(d->eventRootItem->childCount() - 1);
-
-    query.addProjection(QLatin1String("tracker:id(%1)")).variable(Event::Id);
-    query.addPattern(QString(QLatin1String("FILTER (%3 < \"%1\"^^xsd:dateTime || (%3 = \"%1\"^^xsd:dateTime && tracker:id(%4) < %2))"))
-                     .arg(event.endTime().toUTC().toString(Qt::ISODate)).arg(d->lastEventTrackerId))
-        .variable(Event::EndTime)
-        .variable(Event::Id);
-    query.addModifier(QLatin1String("LIMIT ") + QString::number(d->chunkSize));
-
-    QString sparqlQuery = query.query();
-    d->queryRunner->runEventsQuery(sparqlQuery, query.eventProperties());
     d->eventsFilled = 0;
     d->firstFetch = false;
-    d->activeQueries++;
 
-    d->queryRunner->startQueue();
-#endif
+    QSqlQuery query = d->buildQuery(d->currentChunkSize(), &last);
+    d->activeQueries++;
+    d->executeQuery(query);
 }
 
 }
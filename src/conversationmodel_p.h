@@ -44,11 +44,16 @@ public:
                       const QList<Event::Contact> &contacts,
                       const QString &remoteUid);
     bool acceptsEvent(const Event &event) const;
+    QStringList subscriptionPaths() const;
     bool fillModel(int start, int end, QList<CommHistory::Event> events);
-    QSqlQuery buildQuery() const;
+    bool supportsColumnStorage() const;
+    QSqlQuery buildQuery(uint limit = 0, const Event *after = 0) const;
+    uint currentChunkSize() const;
     bool isModelReady() const;
+    void cancelQuery();
 
 public Q_SLOTS:
+    void eventsUpdatedSlot(const QList<CommHistory::Event> &events);
     void groupsUpdatedFullSlot(const QList<CommHistory::Group> &groups);
     virtual void modelUpdatedSlot(bool successful);
     void extraReceivedSlot(QList<CommHistory::Event> events, QVariantList extra);
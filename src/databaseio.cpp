@@ -25,15 +25,91 @@
 #include "commhistorydatabase.h"
 #include "group.h"
 #include "mmscontentdeleter.h"
+#include "databasemaintenance.h"
+#include "fieldencoding.h"
 #include "contactlistener.h"
 #include <QSqlQuery>
 #include <QSqlError>
+#include <QThreadStorage>
+#include <QMutex>
+#include <QTimer>
 #include "debug.h"
 
 using namespace CommHistory;
 
 Q_GLOBAL_STATIC(DatabaseIO, databaseIO)
 
+namespace {
+// Upper bound for distinct cached statements; dynamic insert/update
+// statements vary with the set of written properties.
+static const int maxCachedQueries = 64;
+
+// Time without changes before maintenance runs
+static const int maintenanceIdleInterval = 10000;
+
+typedef QHash<QByteArray, QSqlQuery> QueryCache;
+
+QSqlQuery lookupQuery(QueryCache &cache, const QByteArray &statement, QSqlDatabase &database, bool &hit)
+{
+    QueryCache::iterator it = cache.find(statement);
+    if (it != cache.end()) {
+        hit = true;
+        // Release the result set left over from the previous use
+        it->finish();
+        return *it;
+    }
+
+    hit = false;
+    QSqlQuery query = CommHistoryDatabase::prepare(statement.constData(), database);
+    if (query.lastQuery().isEmpty())
+        return query;
+
+    if (cache.count() >= maxCachedQueries) {
+        DEBUG() << Q_FUNC_INFO << "Query cache full, clearing";
+        cache.clear();
+    }
+
+    // Copies share the prepared statement with the cached instance
+    cache.insert(statement, query);
+    return query;
+}
+
+// SQLite connections may only be used from the thread that opened them,
+// so every reader thread keeps its own connection and statement cache.
+class ReadConnection
+{
+public:
+    ReadConnection()
+        : name(QString::fromLatin1("commhistory-read-%1").arg(quintptr(QThread::currentThreadId())))
+    {
+        database = CommHistoryDatabase::open(name);
+        if (!database.isOpen())
+            return;
+
+        QSqlQuery query(database);
+        if (!query.exec(QLatin1String("PRAGMA query_only = 1"))) {
+            qWarning() << "Failed to make read connection read-only";
+            qWarning() << query.lastError();
+        }
+    }
+
+    ~ReadConnection()
+    {
+        queryCache.clear();
+        database.close();
+        database = QSqlDatabase();
+        QSqlDatabase::removeDatabase(name);
+    }
+
+    QString name;
+    QSqlDatabase database;
+    QueryCache queryCache;
+};
+
+QThreadStorage<ReadConnection *> readConnections;
+
+}
+
 class QueryHelper {
 public:
     typedef QPair<QByteArray,QVariant> Field;
@@ -55,13 +131,18 @@ public:
         q.replace(":fields", fieldsStr);
         q.replace(":values", valuesStr);
 
-        QSqlQuery query = CommHistoryDatabase::prepare(q, DatabaseIOPrivate::instance()->connection());
-        foreach (const Field &field, fields) 
-            query.bindValue(QString::fromLatin1(":" + field.first), field.second);
+        QSqlQuery query = DatabaseIOPrivate::instance()->cachedQuery(q);
+        bindFields(query, fields);
 
         return query;
     }
 
+    static void bindFields(QSqlQuery &query, const FieldList &fields)
+    {
+        foreach (const Field &field, fields)
+            query.bindValue(QString::fromLatin1(":" + field.first), field.second);
+    }
+
     static QSqlQuery updateQuery(QByteArray q, const FieldList &fields)
     {
         QByteArray fieldsStr;
@@ -70,9 +151,8 @@ public:
         fieldsStr.chop(2);
         q.replace(":fields", fieldsStr);
 
-        QSqlQuery query = CommHistoryDatabase::prepare(q, DatabaseIOPrivate::instance()->connection());
-        foreach (const Field &field, fields)
-            query.bindValue(QString::fromLatin1(":" + field.first), field.second);
+        QSqlQuery query = DatabaseIOPrivate::instance()->cachedQuery(q);
+        bindFields(query, fields);
 
         return query;
     }
@@ -81,6 +161,8 @@ public:
     {
         FieldList fields;
 
+        // Property sets iterate in property order, so that the same set of
+        // properties always produces the same (cached) statement.
         foreach (Event::Property property, properties) {
             switch (property) {
                 case Event::Type:
@@ -171,16 +253,9 @@ public:
                     fields.append(QueryHelper::Field("isAction", event.isAction()));
                     break;
                 case Event::Headers:
-                    {
-                        QHash<QString,QString> headers = event.headers();
-                        QString re;
-                        for (QHash<QString,QString>::iterator it = headers.begin(); it != headers.end(); it++) {
-                            if (!re.isEmpty())
-                                re += '\x1c';
-                            re += it.key() + '\x1d' + it.value();
-                        }
-                        fields.append(QueryHelper::Field("headers", re));
-                    }
+                    // Empty headers are stored as NULL
+                    fields.append(QueryHelper::Field("headers", event.encodedHeaders()));
+                    break;
                 /* Irrelevant properties from Event */
                 case Event::Id:
                 case Event::ContactId:
@@ -203,6 +278,17 @@ public:
             }
         }
 
+        // Calls keep their call group for grouping in the database (see
+        // CallModel::setDatabaseGrouping()). Other events write it as NULL,
+        // so that all events of addEvents() bind the same fields.
+        if (properties.contains(Event::Type) || properties.contains(Event::LocalUid)
+            || properties.contains(Event::RemoteUid) || properties.contains(Event::Headers)) {
+            if (event.type() == Event::CallEvent)
+                fields.append(QueryHelper::Field("callGroup", DatabaseIOPrivate::makeCallGroupURI(event)));
+            else if (event.type() != Event::UnknownType)
+                fields.append(QueryHelper::Field("callGroup", QVariant()));
+        }
+
         return fields;
     }
 
@@ -210,13 +296,17 @@ public:
     {
         FieldList fields;
 
-        foreach (Group::Property property, properties) {
+        for (int i = 0; i < Group::NumProperties; i++) {
+            Group::Property property = static_cast<Group::Property>(i);
+            if (!properties.contains(property))
+                continue;
+
             switch (property) {
                 case Group::LocalUid:
                     fields.append(QueryHelper::Field("localUid", group.localUid()));
                     break;
                 case Group::RemoteUids:
-                    fields.append(QueryHelper::Field("remoteUids", group.remoteUids().join(QString(QChar('\n')))));
+                    fields.append(QueryHelper::Field("remoteUids", encodeStringList(group.remoteUids())));
                     break;
                 case Group::Type:
                     fields.append(QueryHelper::Field("type", group.chatType()));
@@ -275,8 +365,13 @@ DatabaseIOPrivate *DatabaseIOPrivate::instance()
 
 DatabaseIOPrivate::DatabaseIOPrivate(DatabaseIO *p)
     : q(p),
+      m_queryCacheHits(0),
+      m_queryCacheMisses(0),
       m_MmsContentDeleter(0),
-      m_bgThread(0)
+      m_bgThread(0),
+      m_maintenanceTimer(0),
+      m_maintenanceThread(0),
+      m_maintenance(0)
 {
 }
 
@@ -286,6 +381,14 @@ DatabaseIOPrivate::~DatabaseIOPrivate()
         m_MmsContentDeleter->deleteLater();
         m_MmsContentDeleter = 0;
     }
+
+    if (m_maintenanceThread) {
+        // The maintenance connection is closed in its own thread
+        m_maintenance->deleteLater();
+        m_maintenanceThread->quit();
+        m_maintenanceThread->wait();
+        delete m_maintenanceThread;
+    }
 }
 
 QSqlDatabase &DatabaseIOPrivate::connection()
@@ -298,10 +401,105 @@ QSqlDatabase &DatabaseIOPrivate::connection()
 
 QSqlQuery DatabaseIOPrivate::createQuery()
 {
-    return QSqlQuery(connection());
+    return QSqlQuery(readConnection());
 }
 
-bool DatabaseIO::addEvent(Event &event)
+QSqlDatabase &DatabaseIOPrivate::readConnection()
+{
+    if (isWriterThread())
+        return connection();
+
+    if (!readConnections.hasLocalData())
+        readConnections.setLocalData(new ReadConnection);
+    return readConnections.localData()->database;
+}
+
+bool DatabaseIOPrivate::isWriterThread() const
+{
+    return QThread::currentThread() == thread();
+}
+
+QSqlQuery DatabaseIOPrivate::cachedQuery(const QByteArray &statement)
+{
+    bool hit;
+    QSqlQuery query = lookupQuery(m_queryCache, statement, connection(), hit);
+    countCacheLookup(hit);
+    return query;
+}
+
+QSqlQuery DatabaseIOPrivate::cachedReadQuery(const QByteArray &statement)
+{
+    if (isWriterThread())
+        return cachedQuery(statement);
+
+    QSqlDatabase &database = readConnection();
+    bool hit;
+    QSqlQuery query = lookupQuery(readConnections.localData()->queryCache, statement, database, hit);
+    countCacheLookup(hit);
+    return query;
+}
+
+void DatabaseIOPrivate::countCacheLookup(bool hit)
+{
+    if (hit)
+        m_queryCacheHits.ref();
+    else
+        m_queryCacheMisses.ref();
+}
+
+void DatabaseIOPrivate::clearQueryCache()
+{
+    m_queryCache.clear();
+}
+
+void DatabaseIOPrivate::scheduleMaintenance()
+{
+    // Changes are committed from any thread, but the timer can only be
+    // started from the thread of this object
+    QMetaObject::invokeMethod(this, "restartMaintenanceTimer", Qt::QueuedConnection);
+}
+
+void DatabaseIOPrivate::restartMaintenanceTimer()
+{
+    if (!m_maintenanceTimer) {
+        m_maintenanceTimer = new QTimer(this);
+        m_maintenanceTimer->setSingleShot(true);
+        m_maintenanceTimer->setInterval(maintenanceIdleInterval);
+        connect(m_maintenanceTimer, SIGNAL(timeout()), SLOT(startMaintenance()));
+    }
+
+    // Restarting postpones maintenance until changes stop
+    m_maintenanceTimer->start();
+}
+
+void DatabaseIOPrivate::startMaintenance()
+{
+    if (m_maintenanceTimer)
+        m_maintenanceTimer->stop();
+
+    if (!m_maintenanceThread) {
+        m_maintenanceThread = new QThread;
+        m_maintenance = new DatabaseMaintenance;
+        m_maintenance->moveToThread(m_maintenanceThread);
+        connect(m_maintenance, SIGNAL(finished(qint64,qint64,int,bool)),
+                SLOT(maintenanceFinished(qint64,qint64,int,bool)));
+        m_maintenanceThread->start(QThread::LowestPriority);
+    }
+
+    QMetaObject::invokeMethod(m_maintenance, "run", Qt::QueuedConnection);
+}
+
+void DatabaseIOPrivate::maintenanceFinished(qint64 walBytesReclaimed, qint64 fileBytesReclaimed,
+                                            int elapsedMs, bool pending)
+{
+    // Vacuum releases a bounded number of pages per run
+    if (pending)
+        scheduleMaintenance();
+
+    emit q->maintenanceFinished(walBytesReclaimed, fileBytesReclaimed, elapsedMs);
+}
+
+static bool isValidNewEvent(const Event &event)
 {
     if (event.type() == Event::UnknownType) {
         qWarning() << Q_FUNC_INFO << "Event type not set";
@@ -321,6 +519,14 @@ bool DatabaseIO::addEvent(Event &event)
     if (event.id() != -1)
         qWarning() << Q_FUNC_INFO << "Adding event with an ID set. ID will be ignored.";
 
+    return true;
+}
+
+bool DatabaseIO::addEvent(Event &event)
+{
+    if (!isValidNewEvent(event))
+        return false;
+
     QueryHelper::FieldList fields = QueryHelper::eventFields(event, event.allProperties());
     QSqlQuery query = QueryHelper::insertQuery("INSERT INTO Events (:fields) VALUES (:values)", fields);
 
@@ -335,100 +541,241 @@ bool DatabaseIO::addEvent(Event &event)
     return true;
 }
 
-static const char *baseEventQuery =
-    "\n SELECT "
-    "\n Events.id, "
-    "\n Events.type, "
-    "\n Events.startTime, "
-    "\n Events.endTime, "
-    "\n Events.direction, "
-    "\n Events.isDraft, "
-    "\n Events.isRead, "
-    "\n Events.isMissedCall, "
-    "\n Events.isEmergencyCall, "
-    "\n Events.status, "
-    "\n Events.bytesReceived, "
-    "\n Events.localUid, "
-    "\n Events.remoteUid, "
-    "\n Events.parentId, "
-    "\n Events.subject, "
-    "\n Events.freeText, "
-    "\n Events.groupId, "
-    "\n Events.messageToken, "
-    "\n Events.lastModified, "
-    "\n Events.vCardFileName, "
-    "\n Events.vCardLabel, "
-    "\n Events.isDeleted, "
-    "\n Events.reportDelivery, "
-    "\n Events.validityPeriod, "
-    "\n Events.contentLocation, "
-    "\n Events.messageParts, "
-    "\n Events.headers, "
-    "\n Events.readStatus, "
-    "\n Events.reportRead, "
-    "\n Events.reportedReadRequested, "
-    "\n Events.mmsId, "
-    "\n Events.isAction "
-    "\n FROM Events ";
+bool DatabaseIO::addEvents(QList<Event> &events)
+{
+    if (events.isEmpty())
+        return true;
+
+    foreach (const Event &event, events) {
+        if (!isValidNewEvent(event))
+            return false;
+    }
+
+    if (!transaction())
+        return false;
+
+    // All events are written with the full property set, so every row
+    // binds the same fields to one prepared statement.
+    QSqlQuery query;
+    for (int i = 0; i < events.size(); i++) {
+        Event &event = events[i];
+        QueryHelper::FieldList fields = QueryHelper::eventFields(event, event.allProperties());
+        if (i == 0)
+            query = QueryHelper::insertQuery("INSERT INTO Events (:fields) VALUES (:values)", fields);
+        else
+            QueryHelper::bindFields(query, fields);
+
+        if (!query.exec()) {
+            qWarning() << "Failed to execute query";
+            qWarning() << query.lastError();
+            qWarning() << query.lastQuery();
+            rollback();
+            // The rows of the events added before were rolled back
+            for (int j = 0; j < i; j++)
+                events[j].setId(-1);
+            return false;
+        }
+
+        event.setId(query.lastInsertId().toInt());
+    }
+
+    // A failed commit() has already rolled the transaction back
+    if (!commit()) {
+        for (int i = 0; i < events.size(); i++)
+            events[i].setId(-1);
+        return false;
+    }
+
+    return true;
+}
+
+namespace {
+
+struct EventColumnInfo {
+    const char *name;
+    Event::Property property;
+};
+
+// Indexed by DatabaseIOPrivate::EventColumn
+static const EventColumnInfo eventColumns[] = {
+    { "id", Event::Id },
+    { "type", Event::Type },
+    { "startTime", Event::StartTime },
+    { "endTime", Event::EndTime },
+    { "direction", Event::Direction },
+    { "isDraft", Event::IsDraft },
+    { "isRead", Event::IsRead },
+    { "isMissedCall", Event::IsMissedCall },
+    { "isEmergencyCall", Event::IsEmergencyCall },
+    { "status", Event::Status },
+    { "bytesReceived", Event::BytesReceived },
+    { "localUid", Event::LocalUid },
+    { "remoteUid", Event::RemoteUid },
+    { "parentId", Event::ParentId },
+    { "subject", Event::Subject },
+    { "freeText", Event::FreeText },
+    { "groupId", Event::GroupId },
+    { "messageToken", Event::MessageToken },
+    { "lastModified", Event::LastModified },
+    { "vCardFileName", Event::FromVCardFileName },
+    { "vCardLabel", Event::FromVCardLabel },
+    { "isDeleted", Event::IsDeleted },
+    { "reportDelivery", Event::ReportDelivery },
+    { "validityPeriod", Event::ValidityPeriod },
+    { "contentLocation", Event::ContentLocation },
+    { "headers", Event::Headers },
+    { "readStatus", Event::ReadStatus },
+    { "reportRead", Event::ReportRead },
+    { "reportedReadRequested", Event::ReportReadRequested },
+    { "mmsId", Event::MmsId },
+    { "isAction", Event::IsAction },
+    { "eventCount", Event::EventCount }
+};
+
+typedef QHash<Event::PropertySet, DatabaseIOPrivate::EventProjection> ProjectionCache;
+Q_GLOBAL_STATIC(ProjectionCache, projectionCache)
+Q_GLOBAL_STATIC(QMutex, projectionCacheMutex)
+
+}
+
+DatabaseIOPrivate::EventProjection DatabaseIOPrivate::eventProjection(const Event::PropertySet &properties)
+{
+    Q_ASSERT(sizeof(eventColumns) / sizeof(eventColumns[0]) == NumEventColumns);
+
+    QMutexLocker locker(projectionCacheMutex());
+    ProjectionCache *cache = projectionCache();
+    ProjectionCache::const_iterator it = cache->constFind(properties);
+    if (it != cache->constEnd())
+        return it.value();
+
+    // Id and type are always valid. Both vCard columns are set together
+    // by setFromVCard().
+    Event::PropertySet selected = properties;
+    selected << Event::Id << Event::Type;
+    if (selected.contains(Event::FromVCardFileName) || selected.contains(Event::FromVCardLabel))
+        selected << Event::FromVCardFileName << Event::FromVCardLabel;
+
+    EventProjection projection;
+    projection.select = "\n SELECT ";
+    int index = 0;
+    for (int i = 0; i < NumEventColumns; i++) {
+        if (!selected.contains(eventColumns[i].property)) {
+            projection.index[i] = -1;
+            continue;
+        }
+
+        if (index > 0)
+            projection.select += ", ";
+        // Computed columns come from the query itself
+        projection.select += i == EventCountColumn ? "\n " : "\n Events.";
+        projection.select += eventColumns[i].name;
+        projection.index[i] = index++;
+    }
+    projection.select += "\n FROM Events ";
+
+    cache->insert(properties, projection);
+    return projection;
+}
+
+Event::PropertySet DatabaseIOPrivate::storedProperties()
+{
+    Event::PropertySet properties = Event::allProperties();
+    properties -= Event::EventCount;
+    return properties;
+}
 
 QString DatabaseIOPrivate::eventQueryBase() 
 {
-    return QLatin1String(baseEventQuery);
+    return eventQueryBase(storedProperties());
+}
+
+QString DatabaseIOPrivate::eventQueryBase(const Event::PropertySet &properties)
+{
+    return QLatin1String(eventProjection(properties).select);
 }
 
 void DatabaseIOPrivate::readEventResult(QSqlQuery &query, Event &event)
 {
-    event.setId(query.value(0).toInt());
-    event.setType(static_cast<Event::EventType>(query.value(1).toInt()));
-    event.setStartTime(QDateTime::fromTime_t(query.value(2).toUInt()));
-    event.setEndTime(QDateTime::fromTime_t(query.value(3).toUInt()));
-    event.setDirection(static_cast<Event::EventDirection>(query.value(4).toInt()));
-    event.setIsDraft(query.value(5).toBool());
-    event.setIsRead(query.value(6).toBool());
-    event.setIsMissedCall(query.value(7).toBool());
-    event.setIsEmergencyCall(query.value(8).toBool());
-    event.setStatus(static_cast<Event::EventStatus>(query.value(9).toInt()));
-    event.setBytesReceived(query.value(10).toInt());
-    event.setLocalUid(query.value(11).toString());
-    event.setRemoteUid(query.value(12).toString());
-    event.setParentId(query.value(13).toInt());
-    event.setSubject(query.value(14).toString());
-    event.setFreeText(query.value(15).toString());
-    if (query.value(16).isNull())
-        event.setGroupId(-1);
-    else
-        event.setGroupId(query.value(16).toInt());
-    event.setMessageToken(query.value(17).toString());
-    event.setLastModified(QDateTime::fromTime_t(query.value(18).toUInt()));
-    event.setFromVCard(query.value(19).toString(), query.value(20).toString());
-    event.setDeleted(query.value(21).toBool());
-    event.setReportDelivery(query.value(22).toBool());
-    event.setValidityPeriod(query.value(23).toInt());
-    event.setContentLocation(query.value(24).toString());
-    // Message parts are much more complicated
-    //event.setMessageParts(query.value(25).toString());
-    event.setReadStatus(static_cast<Event::EventReadStatus>(query.value(27).toInt()));
-    event.setReportRead(query.value(28).toBool());
-    event.setReportReadRequested(query.value(29).toBool());
-    event.setMmsId(query.value(30).toString());
-    event.setIsAction(query.value(31).toBool());
-
-    QHash<QString,QString> headers;
-    QStringList hf = query.value(26).toString().split('\x1c');
-    foreach (QString h, hf) {
-        QStringList fields = h.split('\x1d');
-        if (fields.size() == 2)
-            headers.insert(fields.value(0), fields.value(1));
-    }
-    event.setHeaders(headers);
+    readEventResult(query, event, eventProjection(storedProperties()));
+}
+
+void DatabaseIOPrivate::readEventResult(QSqlQuery &query, Event &event, const EventProjection &projection)
+{
+    const int *index = projection.index;
+
+    event.setId(query.value(index[IdColumn]).toInt());
+    event.setType(static_cast<Event::EventType>(query.value(index[TypeColumn]).toInt()));
+    if (index[StartTimeColumn] >= 0)
+        event.setStartTime(QDateTime::fromTime_t(query.value(index[StartTimeColumn]).toUInt()));
+    if (index[EndTimeColumn] >= 0)
+        event.setEndTime(QDateTime::fromTime_t(query.value(index[EndTimeColumn]).toUInt()));
+    if (index[DirectionColumn] >= 0)
+        event.setDirection(static_cast<Event::EventDirection>(query.value(index[DirectionColumn]).toInt()));
+    if (index[IsDraftColumn] >= 0)
+        event.setIsDraft(query.value(index[IsDraftColumn]).toBool());
+    if (index[IsReadColumn] >= 0)
+        event.setIsRead(query.value(index[IsReadColumn]).toBool());
+    if (index[IsMissedCallColumn] >= 0)
+        event.setIsMissedCall(query.value(index[IsMissedCallColumn]).toBool());
+    if (index[IsEmergencyCallColumn] >= 0)
+        event.setIsEmergencyCall(query.value(index[IsEmergencyCallColumn]).toBool());
+    if (index[StatusColumn] >= 0)
+        event.setStatus(static_cast<Event::EventStatus>(query.value(index[StatusColumn]).toInt()));
+    if (index[BytesReceivedColumn] >= 0)
+        event.setBytesReceived(query.value(index[BytesReceivedColumn]).toInt());
+    if (index[LocalUidColumn] >= 0)
+        event.setLocalUid(query.value(index[LocalUidColumn]).toString());
+    if (index[RemoteUidColumn] >= 0)
+        event.setRemoteUid(query.value(index[RemoteUidColumn]).toString());
+    if (index[ParentIdColumn] >= 0)
+        event.setParentId(query.value(index[ParentIdColumn]).toInt());
+    if (index[SubjectColumn] >= 0)
+        event.setSubject(query.value(index[SubjectColumn]).toString());
+    if (index[FreeTextColumn] >= 0)
+        event.setFreeText(query.value(index[FreeTextColumn]).toString());
+    if (index[GroupIdColumn] >= 0) {
+        QVariant groupId = query.value(index[GroupIdColumn]);
+        event.setGroupId(groupId.isNull() ? -1 : groupId.toInt());
+    }
+    if (index[MessageTokenColumn] >= 0)
+        event.setMessageToken(query.value(index[MessageTokenColumn]).toString());
+    if (index[LastModifiedColumn] >= 0)
+        event.setLastModified(QDateTime::fromTime_t(query.value(index[LastModifiedColumn]).toUInt()));
+    if (index[VCardFileNameColumn] >= 0)
+        event.setFromVCard(query.value(index[VCardFileNameColumn]).toString(),
+                           query.value(index[VCardLabelColumn]).toString());
+    if (index[IsDeletedColumn] >= 0)
+        event.setDeleted(query.value(index[IsDeletedColumn]).toBool());
+    if (index[ReportDeliveryColumn] >= 0)
+        event.setReportDelivery(query.value(index[ReportDeliveryColumn]).toBool());
+    if (index[ValidityPeriodColumn] >= 0)
+        event.setValidityPeriod(query.value(index[ValidityPeriodColumn]).toInt());
+    if (index[ContentLocationColumn] >= 0)
+        event.setContentLocation(query.value(index[ContentLocationColumn]).toString());
+    // Message parts are much more complicated, and not read here
+    if (index[ReadStatusColumn] >= 0)
+        event.setReadStatus(static_cast<Event::EventReadStatus>(query.value(index[ReadStatusColumn]).toInt()));
+    if (index[ReportReadColumn] >= 0)
+        event.setReportRead(query.value(index[ReportReadColumn]).toBool());
+    if (index[ReportReadRequestedColumn] >= 0)
+        event.setReportReadRequested(query.value(index[ReportReadRequestedColumn]).toBool());
+    if (index[MmsIdColumn] >= 0)
+        event.setMmsId(query.value(index[MmsIdColumn]).toString());
+    if (index[IsActionColumn] >= 0)
+        event.setIsAction(query.value(index[IsActionColumn]).toBool());
+    // Decoded on first access
+    if (index[HeadersColumn] >= 0)
+        event.setEncodedHeaders(query.value(index[HeadersColumn]).toByteArray());
+    if (index[EventCountColumn] >= 0)
+        event.setEventCount(query.value(index[EventCountColumn]).toInt());
 }
 
 bool DatabaseIO::getEvent(int id, Event &event)
 {
-    QByteArray q = baseEventQuery;
+    QByteArray q = d->eventProjection(d->storedProperties()).select;
     q += "\n WHERE Events.id = :eventId LIMIT 1";
 
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedReadQuery(q);
     query.bindValue(":eventId", id);
 
     if (!query.exec()) {
@@ -444,17 +791,57 @@ bool DatabaseIO::getEvent(int id, Event &event)
         d->readEventResult(query, e);
     else
         re = false;
+    query.finish();
 
     event = e;
     return re;
 }
 
+static inline QByteArray joinNumberList(const QList<int> &list)
+{
+    QByteArray re;
+    foreach (int i, list) {
+        if (!re.isEmpty())
+            re += ',';
+        re += QByteArray::number(i);
+    }
+    return re;
+}
+
+bool DatabaseIO::getEvents(const QList<int> &ids, QList<Event> &events)
+{
+    events.clear();
+    if (ids.isEmpty())
+        return true;
+
+    QByteArray q = d->eventProjection(d->storedProperties()).select;
+    q += "\n WHERE Events.id IN (" + joinNumberList(ids) + ")";
+
+    // Id lists are inlined into the statement, so it is not cached
+    QSqlQuery query = CommHistoryDatabase::prepare(q, d->readConnection());
+    if (!query.exec()) {
+        qWarning() << "Failed to execute query";
+        qWarning() << query.lastError();
+        qWarning() << query.lastQuery();
+        return false;
+    }
+
+    while (query.next()) {
+        Event event;
+        d->readEventResult(query, event);
+        events.append(event);
+    }
+    query.finish();
+
+    return true;
+}
+
 bool DatabaseIO::getEventByMessageToken(const QString &token, Event &event)
 {
-    QByteArray q = baseEventQuery;
+    QByteArray q = d->eventProjection(d->storedProperties()).select;
     q += "\n WHERE Events.messageToken = :messageToken LIMIT 1";
 
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedReadQuery(q);
     query.bindValue(":messageToken", token);
 
     if (!query.exec()) {
@@ -467,6 +854,7 @@ bool DatabaseIO::getEventByMessageToken(const QString &token, Event &event)
     Event e;
     if (query.next())
         d->readEventResult(query, e);
+    query.finish();
 
     event = e;
     return true;
@@ -474,10 +862,10 @@ bool DatabaseIO::getEventByMessageToken(const QString &token, Event &event)
 
 bool DatabaseIO::getEventByMmsId(const QString &mmsId, int groupId, Event &event)
 {
-    QByteArray q = baseEventQuery;
+    QByteArray q = d->eventProjection(d->storedProperties()).select;
     q += "\n WHERE Events.mmsId = :mmsId AND Events.groupId = :groupId LIMIT 1";
 
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedReadQuery(q);
     query.bindValue(":mmsId", mmsId);
     query.bindValue(":groupId", groupId);
 
@@ -491,6 +879,7 @@ bool DatabaseIO::getEventByMmsId(const QString &mmsId, int groupId, Event &event
     Event e;
     if (query.next())
         d->readEventResult(query, e);
+    query.finish();
 
     event = e;
     return true;
@@ -515,7 +904,7 @@ bool DatabaseIO::modifyEvent(Event &event)
 bool DatabaseIO::moveEvent(Event &event, int groupId)
 {
     static const char *q = "UPDATE Events SET groupId=:groupId WHERE id=:id";
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedQuery(q);
     query.bindValue(":groupId", groupId);
     query.bindValue(":id", event.id());
 
@@ -541,7 +930,7 @@ bool DatabaseIO::deleteEvent(Event &event, QThread *backgroundThread)
     }
 
     static const char *q = "DELETE FROM Events WHERE id=:id";
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedQuery(q);
     query.bindValue(":id", event.id());
 
     if (!query.exec()) {
@@ -582,7 +971,7 @@ void DatabaseIOPrivate::readGroupResult(QSqlQuery &query, Group &group)
 {
     group.setId(query.value(0).toInt());
     group.setLocalUid(query.value(1).toString());
-    group.setRemoteUids(query.value(2).toString().split('\n'));
+    group.setRemoteUids(decodeStringList(query.value(2).toByteArray()));
     group.setChatType(static_cast<Group::ChatType>(query.value(3).toInt()));
     group.setChatName(query.value(4).toString());
     group.setLastModified(QDateTime::fromTime_t(query.value(5).toUInt()));
@@ -612,7 +1001,9 @@ void DatabaseIOPrivate::readGroupResult(QSqlQuery &query, Group &group)
     group.setLastEventType(static_cast<Event::EventType>(query.value(15).toInt()));
     group.setLastEventStatus(static_cast<Event::EventStatus>(query.value(16).toInt()));
     
-    // contacts
+    // contacts; the contact cache can only be used in the writer (main) thread
+    if (!instance()->isWriterThread())
+        return;
     foreach (const QString &remoteUid, group.remoteUids())
         ContactListener::instance()->resolveContact(group.localUid(), remoteUid);
 }
@@ -627,9 +1018,9 @@ static const char *baseGroupQuery =
     "\n Groups.lastModified, "
     "\n LastEvent.startTime, "
     "\n LastEvent.endTime, "
-    "\n EventCount.total, "
-    "\n EventCount.unread, "
-    "\n EventCount.sent, "
+    "\n GroupStats.total, "
+    "\n GroupStats.unread, "
+    "\n GroupStats.sent, "
     "\n LastEvent.id, "
     "\n LastEvent.freeText, "
     "\n LastEvent.vCardFileName, "
@@ -637,39 +1028,15 @@ static const char *baseGroupQuery =
     "\n LastEvent.type, "
     "\n LastEvent.status "
     "\n FROM Groups "
-    "\n LEFT JOIN ("
-    "\n  SELECT "
-    "\n   groupId, "
-    "\n   COUNT(id) AS total, "
-    "\n   COUNT(NULLIF(isRead = 0, 0)) AS unread, "
-    "\n   COUNT(NULLIF(direction = 2, 0)) AS sent "
-    "\n  FROM Events GROUP BY groupId "
-    "\n ) AS EventCount ON (EventCount.groupId = Groups.id) "
-    "\n LEFT JOIN ("
-    "\n  SELECT "
-    "\n   id, "
-    "\n   groupId, "
-    "\n   startTime, "
-    "\n   endTime, "
-    "\n   freeText, "
-    "\n   vCardFileName, "
-    "\n   vCardLabel, "
-    "\n   type, "
-    "\n   status "
-    "\n  FROM Events "
-    "\n ) AS LastEvent ON (LastEvent.id = ( "
-    "\n  SELECT id FROM Events "
-    "\n  WHERE groupId = Groups.id "
-    "\n  ORDER BY startTime DESC, id DESC "
-    "\n  LIMIT 1 "
-    "\n ) ) ";
+    "\n LEFT JOIN GroupStats ON (GroupStats.groupId = Groups.id) "
+    "\n LEFT JOIN Events AS LastEvent ON (LastEvent.id = GroupStats.lastEventId) ";
 
 bool DatabaseIO::getGroup(int id, Group &group)
 {
     QByteArray q = baseGroupQuery;
-    q += "\n WHERE Groups.id = :groupId GROUP BY Groups.id LIMIT 1";
+    q += "\n WHERE Groups.id = :groupId LIMIT 1";
 
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedReadQuery(q);
     query.bindValue(":groupId", id);
 
     if (!query.exec()) {
@@ -685,6 +1052,7 @@ bool DatabaseIO::getGroup(int id, Group &group)
         d->readGroupResult(query, g);
     else
         re = false;
+    query.finish();
 
     group = g;
     return re;
@@ -704,13 +1072,13 @@ bool DatabaseIO::getGroups(const QString &localUid, const QString &remoteUid, QL
         if (!remoteUid.isEmpty())
             q += "Groups.remoteUids = :remoteUid ";
     }
-    q += "GROUP BY Groups.id " + queryOrder;
+    q += "ORDER BY Groups.id " + queryOrder;
 
-    QSqlQuery query = CommHistoryDatabase::prepare(q.data(), d->connection());
+    QSqlQuery query = CommHistoryDatabase::prepare(q.data(), d->readConnection());
     if (!localUid.isEmpty())
         query.bindValue(":localUid", localUid);
     if (!remoteUid.isNull())
-        query.bindValue(":remoteUid", remoteUid);
+        query.bindValue(":remoteUid", encodeStringList(QStringList() << remoteUid));
 
     if (!query.exec()) {
         qWarning() << "Failed to execute query";
@@ -750,23 +1118,13 @@ bool DatabaseIO::deleteGroup(int groupId, QThread *backgroundThread)
     return deleteGroups(QList<int>() << groupId, backgroundThread);
 }
 
-static inline QByteArray joinNumberList(const QList<int> &list)
-{
-    QByteArray re;
-    foreach (int i, list) {
-        if (!re.isEmpty())
-            re += ',';
-        re += QByteArray::number(i);
-    }
-    return re;
-}
-
 bool DatabaseIO::deleteGroups(QList<int> groupIds, QThread *backgroundThread)
 {
     Q_UNUSED(backgroundThread);
 
     // Events are deleted via SQL foreign keys
     QByteArray q = "DELETE FROM Groups WHERE id IN (" + joinNumberList(groupIds) + ")";
+    // Id lists are inlined into the statement, so it is not cached
     QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
 
     if (!query.exec()) {
@@ -776,13 +1134,14 @@ bool DatabaseIO::deleteGroups(QList<int> groupIds, QThread *backgroundThread)
         return false;
     }
 
+    d->scheduleMaintenance();
     return true;
 }
 
 bool DatabaseIO::totalEventsInGroup(int groupId, int &totalEvents)
 {
     static const char *q = "SELECT COUNT(id) FROM Events WHERE groupId=:groupId";
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedReadQuery(q);
     query.bindValue(":groupId", groupId);
 
     if (!query.exec()) {
@@ -792,18 +1151,53 @@ bool DatabaseIO::totalEventsInGroup(int groupId, int &totalEvents)
         return false;
     }
 
+    bool re = false;
     if (query.next()) {
         totalEvents = query.value(0).toInt();
+        re = true;
+    }
+    query.finish();
+
+    return re;
+}
+
+bool DatabaseIO::getEventStates(const QList<int> &ids, QList<Event> &events)
+{
+    events.clear();
+    if (ids.isEmpty())
         return true;
+
+    QByteArray q = "SELECT id, groupId, startTime, direction, isRead, isDraft "
+                   "FROM Events WHERE id IN (" + joinNumberList(ids) + ")";
+    // Id lists are inlined into the statement, so it is not cached
+    QSqlQuery query = CommHistoryDatabase::prepare(q, d->readConnection());
+    if (!query.exec()) {
+        qWarning() << "Failed to execute query";
+        qWarning() << query.lastError();
+        qWarning() << query.lastQuery();
+        return false;
+    }
+
+    while (query.next()) {
+        Event event;
+        event.setId(query.value(0).toInt());
+        event.setGroupId(query.value(1).isNull() ? -1 : query.value(1).toInt());
+        event.setStartTime(QDateTime::fromTime_t(query.value(2).toUInt()));
+        event.setDirection(static_cast<Event::EventDirection>(query.value(3).toInt()));
+        event.setIsRead(query.value(4).toBool());
+        event.setIsDraft(query.value(5).toBool());
+        event.resetModifiedProperties();
+        events.append(event);
     }
+    query.finish();
 
-    return false;
+    return true;
 }
 
 bool DatabaseIO::markAsReadGroup(int groupId)
 {
     static const char *q = "UPDATE Events SET isRead=1 WHERE groupId=:groupId";
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedQuery(q);
     query.bindValue(":groupId", groupId);
 
     if (!query.exec()) {
@@ -821,6 +1215,7 @@ bool DatabaseIO::markAsRead(const QList<int> &eventIds)
     QByteArray q = "UPDATE Events SET isRead=1 WHERE id IN (";
     q += joinNumberList(eventIds) + ")";
 
+    // Not cached, see deleteGroups()
     QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
     if (!query.exec()) {
         qWarning() << "Failed to execute query";
@@ -835,7 +1230,7 @@ bool DatabaseIO::markAsRead(const QList<int> &eventIds)
 bool DatabaseIO::markAsReadAll(Event::EventType eventType)
 {
     static const char *q = "UPDATE Events SET isRead=1 WHERE type=:eventType";
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedQuery(q);
     query.bindValue(":eventType", eventType);
 
     if (!query.exec()) {
@@ -854,7 +1249,7 @@ bool DatabaseIO::deleteAllEvents(Event::EventType eventType)
     if (eventType != Event::UnknownType)
         q += "WHERE type=:eventType ";
 
-    QSqlQuery query = CommHistoryDatabase::prepare(q, d->connection());
+    QSqlQuery query = d->cachedQuery(q);
     if (eventType != Event::UnknownType)
         query.bindValue(":eventType", eventType);
 
@@ -865,13 +1260,17 @@ bool DatabaseIO::deleteAllEvents(Event::EventType eventType)
         return false;
     }
 
-    return d->deleteEmptyGroups();
+    if (!d->deleteEmptyGroups())
+        return false;
+
+    d->scheduleMaintenance();
+    return true;
 }
 
 bool DatabaseIOPrivate::deleteEmptyGroups()
 {
     static const char *q = "DELETE FROM Groups WHERE (SELECT COUNT(id) FROM Events WHERE groupId=Groups.id) = 0";
-    QSqlQuery query = CommHistoryDatabase::prepare(q, connection());
+    QSqlQuery query = cachedQuery(q);
     if (!query.exec()) {
         qWarning() << "Failed to execute query";
         qWarning() << query.lastError();
@@ -885,6 +1284,67 @@ bool DatabaseIOPrivate::deleteEmptyGroups()
     return true;
 }
 
+bool DatabaseIO::checkGroupStats(QList<int> *inconsistentGroups)
+{
+    // Compare the maintained statistics against a full recalculation
+    static const char *q =
+        "\n SELECT Groups.id FROM Groups "
+        "\n LEFT JOIN GroupStats ON (GroupStats.groupId = Groups.id) "
+        "\n LEFT JOIN ("
+        "\n  SELECT "
+        "\n   groupId, "
+        "\n   COUNT(id) AS total, "
+        "\n   COUNT(NULLIF(isRead = 0, 0)) AS unread, "
+        "\n   COUNT(NULLIF(direction = 2, 0)) AS sent "
+        "\n  FROM Events GROUP BY groupId "
+        "\n ) AS EventCount ON (EventCount.groupId = Groups.id) "
+        "\n WHERE GroupStats.groupId IS NULL "
+        "\n  OR GroupStats.total != IFNULL(EventCount.total, 0) "
+        "\n  OR GroupStats.unread != IFNULL(EventCount.unread, 0) "
+        "\n  OR GroupStats.sent != IFNULL(EventCount.sent, 0) "
+        "\n  OR GroupStats.lastEventId IS NOT ( "
+        "\n   SELECT id FROM Events "
+        "\n   WHERE groupId = Groups.id "
+        "\n   ORDER BY startTime DESC, id DESC "
+        "\n   LIMIT 1 "
+        "\n  ) ";
+
+    QSqlQuery query = CommHistoryDatabase::prepare(q, d->readConnection());
+    if (!query.exec()) {
+        qWarning() << "Failed to execute query";
+        qWarning() << query.lastError();
+        qWarning() << query.lastQuery();
+        return false;
+    }
+
+    bool re = true;
+    while (query.next()) {
+        re = false;
+        if (!inconsistentGroups)
+            break;
+        inconsistentGroups->append(query.value(0).toInt());
+    }
+    query.finish();
+
+    if (!re)
+        qWarning() << Q_FUNC_INFO << "Group statistics are inconsistent";
+
+    return re;
+}
+
+bool DatabaseIO::rebuildGroupStats()
+{
+    if (!transaction())
+        return false;
+
+    if (!CommHistoryDatabase::rebuildGroupStats(d->connection())) {
+        rollback();
+        return false;
+    }
+
+    return commit();
+}
+
 bool DatabaseIO::transaction()
 {
     bool re = d->connection().transaction();
@@ -902,6 +1362,8 @@ bool DatabaseIO::commit()
         qWarning() << "Failed to commit transaction";
         qWarning() << d->connection().lastError();
         rollback();
+    } else {
+        d->scheduleMaintenance();
     }
     return re;
 }
@@ -916,6 +1378,29 @@ bool DatabaseIO::rollback()
     return re;
 }
 
+int DatabaseIO::queryCacheHits() const
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
+    return d->m_queryCacheHits;
+#else
+    return d->m_queryCacheHits.load();
+#endif
+}
+
+int DatabaseIO::queryCacheMisses() const
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
+    return d->m_queryCacheMisses;
+#else
+    return d->m_queryCacheMisses.load();
+#endif
+}
+
+void DatabaseIO::runMaintenance()
+{
+    d->startMaintenance();
+}
+
 QString DatabaseIOPrivate::makeCallGroupURI(const CommHistory::Event &event)
 {
     QString callGroupRemoteId;
@@ -940,7 +1425,7 @@ QString DatabaseIOPrivate::makeCallGroupURI(const CommHistory::Event &event)
 bool DatabaseIOPrivate::isLastMmsEvent(const QString &messageToken)
 {
     QByteArray q = QByteArray("SELECT COUNT(id) FROM Events WHERE type=:type AND messageToken=:messageToken");
-    QSqlQuery query = CommHistoryDatabase::prepare(q, connection());
+    QSqlQuery query = cachedQuery(q);
     query.bindValue(":type", (int)Event::MMSEvent);
     query.bindValue(":messageToken", messageToken);
 
@@ -951,9 +1436,9 @@ bool DatabaseIOPrivate::isLastMmsEvent(const QString &messageToken)
         return false;
     }
 
-    if (query.next() && query.value(0).toInt() < 2)
-        return true;
-    return false;
+    bool re = query.next() && query.value(0).toInt() < 2;
+    query.finish();
+    return re;
 }
 
 MmsContentDeleter &DatabaseIOPrivate::getMmsDeleter(QThread *backgroundThread)
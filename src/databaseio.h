@@ -59,6 +59,16 @@ public:
      */
     bool addEvent(Event &event);
 
+    /*!
+     * Add new events into the database in a single transaction. The id
+     * fields of the events are updated if successfully added. Nothing is
+     * added if any of the events fail.
+     *
+     * \param events New events.
+     * \return true if successful, otherwise false
+     */
+    bool addEvents(QList<Event> &events);
+
     /*!
      * Add a new group into the database. The id field of the group is
      * updated if successfully added.
@@ -77,6 +87,16 @@ public:
      */
     bool getEvent(int id, Event &event);
 
+    /*!
+     * Query events by id with one statement. Ids that are not found are
+     * skipped; the order of the events is not defined.
+     *
+     * \param ids Database ids of the events.
+     * \param events Return value for the events.
+     * \return true if successful, otherwise false
+     */
+    bool getEvents(const QList<int> &ids, QList<Event> &events);
+
     /*!
      * Query a single event by message token.
      *
@@ -182,6 +202,19 @@ public:
      */
     bool totalEventsInGroup(int groupId, int &totalEvents);
 
+    /*!
+     * Query the state of events that the group statistics depend on, with
+     * one statement. Only id, group id, start time, direction, read and
+     * draft state are set in the results. Ids that are not found are
+     * skipped.
+     *
+     * \param ids Database ids of the events.
+     * \param events Reference to container for results
+     *
+     * \return true if successful, otherwise false
+     */
+    bool getEventStates(const QList<int> &ids, QList<Event> &events);
+
     /*!
      * Mark all messages in a group as read
      *
@@ -219,17 +252,32 @@ public:
      */
     bool deleteAllEvents(Event::EventType eventType);
 
+    /*!
+     * Verify that the stored per-group statistics (event counts and last
+     * event) match the events in the database.
+     *
+     * \param inconsistentGroups optional list for ids of mismatching groups
+     * \return true if the statistics are consistent, otherwise false
+     */
+    bool checkGroupStats(QList<int> *inconsistentGroups = 0);
+
+    /*!
+     * Recalculate the per-group statistics from the events in the database.
+     *
+     * \return true if successful, otherwise false
+     */
+    bool rebuildGroupStats();
+
     /*!
      * Initate a new database transaction.
      */
     bool transaction();
 
     /*!
-     * Commits the current transaction.
+     * Commits the current transaction. If the commit fails, the
+     * transaction is rolled back, so callers must not roll back again.
      *
-     * \param isBlocking if true, the call blocks until changes are saved
-     *                   if false, the call is asynchronous and returns immediately
-     * \return transaction object to track commit progress for non-blocking call
+     * \return true if successful, otherwise false
      */
     bool commit();
 
@@ -238,6 +286,36 @@ public:
      */
     bool rollback();
 
+    /*!
+     * Number of statements served from the prepared query caches of the
+     * writer and the read connections.
+     */
+    int queryCacheHits() const;
+
+    /*!
+     * Number of statements that had to be prepared because they were
+     * not found in the prepared query cache.
+     */
+    int queryCacheMisses() const;
+
+    /*!
+     * Checkpoint the WAL and release free pages in a background thread,
+     * without waiting for the database to become idle. Maintenance is
+     * otherwise scheduled automatically after large changes.
+     * maintenanceFinished() is emitted when done.
+     */
+    void runMaintenance();
+
+Q_SIGNALS:
+    /*!
+     * Emitted after a database maintenance run.
+     *
+     * \param walBytesReclaimed Decrease of the WAL file size in bytes.
+     * \param fileBytesReclaimed Decrease of the database file size in bytes.
+     * \param elapsedMs Time spent in the maintenance thread.
+     */
+    void maintenanceFinished(qint64 walBytesReclaimed, qint64 fileBytesReclaimed, int elapsedMs);
+
 private:
     friend class DatabaseIOPrivate;
     DatabaseIOPrivate * const d;
@@ -32,16 +32,19 @@
 #include <QThreadStorage>
 #include <QStringList>
 #include <QSqlDatabase>
+#include <QAtomicInt>
 
 #include "event.h"
 #include "commonutils.h"
 
 class MmsContentDeleter;
+class QTimer;
 
 namespace CommHistory {
 
 class Group;
 class DatabaseIO;
+class DatabaseMaintenance;
 
 /**
  * \class DatabaseIOPrivate
@@ -61,10 +64,72 @@ public:
 
     static QString makeCallGroupURI(const CommHistory::Event &event);
 
+    enum EventColumn {
+        IdColumn = 0,
+        TypeColumn,
+        StartTimeColumn,
+        EndTimeColumn,
+        DirectionColumn,
+        IsDraftColumn,
+        IsReadColumn,
+        IsMissedCallColumn,
+        IsEmergencyCallColumn,
+        StatusColumn,
+        BytesReceivedColumn,
+        LocalUidColumn,
+        RemoteUidColumn,
+        ParentIdColumn,
+        SubjectColumn,
+        FreeTextColumn,
+        GroupIdColumn,
+        MessageTokenColumn,
+        LastModifiedColumn,
+        VCardFileNameColumn,
+        VCardLabelColumn,
+        IsDeletedColumn,
+        ReportDeliveryColumn,
+        ValidityPeriodColumn,
+        ContentLocationColumn,
+        HeadersColumn,
+        ReadStatusColumn,
+        ReportReadColumn,
+        ReportReadRequestedColumn,
+        MmsIdColumn,
+        IsActionColumn,
+        // Not stored in Events; selected only by queries that compute it
+        // (see CallModel::setDatabaseGrouping())
+        EventCountColumn,
+        NumEventColumns
+    };
+
+    /*!
+     * \struct EventProjection
+     *
+     * The columns selected for a set of event properties, and the
+     * position of each column in the result (-1 if not selected).
+     */
+    struct EventProjection {
+        QByteArray select;
+        int index[NumEventColumns];
+    };
+
+    /*!
+     * Returns the projection for a set of event properties. Projections are
+     * cached, so this is cheap to call for every query.
+     */
+    static EventProjection eventProjection(const Event::PropertySet &properties);
+
+    /*!
+     * Returns the event properties stored in the Events table.
+     */
+    static Event::PropertySet storedProperties();
+
     static void readEventResult(QSqlQuery &query, Event &event);
+    static void readEventResult(QSqlQuery &query, Event &event, const EventProjection &projection);
     static void readGroupResult(QSqlQuery &query, Group &group);
 
     static QString eventQueryBase();
+    static QString eventQueryBase(const Event::PropertySet &properties);
 
     bool getEvents(const QString &querySuffix, QList<Event> &events);
 
@@ -74,14 +139,72 @@ public:
     bool deleteEmptyGroups();
 
     QSqlQuery createQuery();
+
+    /*!
+     * Returns the writer connection. All modifications and transactions
+     * go through this single connection, which belongs to the thread of
+     * DatabaseIO.
+     */
     QSqlDatabase& connection();
 
+    /*!
+     * Returns a connection for read-only queries in the calling thread.
+     * In the writer thread this is the writer connection, so that reads
+     * see the changes of an open transaction. Other threads get their own
+     * connection from the read pool; it is opened on first use, reads the
+     * last committed WAL snapshot without blocking the writer, and is
+     * closed when the thread exits.
+     */
+    QSqlDatabase& readConnection();
+
+    /*!
+     * Returns true if the calling thread owns the writer connection.
+     */
+    bool isWriterThread() const;
+
+    /*!
+     * Returns a prepared query for a statement, reusing the previously
+     * prepared query for an identical statement on this connection.
+     * Statements with inlined values (e.g. id lists) must not be
+     * passed here, as every variant would occupy a cache entry.
+     */
+    QSqlQuery cachedQuery(const QByteArray &statement);
+    void clearQueryCache();
+
+    /*!
+     * As cachedQuery(), but prepared on readConnection() with a cache
+     * kept per read connection.
+     */
+    QSqlQuery cachedReadQuery(const QByteArray &statement);
+    void countCacheLookup(bool hit);
+
+    /*!
+     * Run database maintenance in the background once no further changes
+     * have been made for a while. Called after changes that leave free
+     * pages or a large WAL behind. May be called from any thread.
+     */
+    void scheduleMaintenance();
+
+public Q_SLOTS:
+    void restartMaintenanceTimer();
+    void startMaintenance();
+    void maintenanceFinished(qint64 walBytesReclaimed, qint64 fileBytesReclaimed, int elapsedMs, bool pending);
+
 public:
     QSqlDatabase m_pConnection;
 
+    QHash<QByteArray, QSqlQuery> m_queryCache;
+    // Counted for the writer and all read connections, from any thread
+    QAtomicInt m_queryCacheHits;
+    QAtomicInt m_queryCacheMisses;
+
     MmsContentDeleter *m_MmsContentDeleter;
 
     QThread *m_bgThread;
+
+    QTimer *m_maintenanceTimer;
+    QThread *m_maintenanceThread;
+    DatabaseMaintenance *m_maintenance;
 };
 
 } // namespace
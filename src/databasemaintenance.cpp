@@ -0,0 +1,152 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include "databasemaintenance.h"
+#include "commhistorydatabase.h"
+#include "debug.h"
+
+using namespace CommHistory;
+
+namespace {
+// WAL size above which the checkpoint also truncates the WAL file
+static const qint64 walTruncateThreshold = 4 << 20;
+// Free space in the database file above which incremental vacuum is run
+static const qint64 freeSpaceThreshold = 1 << 20;
+// Upper bound of pages released in one run, to keep the write lock short
+static const int maxVacuumPages = 2048;
+
+// auto_vacuum = INCREMENTAL
+static const int incrementalAutoVacuum = 2;
+
+qint64 fileSize(const QString &path)
+{
+    QFileInfo info(path);
+    return info.exists() ? info.size() : 0;
+}
+}
+
+DatabaseMaintenance::DatabaseMaintenance(QObject *parent)
+    : QObject(parent)
+{
+}
+
+DatabaseMaintenance::~DatabaseMaintenance()
+{
+    if (m_connection.isValid()) {
+        const QString name = m_connection.connectionName();
+        m_connection.close();
+        m_connection = QSqlDatabase();
+        QSqlDatabase::removeDatabase(name);
+    }
+}
+
+QSqlDatabase &DatabaseMaintenance::connection()
+{
+    // Checkpoints and vacuum write to the database file, so they can not
+    // use the read-only connection of this thread
+    if (!m_connection.isValid())
+        m_connection = CommHistoryDatabase::open(QLatin1String("commhistory-maintenance"));
+
+    return m_connection;
+}
+
+bool DatabaseMaintenance::pragmaValue(const QString &pragma, qint64 &value)
+{
+    QSqlQuery query(connection());
+    if (!query.exec(QLatin1String("PRAGMA ") + pragma) || !query.next()) {
+        qWarning() << "Failed to execute query";
+        qWarning() << query.lastError();
+        qWarning() << query.lastQuery();
+        return false;
+    }
+
+    value = query.value(0).toLongLong();
+    return true;
+}
+
+void DatabaseMaintenance::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QSqlDatabase &database = connection();
+    if (!database.isOpen()) {
+        emit finished(0, 0, timer.elapsed(), false);
+        return;
+    }
+
+    const QString databaseFile = database.databaseName();
+    const QString walFile = databaseFile + QLatin1String("-wal");
+    const qint64 databaseSize = fileSize(databaseFile);
+
+    bool pending = false;
+    qint64 autoVacuum = 0, pageSize = 0, freePages = 0;
+    if (pragmaValue(QLatin1String("auto_vacuum"), autoVacuum)
+            && pragmaValue(QLatin1String("page_size"), pageSize)
+            && pragmaValue(QLatin1String("freelist_count"), freePages)) {
+        if (autoVacuum != incrementalAutoVacuum) {
+            DEBUG() << Q_FUNC_INFO << "Incremental vacuum is not enabled for the database";
+        } else if (freePages * pageSize >= freeSpaceThreshold) {
+            // Every step of the pragma releases one page
+            QSqlQuery query(database);
+            if (query.exec(QString::fromLatin1("PRAGMA incremental_vacuum(%1)").arg(maxVacuumPages))) {
+                while (query.next())
+                    ;
+                pending = (freePages - maxVacuumPages) * pageSize >= freeSpaceThreshold;
+            } else {
+                qWarning() << "Failed to execute query";
+                qWarning() << query.lastError();
+                qWarning() << query.lastQuery();
+            }
+        }
+    }
+
+    // Vacuum goes through the WAL as well, so checkpoint after it
+    const qint64 walSize = fileSize(walFile);
+    if (walSize > 0) {
+        const char *mode = walSize >= walTruncateThreshold ? "TRUNCATE" : "PASSIVE";
+        QSqlQuery query(database);
+        if (!query.exec(QString::fromLatin1("PRAGMA wal_checkpoint(%1)").arg(QLatin1String(mode)))) {
+            qWarning() << "Failed to execute query";
+            qWarning() << query.lastError();
+            qWarning() << query.lastQuery();
+        } else if (query.next() && query.value(0).toInt() != 0) {
+            DEBUG() << Q_FUNC_INFO << "Checkpoint was blocked by readers";
+        }
+        query.finish();
+    }
+
+    const qint64 walReclaimed = walSize - fileSize(walFile);
+    const qint64 fileReclaimed = databaseSize - fileSize(databaseFile);
+    const int elapsed = timer.elapsed();
+
+    DEBUG() << Q_FUNC_INFO << "WAL:" << walReclaimed << "bytes, database:" << fileReclaimed
+            << "bytes reclaimed in" << elapsed << "ms";
+
+    emit finished(walReclaimed, fileReclaimed, elapsed, pending);
+}
@@ -0,0 +1,74 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_DATABASEMAINTENANCE_H
+#define COMMHISTORY_DATABASEMAINTENANCE_H
+
+#include <QObject>
+#include <QSqlDatabase>
+
+namespace CommHistory {
+
+/*!
+ * \class DatabaseMaintenance
+ *
+ * Checkpoints the WAL and returns free pages to the file system. Lives in
+ * a background thread of DatabaseIO, which invokes run() once the
+ * database has been idle for a while after changes.
+ */
+class DatabaseMaintenance : public QObject
+{
+    Q_OBJECT
+
+public:
+    DatabaseMaintenance(QObject *parent = 0);
+    ~DatabaseMaintenance();
+
+public Q_SLOTS:
+    /*!
+     * Checkpoint the WAL if it is not empty, truncating it if it is larger
+     * than the WAL threshold, and run incremental vacuum if the free pages
+     * exceed the free space threshold.
+     */
+    void run();
+
+Q_SIGNALS:
+    /*!
+     * Emitted after each run.
+     *
+     * \param walBytesReclaimed Decrease of the WAL file size.
+     * \param fileBytesReclaimed Decrease of the database file size.
+     * \param elapsedMs Time spent.
+     * \param pending True if free pages remain above the threshold.
+     */
+    void finished(qint64 walBytesReclaimed, qint64 fileBytesReclaimed, int elapsedMs, bool pending);
+
+private:
+    QSqlDatabase &connection();
+    bool pragmaValue(const QString &pragma, qint64 &value);
+
+    QSqlDatabase m_connection;
+};
+
+}
+
+#endif
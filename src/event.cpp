@@ -22,9 +22,11 @@
 
 #include <QDebug>
 #include <QSharedDataPointer>
+#include <QAtomicPointer>
 #include <QDBusArgument>
 #include "event.h"
 #include "messagepart.h"
+#include "fieldencoding.h"
 
 #include <QStringBuilder>
 
@@ -35,6 +37,15 @@
 
 namespace CommHistory {
 
+static inline QHash<QString, QString> *loadHeaderCache(const QAtomicPointer<QHash<QString, QString> > &cache)
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
+    return cache;
+#else
+    return cache.loadAcquire();
+#endif
+}
+
 class EventPrivate : public QSharedData
 {
 public:
@@ -90,7 +101,17 @@ public:
 
     bool isAction;
 
+    // Headers read from the database are kept encoded until modified.
+    // Const readers decode them once into headerCache. The data may be
+    // shared between threads, so the cache is published atomically and
+    // never changed while it is shared.
+    QHash<QString, QString> decodedHeaders() const;
+    QHash<QString, QString> &mutableHeaders();
+    void resetHeaderCache();
+
     QHash<QString, QString> headers;
+    QByteArray encodedHeaders;
+    mutable QAtomicPointer<QHash<QString, QString> > headerCache;
 
     Event::PropertySet validProperties;
     Event::PropertySet modifiedProperties;
@@ -100,8 +121,6 @@ public:
 
 using namespace CommHistory;
 
-static Event::PropertySet setOfAllProperties;
-
 QDBusArgument &operator<<(QDBusArgument &argument, const Event &event)
 {
     argument.beginStructure();
@@ -153,7 +172,8 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, Event &event)
     while (!argument.atEnd()) {
         int vp;
         argument >> vp;
-        p.validProperties.insert((Event::Property)vp);
+        if (vp >= 0 && vp < Event::NumProperties)
+            p.validProperties.insert((Event::Property)vp);
     }
     argument.endArray();
     argument.endStructure();
@@ -314,6 +334,7 @@ EventPrivate::EventPrivate()
         , validityPeriod(0)
         , readStatus(Event::UnknownReadStatus)
         , isAction(false)
+        , headerCache(0)
 {
     lastModified = QDateTime::fromTime_t(0);
 }
@@ -357,23 +378,61 @@ EventPrivate::EventPrivate(const EventPrivate &other)
         , readStatus(other.readStatus)
         , isAction(other.isAction)
         , headers(other.headers)
+        , encodedHeaders(other.encodedHeaders)
+        , headerCache(0)
         , validProperties(other.validProperties)
         , modifiedProperties(other.modifiedProperties)
 {
+    QHash<QString, QString> *cached = loadHeaderCache(other.headerCache);
+    if (cached)
+        headerCache.fetchAndStoreOrdered(new QHash<QString, QString>(*cached));
 }
 
 EventPrivate::~EventPrivate()
 {
+    resetHeaderCache();
 }
 
-Event::PropertySet Event::allProperties()
+QHash<QString, QString> EventPrivate::decodedHeaders() const
 {
-    if (setOfAllProperties.isEmpty()) {
-        for (int i = 0; i < Event::NumProperties; i++)
-            setOfAllProperties += (Event::Property)i;
+    if (encodedHeaders.isEmpty())
+        return headers;
+
+    QHash<QString, QString> *cached = loadHeaderCache(headerCache);
+    if (!cached) {
+        // Another thread may decode the same data; the first one is kept
+        QHash<QString, QString> *decoded = new QHash<QString, QString>(decodeStringHash(encodedHeaders));
+        if (headerCache.testAndSetOrdered(0, decoded)) {
+            cached = decoded;
+        } else {
+            delete decoded;
+            cached = loadHeaderCache(headerCache);
+        }
     }
 
-    return setOfAllProperties;
+    return *cached;
+}
+
+QHash<QString, QString> &EventPrivate::mutableHeaders()
+{
+    // Only called on detached data, which no other thread can read
+    if (!encodedHeaders.isEmpty()) {
+        QHash<QString, QString> *cached = loadHeaderCache(headerCache);
+        headers = cached ? *cached : decodeStringHash(encodedHeaders);
+        encodedHeaders.clear();
+        resetHeaderCache();
+    }
+    return headers;
+}
+
+void EventPrivate::resetHeaderCache()
+{
+    delete headerCache.fetchAndStoreOrdered(0);
+}
+
+Event::PropertySet Event::allProperties()
+{
+    return Event::PropertySet::all();
 }
 
 Event::Event()
@@ -507,7 +566,7 @@ bool Event::isVideoCall() const
 {
     bool isVideo = false;
 
-    QString header = d->headers.value(VIDEO_CALL_HEADER).toLower();
+    QString header = d->decodedHeaders().value(VIDEO_CALL_HEADER).toLower();
     if (header == "true" || header == "1" || header == "yes")
         isVideo = true;
 
@@ -591,17 +650,17 @@ QList<MessagePart> Event::messageParts() const
 
 QStringList Event::toList() const
 {
-    return d->headers.value(MMS_TO_HEADER).split("\x1e", QString::SkipEmptyParts);
+    return d->decodedHeaders().value(MMS_TO_HEADER).split("\x1e", QString::SkipEmptyParts);
 }
 
 QStringList Event::ccList() const
 {
-    return d->headers.value(MMS_CC_HEADER).split("\x1e", QString::SkipEmptyParts);
+    return d->decodedHeaders().value(MMS_CC_HEADER).split("\x1e", QString::SkipEmptyParts);
 }
 
 QStringList Event::bccList() const
 {
-    return d->headers.value(MMS_BCC_HEADER).split("\x1e", QString::SkipEmptyParts);
+    return d->decodedHeaders().value(MMS_BCC_HEADER).split("\x1e", QString::SkipEmptyParts);
 }
 
 Event::EventReadStatus Event::readStatus() const
@@ -671,7 +730,14 @@ bool Event::isAction() const
 
 QHash<QString, QString> Event::headers() const
 {
-    return d->headers;
+    return d->decodedHeaders();
+}
+
+QByteArray Event::encodedHeaders() const
+{
+    if (!d->encodedHeaders.isEmpty())
+        return d->encodedHeaders;
+    return encodeStringHash(d->headers);
 }
 
 void Event::setValidProperties(const Event::PropertySet &properties)
@@ -752,9 +818,9 @@ void Event::setIsEmergencyCall( bool isEmergency )
 void Event::setIsVideoCall( bool isVideo )
 {
     if (!isVideo) {
-        d->headers.remove(VIDEO_CALL_HEADER);
+        d->mutableHeaders().remove(VIDEO_CALL_HEADER);
     } else {
-        d->headers.insert(VIDEO_CALL_HEADER, "true");
+        d->mutableHeaders().insert(VIDEO_CALL_HEADER, "true");
     }
     d->propertyChanged(Event::Headers);
 }
@@ -916,9 +982,9 @@ void Event::addMessagePart(const MessagePart &part)
 void Event::setToList(const QStringList &toList)
 {
     if (toList.isEmpty()) {
-        d->headers.remove(MMS_TO_HEADER);
+        d->mutableHeaders().remove(MMS_TO_HEADER);
     } else {
-        d->headers.insert(MMS_TO_HEADER, toList.join("\x1e"));
+        d->mutableHeaders().insert(MMS_TO_HEADER, toList.join("\x1e"));
     }
     d->propertyChanged(Event::Headers);
 }
@@ -926,9 +992,9 @@ void Event::setToList(const QStringList &toList)
 void Event::setCcList(const QStringList &ccList)
 {
     if (ccList.isEmpty()) {
-        d->headers.remove(MMS_CC_HEADER);
+        d->mutableHeaders().remove(MMS_CC_HEADER);
     } else {
-        d->headers.insert(MMS_CC_HEADER, ccList.join("\x1e"));
+        d->mutableHeaders().insert(MMS_CC_HEADER, ccList.join("\x1e"));
     }
     d->propertyChanged(Event::Headers);
 }
@@ -936,9 +1002,9 @@ void Event::setCcList(const QStringList &ccList)
 void Event::setBccList(const QStringList &bccList)
 {
     if (bccList.isEmpty()) {
-        d->headers.remove(MMS_BCC_HEADER);
+        d->mutableHeaders().remove(MMS_BCC_HEADER);
     } else {
-        d->headers.insert(MMS_BCC_HEADER, bccList.join("\x1e"));
+        d->mutableHeaders().insert(MMS_BCC_HEADER, bccList.join("\x1e"));
     }
     d->propertyChanged(Event::Headers);
 }
@@ -970,6 +1036,16 @@ void Event::setIsAction(bool isAction)
 void Event::setHeaders(const QHash<QString, QString> &headers)
 {
     d->headers = headers;
+    d->encodedHeaders.clear();
+    d->resetHeaderCache();
+    d->propertyChanged(Event::Headers);
+}
+
+void Event::setEncodedHeaders(const QByteArray &encoded)
+{
+    d->headers.clear();
+    d->encodedHeaders = encoded;
+    d->resetHeaderCache();
     d->propertyChanged(Event::Headers);
 }
 
@@ -988,9 +1064,10 @@ QString Event::toString() const
     }
 
     QString headers;
-    if (!d->headers.isEmpty()) {
+    const QHash<QString, QString> headerHash = d->decodedHeaders();
+    if (!headerHash.isEmpty()) {
         QStringList headerList;
-        QHashIterator<QString, QString> i(d->headers);
+        QHashIterator<QString, QString> i(headerHash);
         while (i.hasNext()) {
             i.next();
             headerList.append(QString("%1=%2").arg(i.key()).arg(i.value()));
@@ -1143,7 +1220,11 @@ void Event::copyValidProperties(const Event &other)
         case Cc:
         case Bcc:
         case Headers:
-            setHeaders(other.headers());
+            // Keeps the headers encoded if they have not been accessed
+            d->headers = other.d->headers;
+            d->encodedHeaders = other.d->encodedHeaders;
+            d->resetHeaderCache();
+            d->propertyChanged(Event::Headers);
             break;
         default:
             qCritical() << "Unknown event property";
@@ -1151,3 +1232,342 @@ void Event::copyValidProperties(const Event &other)
         }
     }
 }
+
+QByteArray Event::encodeProperties(const Event::PropertySet &properties) const
+{
+    Event::PropertySet encoded = properties & d->validProperties;
+    // Aliases are sent as the property that carries their value
+    if (encoded.remove(ContactId) | encoded.remove(ContactName))
+        encoded += Contacts;
+    if (encoded.remove(FromVCardLabel))
+        encoded += FromVCardFileName;
+    if (encoded.remove(To) | encoded.remove(Cc) | encoded.remove(Bcc))
+        encoded += Headers;
+    encoded.remove(Id);
+    encoded.remove(Type);
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << qint32(d->id) << qint32(d->type) << quint8(encoded.count());
+
+    foreach (Property p, encoded) {
+        stream << quint8(p);
+        switch (p) {
+        case StartTime:
+            stream << d->startTime;
+            break;
+        case EndTime:
+            stream << d->endTime;
+            break;
+        case Direction:
+            stream << qint32(d->direction);
+            break;
+        case IsDraft:
+            stream << d->isDraft;
+            break;
+        case IsRead:
+            stream << d->isRead;
+            break;
+        case IsMissedCall:
+            stream << d->isMissedCall;
+            break;
+        case IsEmergencyCall:
+            stream << d->isEmergencyCall;
+            break;
+        case Status:
+            stream << qint32(d->status);
+            break;
+        case BytesReceived:
+            stream << qint32(d->bytesReceived);
+            break;
+        case LocalUid:
+            stream << d->localUid;
+            break;
+        case RemoteUid:
+            stream << d->remoteUid;
+            break;
+        case Contacts:
+            stream << d->contacts;
+            break;
+        case ParentId:
+            stream << qint32(d->parentId);
+            break;
+        case Subject:
+            stream << d->subject;
+            break;
+        case FreeText:
+            stream << d->freeText;
+            break;
+        case GroupId:
+            stream << qint32(d->groupId);
+            break;
+        case MessageToken:
+            stream << d->messageToken;
+            break;
+        case LastModified:
+            stream << d->lastModified;
+            break;
+        case EventCount:
+            stream << qint32(d->eventCount);
+            break;
+        case FromVCardFileName:
+            stream << d->fromVCardFileName << d->fromVCardLabel;
+            break;
+        case Encoding:
+            stream << d->encoding;
+            break;
+        case CharacterSet:
+            stream << d->charset;
+            break;
+        case Language:
+            stream << d->language;
+            break;
+        case IsDeleted:
+            stream << d->deleted;
+            break;
+        case ReportDelivery:
+            stream << d->reportDelivery;
+            break;
+        case ValidityPeriod:
+            stream << qint32(d->validityPeriod);
+            break;
+        case ContentLocation:
+            stream << d->contentLocation;
+            break;
+        case MessageParts:
+            stream << d->messageParts;
+            break;
+        case ReadStatus:
+            stream << qint32(d->readStatus);
+            break;
+        case ReportRead:
+            stream << d->reportRead;
+            break;
+        case ReportReadRequested:
+            stream << d->reportReadRequested;
+            break;
+        case MmsId:
+            stream << d->mmsId;
+            break;
+        case IsAction:
+            stream << d->isAction;
+            break;
+        case Headers:
+            stream << encodedHeaders();
+            break;
+        default:
+            qCritical() << "Unknown event property";
+            Q_ASSERT(false);
+        }
+    }
+
+    return data;
+}
+
+QByteArray Event::encodeProperties(const Event::PropertySet &properties, const Event &previous) const
+{
+    QByteArray data = encodeProperties(properties);
+    Event::PropertySet previousProperties = previous.validProperties();
+    previousProperties -= Id;
+    previousProperties -= Type;
+    if (previousProperties.isEmpty())
+        return data;
+
+    // Appended after the properties, where decoders that do not read it
+    // stop anyway
+    QDataStream stream(&data, QIODevice::WriteOnly | QIODevice::Append);
+    stream << previous.encodeProperties(previous.validProperties());
+    return data;
+}
+
+Event Event::decodeProperties(const QByteArray &data, Event *previous)
+{
+    QDataStream stream(data);
+    qint32 id, type;
+    quint8 count;
+    stream >> id >> type >> count;
+
+    Event event;
+    event.setId(id);
+    event.setType(static_cast<EventType>(type));
+
+    for (int i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        quint8 p;
+        qint32 n;
+        bool b;
+        QString s;
+        QDateTime t;
+
+        stream >> p;
+        switch (p) {
+        case StartTime:
+            stream >> t;
+            event.setStartTime(t);
+            break;
+        case EndTime:
+            stream >> t;
+            event.setEndTime(t);
+            break;
+        case Direction:
+            stream >> n;
+            event.setDirection(static_cast<EventDirection>(n));
+            break;
+        case IsDraft:
+            stream >> b;
+            event.setIsDraft(b);
+            break;
+        case IsRead:
+            stream >> b;
+            event.setIsRead(b);
+            break;
+        case IsMissedCall:
+            stream >> b;
+            event.setIsMissedCall(b);
+            break;
+        case IsEmergencyCall:
+            stream >> b;
+            event.setIsEmergencyCall(b);
+            break;
+        case Status:
+            stream >> n;
+            event.setStatus(static_cast<EventStatus>(n));
+            break;
+        case BytesReceived:
+            stream >> n;
+            event.setBytesReceived(n);
+            break;
+        case LocalUid:
+            stream >> s;
+            event.setLocalUid(s);
+            break;
+        case RemoteUid:
+            stream >> s;
+            event.setRemoteUid(s);
+            break;
+        case Contacts: {
+            QList<Contact> contacts;
+            stream >> contacts;
+            event.setContacts(contacts);
+            break;
+        }
+        case ParentId:
+            stream >> n;
+            event.setParentId(n);
+            break;
+        case Subject:
+            stream >> s;
+            event.setSubject(s);
+            break;
+        case FreeText:
+            stream >> s;
+            event.setFreeText(s);
+            break;
+        case GroupId:
+            stream >> n;
+            event.setGroupId(n);
+            break;
+        case MessageToken:
+            stream >> s;
+            event.setMessageToken(s);
+            break;
+        case LastModified:
+            stream >> t;
+            event.setLastModified(t);
+            break;
+        case EventCount:
+            stream >> n;
+            event.setEventCount(n);
+            break;
+        case FromVCardFileName: {
+            QString label;
+            stream >> s >> label;
+            event.setFromVCard(s, label);
+            break;
+        }
+        case Encoding:
+            stream >> s;
+            event.setEncoding(s);
+            break;
+        case CharacterSet:
+            stream >> s;
+            event.setCharacterSet(s);
+            break;
+        case Language:
+            stream >> s;
+            event.setLanguage(s);
+            break;
+        case IsDeleted:
+            stream >> b;
+            event.setDeleted(b);
+            break;
+        case ReportDelivery:
+            stream >> b;
+            event.setReportDelivery(b);
+            break;
+        case ValidityPeriod:
+            stream >> n;
+            event.setValidityPeriod(n);
+            break;
+        case ContentLocation:
+            stream >> s;
+            event.setContentLocation(s);
+            break;
+        case MessageParts: {
+            QList<MessagePart> parts;
+            stream >> parts;
+            event.setMessageParts(parts);
+            break;
+        }
+        case ReadStatus:
+            stream >> n;
+            event.setReadStatus(static_cast<EventReadStatus>(n));
+            break;
+        case ReportRead:
+            stream >> b;
+            event.setReportRead(b);
+            break;
+        case ReportReadRequested:
+            stream >> b;
+            event.setReportReadRequested(b);
+            break;
+        case MmsId:
+            stream >> s;
+            event.setMmsId(s);
+            break;
+        case IsAction:
+            stream >> b;
+            event.setIsAction(b);
+            break;
+        case Headers: {
+            QByteArray headers;
+            stream >> headers;
+            event.setEncodedHeaders(headers);
+            break;
+        }
+        default:
+            qWarning() << "Invalid property in encoded event" << p;
+            stream.setStatus(QDataStream::ReadCorruptData);
+        }
+    }
+
+    if (stream.status() != QDataStream::Ok)
+        qWarning() << "Failed to decode event properties for event" << id;
+
+    if (previous) {
+        QByteArray previousData;
+        if (stream.status() == QDataStream::Ok && !stream.atEnd())
+            stream >> previousData;
+
+        if (!previousData.isEmpty()) {
+            *previous = decodeProperties(previousData);
+        } else {
+            *previous = Event();
+            previous->setId(id);
+            previous->setType(static_cast<EventType>(type));
+            previous->resetModifiedProperties();
+        }
+    }
+
+    event.resetModifiedProperties();
+    return event;
+}
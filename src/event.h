@@ -31,6 +31,7 @@
 #include <QSet>
 
 #include "messagepart.h"
+#include "propertyset.h"
 #include "libcommhistoryexport.h"
 
 class QDBusArgument;
@@ -153,7 +154,7 @@ public:
         NumProperties
     };
 
-    typedef QSet<Event::Property> PropertySet;
+    typedef PropertyBitSet<Event::Property, Event::NumProperties> PropertySet;
 
     // FIXME: potential risk of QContactLocalId (quint32) not fitting to int.
     // should we change event/group.contactId to uint?
@@ -334,6 +335,9 @@ public:
     // Optional message headers, key/value.
     QHash<QString, QString> headers() const;
 
+    // Headers in the database storage format (see fieldencoding.h)
+    QByteArray encodedHeaders() const;
+
     //\\//\\// S E T - A C C E S S O R S //\\//\\//
     void setId(int id);
 
@@ -432,6 +436,10 @@ public:
 
     void setHeaders(const QHash<QString, QString> &headers);
 
+    // Set headers in the database storage format. They are decoded when
+    // first accessed.
+    void setEncodedHeaders(const QByteArray &encoded);
+
     QString toString() const;
 
     bool resetModifiedProperty(Event::Property property);
@@ -443,6 +451,37 @@ public:
      */
     void copyValidProperties(const Event &other);
 
+    /*!
+     * \brief Encode the id, type and given properties in a compact form
+     *
+     * Used for change notifications, which only need to carry the
+     * modified properties. Properties that are not valid are skipped.
+     *
+     * \param properties Properties to encode.
+     * \return Encoded data, see decodeProperties().
+     */
+    QByteArray encodeProperties(const Event::PropertySet &properties) const;
+
+    /*!
+     * \brief Encode the given properties and the valid properties of the
+     * event's previous state
+     *
+     * Lets receivers of a change apply it to derived state, such as group
+     * statistics, without reading the previous state back.
+     */
+    QByteArray encodeProperties(const Event::PropertySet &properties, const Event &previous) const;
+
+    /*!
+     * \brief Decode an event encoded with encodeProperties()
+     *
+     * Only the id, type and encoded properties are valid in the result,
+     * so it can be applied to a full event with copyValidProperties().
+     *
+     * \param previous If not null, set to the previous state, if one was
+     *        encoded, or else to an event with only the id and type.
+     */
+    static Event decodeProperties(const QByteArray &data, Event *previous = 0);
+
 private:
     QSharedDataPointer<EventPrivate> d;
 };
@@ -461,6 +500,10 @@ LIBCOMMHISTORY_EXPORT QDataStream &operator>>(QDataStream &stream, CommHistory::
 Q_DECLARE_METATYPE(CommHistory::Event);
 Q_DECLARE_METATYPE(QList<CommHistory::Event>);
 Q_DECLARE_METATYPE(CommHistory::Event::Contact);
+Q_DECLARE_METATYPE(CommHistory::Event::PropertySet);
 Q_DECLARE_METATYPE(QList<CommHistory::Event::Contact>);
+#if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
+Q_DECLARE_METATYPE(QList<QByteArray>);
+#endif
 
 #endif
@@ -0,0 +1,390 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QSqlQuery>
+#include <QSet>
+
+#include "eventcolumnstore.h"
+#include "eventmodel.h"
+
+using namespace CommHistory;
+
+namespace {
+
+QVariant columnValue(const QSqlQuery &query, const DatabaseIOPrivate::EventProjection &projection,
+                     DatabaseIOPrivate::EventColumn column)
+{
+    int index = projection.index[column];
+    return index >= 0 ? query.value(index) : QVariant();
+}
+
+}
+
+template <typename T>
+void EventColumnStore::ArenaColumn<T>::append(const T &value)
+{
+    data += value;
+    ends.append(data.size());
+}
+
+template <typename T>
+void EventColumnStore::ArenaColumn<T>::append(const ArenaColumn &other)
+{
+    int base = data.size();
+    data += other.data;
+    ends.reserve(ends.size() + other.ends.size());
+    foreach (int end, other.ends)
+        ends.append(base + end);
+}
+
+template <typename T>
+T EventColumnStore::ArenaColumn<T>::at(int row) const
+{
+    int start = row > 0 ? ends.at(row - 1) : 0;
+    return data.mid(start, ends.at(row) - start);
+}
+
+template <typename T>
+void EventColumnStore::ArenaColumn<T>::clear()
+{
+    data.clear();
+    ends.clear();
+}
+
+EventColumnStore::EventColumnStore(const Event::PropertySet &properties)
+    : m_properties(properties)
+{
+    m_properties << Event::Id << Event::Type;
+    if (m_properties.contains(Event::FromVCardFileName) || m_properties.contains(Event::FromVCardLabel))
+        m_properties << Event::FromVCardFileName << Event::FromVCardLabel;
+}
+
+Event::PropertySet EventColumnStore::properties() const
+{
+    return m_properties;
+}
+
+int EventColumnStore::count() const
+{
+    return m_id.size();
+}
+
+bool EventColumnStore::isEmpty() const
+{
+    return m_id.isEmpty();
+}
+
+void EventColumnStore::clear()
+{
+    m_id.clear();
+    m_type.clear();
+    m_startTime.clear();
+    m_endTime.clear();
+    m_direction.clear();
+    m_flags.clear();
+    m_status.clear();
+    m_bytesReceived.clear();
+    m_localUid.clear();
+    m_remoteUid.clear();
+    m_parentId.clear();
+    m_groupId.clear();
+    m_lastModified.clear();
+    m_validityPeriod.clear();
+    m_readStatus.clear();
+    m_subject.clear();
+    m_freeText.clear();
+    m_messageToken.clear();
+    m_vCardFileName.clear();
+    m_vCardLabel.clear();
+    m_contentLocation.clear();
+    m_mmsId.clear();
+    m_headers.clear();
+    m_uids.clear();
+    m_uidIndex.clear();
+    m_rowById.clear();
+}
+
+int EventColumnStore::uidIndex(const QString &uid)
+{
+    QHash<QString, int>::const_iterator it = m_uidIndex.constFind(uid);
+    if (it != m_uidIndex.constEnd())
+        return it.value();
+
+    m_uids.append(uid);
+    m_uidIndex.insert(uid, m_uids.size() - 1);
+    return m_uids.size() - 1;
+}
+
+void EventColumnStore::appendRow(const QSqlQuery &query, const DatabaseIOPrivate::EventProjection &projection)
+{
+    // Unselected columns are stored with the defaults of Event
+    QVariant v;
+
+    m_id.append(columnValue(query, projection, DatabaseIOPrivate::IdColumn).toInt());
+    m_type.append(columnValue(query, projection, DatabaseIOPrivate::TypeColumn).toUInt());
+    m_startTime.append(columnValue(query, projection, DatabaseIOPrivate::StartTimeColumn).toUInt());
+    m_endTime.append(columnValue(query, projection, DatabaseIOPrivate::EndTimeColumn).toUInt());
+    m_direction.append(columnValue(query, projection, DatabaseIOPrivate::DirectionColumn).toUInt());
+    m_status.append(columnValue(query, projection, DatabaseIOPrivate::StatusColumn).toUInt());
+    m_bytesReceived.append(columnValue(query, projection, DatabaseIOPrivate::BytesReceivedColumn).toInt());
+    m_localUid.append(uidIndex(columnValue(query, projection, DatabaseIOPrivate::LocalUidColumn).toString()));
+    m_remoteUid.append(uidIndex(columnValue(query, projection, DatabaseIOPrivate::RemoteUidColumn).toString()));
+    v = columnValue(query, projection, DatabaseIOPrivate::ParentIdColumn);
+    m_parentId.append(v.isNull() ? -1 : v.toInt());
+    v = columnValue(query, projection, DatabaseIOPrivate::GroupIdColumn);
+    m_groupId.append(v.isNull() ? -1 : v.toInt());
+    m_lastModified.append(columnValue(query, projection, DatabaseIOPrivate::LastModifiedColumn).toUInt());
+    m_validityPeriod.append(columnValue(query, projection, DatabaseIOPrivate::ValidityPeriodColumn).toInt());
+    m_readStatus.append(columnValue(query, projection, DatabaseIOPrivate::ReadStatusColumn).toUInt());
+
+    quint16 flags = 0;
+    if (columnValue(query, projection, DatabaseIOPrivate::IsDraftColumn).toBool())
+        flags |= IsDraftFlag;
+    if (columnValue(query, projection, DatabaseIOPrivate::IsReadColumn).toBool())
+        flags |= IsReadFlag;
+    if (columnValue(query, projection, DatabaseIOPrivate::IsMissedCallColumn).toBool())
+        flags |= IsMissedCallFlag;
+    if (columnValue(query, projection, DatabaseIOPrivate::IsEmergencyCallColumn).toBool())
+        flags |= IsEmergencyCallFlag;
+    if (columnValue(query, projection, DatabaseIOPrivate::IsDeletedColumn).toBool())
+        flags |= IsDeletedFlag;
+    if (columnValue(query, projection, DatabaseIOPrivate::ReportDeliveryColumn).toBool())
+        flags |= ReportDeliveryFlag;
+    if (columnValue(query, projection, DatabaseIOPrivate::ReportReadColumn).toBool())
+        flags |= ReportReadFlag;
+    if (columnValue(query, projection, DatabaseIOPrivate::ReportReadRequestedColumn).toBool())
+        flags |= ReportReadRequestedFlag;
+    if (columnValue(query, projection, DatabaseIOPrivate::IsActionColumn).toBool())
+        flags |= IsActionFlag;
+    m_flags.append(flags);
+
+    m_subject.append(columnValue(query, projection, DatabaseIOPrivate::SubjectColumn).toString());
+    m_freeText.append(columnValue(query, projection, DatabaseIOPrivate::FreeTextColumn).toString());
+    m_messageToken.append(columnValue(query, projection, DatabaseIOPrivate::MessageTokenColumn).toString());
+    m_vCardFileName.append(columnValue(query, projection, DatabaseIOPrivate::VCardFileNameColumn).toString());
+    m_vCardLabel.append(columnValue(query, projection, DatabaseIOPrivate::VCardLabelColumn).toString());
+    m_contentLocation.append(columnValue(query, projection, DatabaseIOPrivate::ContentLocationColumn).toString());
+    m_mmsId.append(columnValue(query, projection, DatabaseIOPrivate::MmsIdColumn).toString());
+    m_headers.append(columnValue(query, projection, DatabaseIOPrivate::HeadersColumn).toByteArray());
+
+    m_rowById.clear();
+}
+
+void EventColumnStore::append(const EventColumnStore &other)
+{
+    Q_ASSERT(m_properties == other.m_properties);
+
+    m_id += other.m_id;
+    m_type += other.m_type;
+    m_startTime += other.m_startTime;
+    m_endTime += other.m_endTime;
+    m_direction += other.m_direction;
+    m_flags += other.m_flags;
+    m_status += other.m_status;
+    m_bytesReceived += other.m_bytesReceived;
+    m_parentId += other.m_parentId;
+    m_groupId += other.m_groupId;
+    m_lastModified += other.m_lastModified;
+    m_validityPeriod += other.m_validityPeriod;
+    m_readStatus += other.m_readStatus;
+
+    // Uid indexes refer to the uid list of their store
+    m_localUid.reserve(m_localUid.size() + other.m_localUid.size());
+    foreach (int index, other.m_localUid)
+        m_localUid.append(uidIndex(other.m_uids.at(index)));
+    m_remoteUid.reserve(m_remoteUid.size() + other.m_remoteUid.size());
+    foreach (int index, other.m_remoteUid)
+        m_remoteUid.append(uidIndex(other.m_uids.at(index)));
+
+    m_subject.append(other.m_subject);
+    m_freeText.append(other.m_freeText);
+    m_messageToken.append(other.m_messageToken);
+    m_vCardFileName.append(other.m_vCardFileName);
+    m_vCardLabel.append(other.m_vCardLabel);
+    m_contentLocation.append(other.m_contentLocation);
+    m_mmsId.append(other.m_mmsId);
+    m_headers.append(other.m_headers);
+
+    m_rowById.clear();
+}
+
+int EventColumnStore::id(int row) const
+{
+    return m_id.at(row);
+}
+
+QString EventColumnStore::localUid(int row) const
+{
+    return m_uids.at(m_localUid.at(row));
+}
+
+QString EventColumnStore::remoteUid(int row) const
+{
+    return m_uids.at(m_remoteUid.at(row));
+}
+
+int EventColumnStore::findRow(int id) const
+{
+    if (m_rowById.isEmpty() && !m_id.isEmpty()) {
+        m_rowById.reserve(m_id.size());
+        for (int row = m_id.size() - 1; row >= 0; row--)
+            m_rowById.insert(m_id.at(row), row);
+    }
+
+    return m_rowById.value(id, -1);
+}
+
+Event EventColumnStore::event(int row) const
+{
+    Event event;
+
+    event.setId(m_id.at(row));
+    event.setType(static_cast<Event::EventType>(m_type.at(row)));
+    if (has(Event::StartTime))
+        event.setStartTime(QDateTime::fromTime_t(m_startTime.at(row)));
+    if (has(Event::EndTime))
+        event.setEndTime(QDateTime::fromTime_t(m_endTime.at(row)));
+    if (has(Event::Direction))
+        event.setDirection(static_cast<Event::EventDirection>(m_direction.at(row)));
+    if (has(Event::IsDraft))
+        event.setIsDraft(flag(row, IsDraftFlag));
+    if (has(Event::IsRead))
+        event.setIsRead(flag(row, IsReadFlag));
+    if (has(Event::IsMissedCall))
+        event.setIsMissedCall(flag(row, IsMissedCallFlag));
+    if (has(Event::IsEmergencyCall))
+        event.setIsEmergencyCall(flag(row, IsEmergencyCallFlag));
+    if (has(Event::Status))
+        event.setStatus(static_cast<Event::EventStatus>(m_status.at(row)));
+    if (has(Event::BytesReceived))
+        event.setBytesReceived(m_bytesReceived.at(row));
+    if (has(Event::LocalUid))
+        event.setLocalUid(localUid(row));
+    if (has(Event::RemoteUid))
+        event.setRemoteUid(remoteUid(row));
+    if (has(Event::ParentId))
+        event.setParentId(m_parentId.at(row));
+    if (has(Event::Subject))
+        event.setSubject(m_subject.at(row));
+    if (has(Event::FreeText))
+        event.setFreeText(m_freeText.at(row));
+    if (has(Event::GroupId))
+        event.setGroupId(m_groupId.at(row));
+    if (has(Event::MessageToken))
+        event.setMessageToken(m_messageToken.at(row));
+    if (has(Event::LastModified))
+        event.setLastModified(QDateTime::fromTime_t(m_lastModified.at(row)));
+    if (has(Event::FromVCardFileName))
+        event.setFromVCard(m_vCardFileName.at(row), m_vCardLabel.at(row));
+    if (has(Event::IsDeleted))
+        event.setDeleted(flag(row, IsDeletedFlag));
+    if (has(Event::ReportDelivery))
+        event.setReportDelivery(flag(row, ReportDeliveryFlag));
+    if (has(Event::ValidityPeriod))
+        event.setValidityPeriod(m_validityPeriod.at(row));
+    if (has(Event::ContentLocation))
+        event.setContentLocation(m_contentLocation.at(row));
+    if (has(Event::ReadStatus))
+        event.setReadStatus(static_cast<Event::EventReadStatus>(m_readStatus.at(row)));
+    if (has(Event::ReportRead))
+        event.setReportRead(flag(row, ReportReadFlag));
+    if (has(Event::ReportReadRequested))
+        event.setReportReadRequested(flag(row, ReportReadRequestedFlag));
+    if (has(Event::MmsId))
+        event.setMmsId(m_mmsId.at(row));
+    if (has(Event::IsAction))
+        event.setIsAction(flag(row, IsActionFlag));
+    if (has(Event::Headers))
+        event.setEncodedHeaders(m_headers.at(row));
+
+    return event;
+}
+
+QVariant EventColumnStore::value(int row, int column) const
+{
+    switch (column) {
+        case EventModel::EventId:
+            return QVariant::fromValue(m_id.at(row));
+        case EventModel::EventType:
+            return QVariant::fromValue((int)m_type.at(row));
+        case EventModel::StartTime:
+            return QVariant::fromValue(has(Event::StartTime) ? QDateTime::fromTime_t(m_startTime.at(row)) : QDateTime());
+        case EventModel::EndTime:
+            return QVariant::fromValue(has(Event::EndTime) ? QDateTime::fromTime_t(m_endTime.at(row)) : QDateTime());
+        case EventModel::Direction:
+            return QVariant::fromValue((int)m_direction.at(row));
+        case EventModel::IsDraft:
+            return QVariant::fromValue(flag(row, IsDraftFlag));
+        case EventModel::IsRead:
+            return QVariant::fromValue(flag(row, IsReadFlag));
+        case EventModel::IsMissedCall:
+            return QVariant::fromValue(flag(row, IsMissedCallFlag));
+        case EventModel::Status:
+            return QVariant::fromValue((int)m_status.at(row));
+        case EventModel::BytesReceived:
+            return QVariant::fromValue(m_bytesReceived.at(row));
+        case EventModel::LocalUid:
+            return QVariant::fromValue(localUid(row));
+        case EventModel::RemoteUid:
+            return QVariant::fromValue(remoteUid(row));
+        case EventModel::FreeText:
+            return QVariant::fromValue(m_freeText.at(row));
+        case EventModel::GroupId:
+            return QVariant::fromValue(m_groupId.at(row));
+        case EventModel::MessageToken:
+            return QVariant::fromValue(m_messageToken.at(row));
+        case EventModel::LastModified:
+            return QVariant::fromValue(has(Event::LastModified) ? QDateTime::fromTime_t(m_lastModified.at(row)) : QDateTime());
+        case EventModel::EventCount:
+            return QVariant::fromValue(0);
+        case EventModel::FromVCardFileName:
+            return QVariant::fromValue(m_vCardFileName.at(row));
+        case EventModel::FromVCardLabel: {
+            // As set by Event::setFromVCard()
+            QString label = m_vCardLabel.at(row);
+            return QVariant::fromValue(label.isEmpty() ? m_vCardFileName.at(row) : label);
+        }
+        case EventModel::Encoding:
+        case EventModel::Charset:
+        case EventModel::Language:
+            // Not stored in the database
+            return QVariant::fromValue(QString());
+        case EventModel::IsDeleted:
+            return QVariant::fromValue(flag(row, IsDeletedFlag));
+        default:
+            return QVariant();
+    }
+}
+
+QList<QPair<QString, QString> > EventColumnStore::addresses() const
+{
+    QSet<QPair<int, int> > seen;
+    QList<QPair<QString, QString> > result;
+    for (int row = 0; row < m_id.size(); row++) {
+        QPair<int, int> key(m_localUid.at(row), m_remoteUid.at(row));
+        if (seen.contains(key))
+            continue;
+        seen.insert(key);
+        result.append(qMakePair(m_uids.at(key.first), m_uids.at(key.second)));
+    }
+    return result;
+}
@@ -0,0 +1,166 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_EVENTCOLUMNSTORE_H
+#define COMMHISTORY_EVENTCOLUMNSTORE_H
+
+#include <QVector>
+#include <QHash>
+#include <QStringList>
+#include <QPair>
+#include <QMetaType>
+
+#include "event.h"
+#include "databaseio_p.h"
+
+class QSqlQuery;
+
+namespace CommHistory {
+
+/*!
+ * \class EventColumnStore
+ *
+ * Query results stored column by column. Numbers and flags are kept in
+ * fixed width arrays, uids are stored once and referenced by index, and
+ * text is kept in one string per column. Event objects are created only
+ * when requested with event().
+ */
+class EventColumnStore
+{
+public:
+    /*!
+     * \param properties Properties selected by the queries whose results
+     *                   are stored. Other properties are not valid in
+     *                   the events returned by event().
+     */
+    explicit EventColumnStore(const Event::PropertySet &properties = Event::allProperties());
+
+    Event::PropertySet properties() const;
+
+    int count() const;
+    bool isEmpty() const;
+    void clear();
+
+    /*!
+     * Append the current row of a query that selects
+     * DatabaseIOPrivate::eventQueryBase(properties()).
+     */
+    void appendRow(const QSqlQuery &query, const DatabaseIOPrivate::EventProjection &projection);
+
+    /*!
+     * Append all rows of another store with the same properties.
+     */
+    void append(const EventColumnStore &other);
+
+    int id(int row) const;
+    QString localUid(int row) const;
+    QString remoteUid(int row) const;
+
+    /*!
+     * Row of an event, or -1 if not found.
+     */
+    int findRow(int id) const;
+
+    /*!
+     * Create the event of a row.
+     */
+    Event event(int row) const;
+
+    /*!
+     * Value of an EventModel column, as EventModel::data() returns it for
+     * an event. EventModel::Contacts is not stored and returns an invalid
+     * value.
+     */
+    QVariant value(int row, int column) const;
+
+    /*!
+     * Distinct (local uid, remote uid) pairs of the stored events.
+     */
+    QList<QPair<QString, QString> > addresses() const;
+
+private:
+    enum Flag {
+        IsDraftFlag = 0x1,
+        IsReadFlag = 0x2,
+        IsMissedCallFlag = 0x4,
+        IsEmergencyCallFlag = 0x8,
+        IsDeletedFlag = 0x10,
+        ReportDeliveryFlag = 0x20,
+        ReportReadFlag = 0x40,
+        ReportReadRequestedFlag = 0x80,
+        IsActionFlag = 0x100
+    };
+
+    template <typename T>
+    struct ArenaColumn {
+        T data;
+        QVector<int> ends;
+
+        void append(const T &value);
+        void append(const ArenaColumn &other);
+        T at(int row) const;
+        void clear();
+    };
+
+    int uidIndex(const QString &uid);
+    bool flag(int row, Flag f) const { return (m_flags.at(row) & f) != 0; }
+    bool has(Event::Property property) const { return m_properties.contains(property); }
+
+    Event::PropertySet m_properties;
+
+    QVector<int> m_id;
+    QVector<quint8> m_type;
+    QVector<quint32> m_startTime;
+    QVector<quint32> m_endTime;
+    QVector<quint8> m_direction;
+    QVector<quint16> m_flags;
+    QVector<quint8> m_status;
+    QVector<int> m_bytesReceived;
+    QVector<int> m_localUid;
+    QVector<int> m_remoteUid;
+    QVector<int> m_parentId;
+    QVector<int> m_groupId;
+    QVector<quint32> m_lastModified;
+    QVector<int> m_validityPeriod;
+    QVector<quint8> m_readStatus;
+
+    ArenaColumn<QString> m_subject;
+    ArenaColumn<QString> m_freeText;
+    ArenaColumn<QString> m_messageToken;
+    ArenaColumn<QString> m_vCardFileName;
+    ArenaColumn<QString> m_vCardLabel;
+    ArenaColumn<QString> m_contentLocation;
+    ArenaColumn<QString> m_mmsId;
+    ArenaColumn<QByteArray> m_headers;
+
+    QStringList m_uids;
+    QHash<QString, int> m_uidIndex;
+
+    // Built on first use by findRow()
+    mutable QHash<int, int> m_rowById;
+};
+
+}
+
+Q_DECLARE_METATYPE(CommHistory::EventColumnStore*)
+
+#endif
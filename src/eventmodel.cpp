@@ -28,6 +28,7 @@
 #include "adaptor.h"
 #include "event.h"
 #include "eventtreeitem.h"
+#include "eventcolumnstore.h"
 #include "debug.h"
 
 using namespace CommHistory;
@@ -147,7 +148,11 @@ QModelIndex EventModel::parent(const QModelIndex &index) const
         return QModelIndex();
     }
 
+    // Rows of the column store have no item and are all at the root
     EventTreeItem *childItem = static_cast<EventTreeItem *>(index.internalPointer());
+    if (!childItem) {
+        return QModelIndex();
+    }
     EventTreeItem *parentItem = childItem->parent();
 
     if (!parentItem || parentItem == d->eventRootItem) {
@@ -162,6 +167,8 @@ bool EventModel::hasChildren(const QModelIndex &parent) const
     Q_D(const EventModel);
     EventTreeItem *item;
     if (!parent.isValid()) {
+        if (d->columnStore)
+            return !d->columnStore->isEmpty();
         item = d->eventRootItem;
     } else {
         item = static_cast<EventTreeItem *>(parent.internalPointer());
@@ -177,6 +184,10 @@ QModelIndex EventModel::index(int row, int column,
         return QModelIndex();
     }
 
+    if (!parent.isValid() && d->columnStore) {
+        return createIndex(row, column);
+    }
+
     EventTreeItem *parentItem;
     if (!parent.isValid()) {
         parentItem = d->eventRootItem;
@@ -201,9 +212,13 @@ int EventModel::rowCount(const QModelIndex &parent) const
 
     EventTreeItem *parentItem;
     if (!parent.isValid()) {
+        if (d->columnStore)
+            return d->columnStore->count();
         parentItem = d->eventRootItem;
     } else {
         parentItem = static_cast<EventTreeItem *>(parent.internalPointer());
+        if (!parentItem)
+            return 0;
     }
 
     return parentItem->childCount();
@@ -218,13 +233,16 @@ int EventModel::columnCount(const QModelIndex &parent) const
 
 QVariant EventModel::data(const QModelIndex &index, int role) const
 {
-    Q_UNUSED(role);
+    Q_D(const EventModel);
 
     if (!index.isValid()) {
         return QVariant();
     }
 
     EventTreeItem *item = static_cast<EventTreeItem *>(index.internalPointer());
+    if (!item) {
+        return d->columnData(index.row(), index.column(), role);
+    }
     Event &event = item->event();
 
     if (role == Qt::UserRole) {
@@ -322,11 +340,18 @@ QVariant EventModel::data(const QModelIndex &index, int role) const
 
 Event EventModel::event(const QModelIndex &index) const
 {
+    Q_D(const EventModel);
+
     if (!index.isValid()) {
         return Event();
     }
 
     EventTreeItem *item = static_cast<EventTreeItem *>(index.internalPointer());
+    if (!item) {
+        if (!d->columnStore || index.row() >= d->columnStore->count())
+            return Event();
+        return d->columnEvent(index.row());
+    }
     return item->event();
 }
 
@@ -462,6 +487,18 @@ void EventModel::setOffset(int offset)
     d->queryOffset = offset;
 }
 
+void EventModel::setColumnStorage(bool enabled)
+{
+    Q_D(EventModel);
+    d->columnStorage = enabled;
+}
+
+bool EventModel::columnStorage() const
+{
+    Q_D(const EventModel);
+    return d->columnStorage;
+}
+
 void EventModel::enableContactChanges(bool enabled)
 {
     Q_D(EventModel);
@@ -482,26 +519,17 @@ bool EventModel::addEvents(QList<Event> &events, bool toModelOnly)
     Q_D(EventModel);
 
     if (!toModelOnly) {
-        // Insert the events into the database
-        if (!d->database()->transaction())
-            return false;
-
-        // Cannot be foreach, because addEvent modifies the events with their new ID
-        for (int i = 0; i < events.size(); i++) {
-            if (!d->database()->addEvent(events[i])) {
-                d->database()->rollback();
-                return false;
-            }
-        }
-
-        if (!d->database()->commit())
+        // Insert the events into the database, updating their IDs
+        if (!d->database()->addEvents(events))
             return false;
     }
 
-    foreach (Event event, events) {
+    QList<Event> accepted;
+    foreach (const Event &event, events) {
         if (d->acceptsEvent(event))
-            d->addToModel(event);
+            accepted.append(event);
     }
+    d->addEventsToModel(accepted);
 
     emit d->eventsAdded(events);
 
@@ -527,6 +555,12 @@ bool EventModel::modifyEvents(QList<Event> &events)
     if (!d->database()->transaction())
         return false;
 
+    QHash<int, Event> previous;
+    if (!d->readPreviousStates(events, previous)) {
+        d->database()->rollback();
+        return false;
+    }
+
     QList<int> modifiedGroups;
     for (QList<Event>::Iterator it = events.begin(); it != events.end(); it++) {
         Event &event = *it;
@@ -539,6 +573,14 @@ bool EventModel::modifyEvents(QList<Event> &events)
         if (event.lastModified() == QDateTime::fromTime_t(0))
              event.setLastModified(QDateTime::currentDateTime());
 
+        QHash<int, Event>::const_iterator state = previous.constFind(event.id());
+        if (state != previous.constEnd()
+            && state->groupId() != event.groupId()
+            && state->groupId() != -1
+            && !modifiedGroups.contains(state->groupId())) {
+            modifiedGroups.append(state->groupId());
+        }
+
         if (!d->database()->modifyEvent(event)) {
             d->database()->rollback();
             return false;
@@ -555,7 +597,7 @@ bool EventModel::modifyEvents(QList<Event> &events)
     if (!d->database()->commit())
         return false;
 
-    emit d->eventsUpdated(events);
+    d->emitEventsUpdated(events, previous);
     if (!modifiedGroups.isEmpty())
         emit d->groupsUpdated(modifiedGroups);
     emit d->eventsCommitted(events, true);
@@ -619,7 +661,8 @@ bool EventModel::deleteEvent(Event &event)
     if (!d->database()->commit())
         return false;
 
-    emit d->eventDeleted(event.id());
+    // Sent with the state of the event, for the group counters
+    emit d->eventsDeleted(QList<Event>() << event);
 
     if (groupDeleted)
         emit d->groupsDeleted(QList<int>() << event.groupId());
@@ -646,6 +689,7 @@ bool EventModel::moveEvent(Event &event, int groupId)
 
     // DatabaseIO::moveEvent changes groupId
     int oldGroupId = event.groupId();
+    Event previous = event;
 
     if (!d->database()->transaction())
         return false;
@@ -678,7 +722,7 @@ bool EventModel::moveEvent(Event &event, int groupId)
     if (!d->database()->commit())
         return false;
 
-    emit d->eventDeleted(event.id());
+    emit d->eventsDeleted(QList<Event>() << previous);
     if (groupDeleted != -1)
         emit d->groupsDeleted(QList<int>() << groupDeleted);
     else if (oldGroupId != -1)
@@ -701,6 +745,12 @@ bool EventModel::modifyEventsInGroup(QList<Event> &events, Group group)
     if (!d->database()->transaction())
         return false;
 
+    QHash<int, Event> previous;
+    if (!d->readPreviousStates(events, previous)) {
+        d->database()->rollback();
+        return false;
+    }
+
     for (QList<Event>::Iterator it = events.begin(); it != events.end(); it++) {
         Event &event = *it;
         if (event.id() == -1) {
@@ -760,7 +810,7 @@ bool EventModel::modifyEventsInGroup(QList<Event> &events, Group group)
     if (!d->database()->commit())
         return false;
 
-    emit d->eventsUpdated(events);
+    d->emitEventsUpdated(events, previous);
     emit d->groupsUpdatedFull(QList<Group>() << group);
     emit d->eventsCommitted(events, true);
     return true;
@@ -783,6 +833,7 @@ void EventModel::setBackgroundThread(QThread *thread)
 {
     Q_D(EventModel);
 
+    d->cancelQuery();
     d->bgThread = thread;
     DEBUG() << Q_FUNC_INFO << thread;
 }
@@ -123,7 +123,7 @@ public:
      * properties are read; for example, id and type are always valid.
      * getEvent() will always fetch the full event data.
      *
-     * \param properties QSet of event properties to fetch (see Event::Property).
+     * \param properties Set of event properties to fetch (see Event::Property).
      */
     void setPropertyMask(const Event::PropertySet &properties);
 
@@ -167,9 +167,10 @@ public:
      * and results will be fetched in the background. modelReady() is
      * emitted when all results have been received.
      *
-     * StreamedAsyncQuery (not implemented yet): Same as AsyncQuery, but
-     * only one chunk is fetched at a time. Use the standard Qt model
-     * canFetchMore() and fetchMore() to fetch more events.
+     * StreamedAsyncQuery: Same as AsyncQuery, but only one chunk is
+     * fetched at a time. Use the standard Qt model canFetchMore() and
+     * fetchMore() to fetch more events. Currently only implemented by
+     * ConversationModel; other models fetch all events.
      *
      * SyncQuery: getEvents() blocks until all results have been fetched.
      *
@@ -218,6 +219,20 @@ public:
      */
     void enableContactChanges(bool enabled);
 
+    /*!
+     * If enabled, query results of flat models are kept column by
+     * column and Event instances are created only when a row is read
+     * with Qt::UserRole or event(). This makes large read-only lists
+     * considerably smaller. The rows are converted to regular events on
+     * the first change to the model contents (for example addEvent() or
+     * a modified event). Models that do not support it ignore this.
+     * Disabled by default. Takes effect on the next getEvents().
+     *
+     * \param enabled If true, use column storage.
+     */
+    void setColumnStorage(bool enabled);
+    bool columnStorage() const;
+
     /*!
      * Add a new event.
      *
@@ -335,6 +350,8 @@ public:
     /*!
      * Provide background thread for running database queries and blocking operations.
      * It allows to avoid blocking when the model used in the main GUI thread.
+     * Queries are run in the background thread unless the query mode is
+     * SyncQuery, and use a separate database connection for that thread.
      * This function will cancel any outgoing requests. If thread is NULL,
      * model's thread is used for quereis.
      *
@@ -36,6 +36,8 @@
 #include "commonutils.h"
 #include "debug.h"
 #include "recentcontactsmodel.h"
+#include "queryworker.h"
+#include "eventcolumnstore.h"
 
 using namespace CommHistory;
 
@@ -55,43 +57,63 @@ EventModelPrivate::EventModelPrivate(EventModel *model)
         , threadCanFetchMore(false)
         , contactChangesEnabled(false)
         , propertyMask(Event::allProperties())
+        , columnStorage(false)
+        , columnStore(0)
+        , contactCache(ContactCache::instance())
+        , contactListening(false)
         , bgThread(0)
+        , queryWorker(0)
+        , activeQueryId(0)
 {
     q_ptr = model;
     qRegisterMetaType<QList<CommHistory::Event> >();
+    qRegisterMetaType<CommHistory::Event::PropertySet>();
+    qRegisterMetaType<CommHistory::EventColumnStore*>();
     // emit dbus signals
     emitter = UpdatesEmitter::instance();
     connect(this, SIGNAL(eventsAdded(const QList<CommHistory::Event>&)),
-            emitter.data(), SIGNAL(eventsAdded(const QList<CommHistory::Event>&)));
+            emitter.data(), SLOT(queueEventsAdded(const QList<CommHistory::Event>&)));
     connect(this, SIGNAL(eventsUpdated(const QList<CommHistory::Event>&)),
-            emitter.data(), SIGNAL(eventsUpdated(const QList<CommHistory::Event>&)));
+            emitter.data(), SLOT(queueEventsUpdated(const QList<CommHistory::Event>&)));
+    connect(this, SIGNAL(eventPropertiesUpdated(const QList<QByteArray>&, const QStringList&)),
+            emitter.data(), SLOT(queueEventPropertiesUpdated(const QList<QByteArray>&, const QStringList&)));
     connect(this, SIGNAL(eventDeleted(int)),
-            emitter.data(), SIGNAL(eventDeleted(int)));
+            emitter.data(), SLOT(queueEventDeleted(int)));
+    connect(this, SIGNAL(eventsDeleted(const QList<CommHistory::Event>&)),
+            emitter.data(), SLOT(queueEventsDeleted(const QList<CommHistory::Event>&)));
     connect(this, SIGNAL(groupsUpdated(const QList<int>&)),
-            emitter.data(), SIGNAL(groupsUpdated(const QList<int>&)));
+            emitter.data(), SLOT(queueGroupsUpdated(const QList<int>&)));
     connect(this, SIGNAL(groupsUpdatedFull(const QList<CommHistory::Group>&)),
-            emitter.data(), SIGNAL(groupsUpdatedFull(const QList<CommHistory::Group>&)));
+            emitter.data(), SLOT(queueGroupsUpdatedFull(const QList<CommHistory::Group>&)));
     connect(this, SIGNAL(groupsDeleted(const QList<int>&)),
-            emitter.data(), SIGNAL(groupsDeleted(const QList<int>&)));
-
-    // listen to dbus signals
-    QDBusConnection::sessionBus().connect(
-        QString(), QString(), COMM_HISTORY_SERVICE_NAME, EVENTS_ADDED_SIGNAL,
-        this, SLOT(eventsAddedSlot(const QList<CommHistory::Event> &)));
-    QDBusConnection::sessionBus().connect(
-        QString(), QString(), COMM_HISTORY_SERVICE_NAME, EVENTS_UPDATED_SIGNAL,
-        this, SLOT(eventsUpdatedSlot(const QList<CommHistory::Event> &)));
-    QDBusConnection::sessionBus().connect(
-        QString(), QString(), COMM_HISTORY_SERVICE_NAME, EVENT_DELETED_SIGNAL,
-        this, SLOT(eventDeletedSlot(int)));
+            emitter.data(), SLOT(queueGroupsDeleted(const QList<int>&)));
+
+    // listen to changes from this and other processes; subclasses may
+    // narrow added and updated events down to their feeds with
+    // updateSubscriptions()
+    emitter->subscribe(subscribedPaths);
+    connect(emitter.data(), SIGNAL(receivedEventsAdded(const QList<CommHistory::Event> &)),
+            this, SLOT(eventsAddedSlot(const QList<CommHistory::Event> &)));
+    connect(emitter.data(), SIGNAL(receivedEventPropertiesUpdated(const QList<CommHistory::Event> &,
+                                                                  const QList<CommHistory::Event> &)),
+            this, SLOT(eventPropertiesUpdatedSlot(const QList<CommHistory::Event> &)));
+    connect(emitter.data(), SIGNAL(receivedEventDeleted(int)),
+            this, SLOT(eventDeletedSlot(int)));
 
     eventRootItem = new EventTreeItem(Event());
+    eventRootItem->enableIdIndex();
 }
 
 EventModelPrivate::~EventModelPrivate()
 {
     DEBUG() << Q_FUNC_INFO;
 
+    if (queryWorker)
+        queryWorker->deleteLater();
+
+    emitter->unsubscribe(subscribedPaths);
+
+    delete columnStore;
     delete eventRootItem;
 }
 
@@ -101,26 +123,44 @@ bool EventModelPrivate::acceptsEvent(const Event &event) const
     return false;
 }
 
-QModelIndex EventModelPrivate::findEventRecursive(int id, EventTreeItem *parent) const
+bool EventModelPrivate::acceptsUpdatedEvent(const Event &event) const
 {
-    Q_Q(const EventModel);
+    return acceptsEvent(event);
+}
 
-    if (id < 0)
-        return QModelIndex();
+QStringList EventModelPrivate::subscriptionPaths() const
+{
+    return QStringList();
+}
 
-    for (int row = 0; row < parent->childCount(); row++) {
-        if (parent->eventAt(row).id() == id) {
-            return q->createIndex(row, 0, parent->child(row));
-        } else if (parent->child(row)->childCount()) {
-            return findEventRecursive(id, parent->child(row));
-        }
-    }
-    return QModelIndex();
+void EventModelPrivate::updateSubscriptions()
+{
+    QStringList paths = subscriptionPaths();
+    if (paths == subscribedPaths)
+        return;
+
+    DEBUG() << Q_FUNC_INFO << paths;
+
+    // Subscribe first so that shared feeds stay connected
+    emitter->subscribe(paths);
+    emitter->unsubscribe(subscribedPaths);
+    subscribedPaths = paths;
 }
 
 QModelIndex EventModelPrivate::findEvent(int id) const
 {
-    return findEventRecursive(id, eventRootItem);
+    Q_Q(const EventModel);
+
+    if (columnStore) {
+        int row = columnStore->findRow(id);
+        return row >= 0 ? q->createIndex(row, 0) : QModelIndex();
+    }
+
+    EventTreeItem *item = eventRootItem->findItem(id);
+    if (!item)
+        return QModelIndex();
+
+    return q->createIndex(item->row(), 0, item);
 }
 
 QModelIndex EventModelPrivate::findParent(const Event &event)
@@ -137,16 +177,63 @@ bool EventModelPrivate::executeQuery(QSqlQuery &query)
 
     isReady = false;
 
+    if (queryMode != EventModel::SyncQuery && bgThread) {
+        if (queryWorker && queryWorker->thread() != bgThread) {
+            queryWorker->deleteLater();
+            queryWorker = 0;
+        }
+
+        if (!queryWorker) {
+            queryWorker = new QueryWorker;
+            queryWorker->moveToThread(bgThread);
+            connect(queryWorker, SIGNAL(eventsReceived(int, int, int, QList<CommHistory::Event>)),
+                    this, SLOT(queryEventsReceivedSlot(int, int, int, QList<CommHistory::Event>)),
+                    Qt::QueuedConnection);
+            connect(queryWorker, SIGNAL(columnsReceived(int, CommHistory::EventColumnStore*)),
+                    this, SLOT(queryColumnsReceivedSlot(int, CommHistory::EventColumnStore*)),
+                    Qt::QueuedConnection);
+            connect(queryWorker, SIGNAL(queryFinished(int, bool)),
+                    this, SLOT(queryFinishedSlot(int, bool)),
+                    Qt::QueuedConnection);
+        }
+
+        // The statement is prepared again on the connection of the worker thread
+        uint size = resultChunkSize();
+        QMetaObject::invokeMethod(queryWorker,
+                                  usesColumnStorage() ? "runColumnQuery" : "runQuery",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(int, ++activeQueryId),
+                                  Q_ARG(QString, query.lastQuery()),
+                                  Q_ARG(QVariantMap, query.boundValues()),
+                                  Q_ARG(CommHistory::Event::PropertySet, queryProperties()),
+                                  Q_ARG(int, size ? (firstChunkSize ? firstChunkSize : size) : 0),
+                                  Q_ARG(int, size));
+        return true;
+    }
+
     if (!query.exec()) {
         qWarning() << "Failed to execute query";
         qWarning() << query.lastError();
         qWarning() << query.lastQuery();
     }
 
+    DatabaseIOPrivate::EventProjection projection = DatabaseIOPrivate::eventProjection(queryProperties());
+
+    if (usesColumnStorage()) {
+        EventColumnStore *columns = new EventColumnStore(queryProperties());
+        while (query.next())
+            columns->appendRow(query, projection);
+        query.finish();
+
+        fillColumns(columns);
+        modelUpdatedSlot(true);
+        return true;
+    }
+
     QList<Event> events;
     while (query.next()) {
         Event e;
-        DatabaseIOPrivate::readEventResult(query, e);
+        DatabaseIOPrivate::readEventResult(query, e, projection);
         events.append(e);
     }
 
@@ -155,6 +242,60 @@ bool EventModelPrivate::executeQuery(QSqlQuery &query)
     return true;
 }
 
+Event::PropertySet EventModelPrivate::queryProperties() const
+{
+    Event::PropertySet properties = propertyMask;
+    properties << Event::Id
+               << Event::Type
+               << Event::StartTime
+               << Event::EndTime
+               << Event::Direction
+               << Event::IsMissedCall
+               << Event::GroupId
+               << Event::LocalUid
+               << Event::RemoteUid;
+    properties -= Event::EventCount;
+    return properties;
+}
+
+uint EventModelPrivate::resultChunkSize() const
+{
+    return chunkSize;
+}
+
+void EventModelPrivate::cancelQuery()
+{
+    // Results are matched against the id of the latest query
+    ++activeQueryId;
+}
+
+void EventModelPrivate::queryEventsReceivedSlot(int queryId, int start, int end,
+                                                QList<CommHistory::Event> events)
+{
+    if (queryId != activeQueryId)
+        return;
+
+    eventsReceivedSlot(start, end, events);
+}
+
+void EventModelPrivate::queryColumnsReceivedSlot(int queryId, CommHistory::EventColumnStore *columns)
+{
+    if (queryId != activeQueryId) {
+        delete columns;
+        return;
+    }
+
+    fillColumns(columns);
+}
+
+void EventModelPrivate::queryFinishedSlot(int queryId, bool successful)
+{
+    if (queryId != activeQueryId)
+        return;
+
+    modelUpdatedSlot(successful);
+}
+
 bool EventModelPrivate::fillModel(int start,
                                  int end,
                                  QList<CommHistory::Event> events)
@@ -177,8 +318,134 @@ bool EventModelPrivate::fillModel(int start,
 void EventModelPrivate::clearEvents()
 {
     DEBUG() << __PRETTY_FUNCTION__;
+    cancelQuery();
+    delete columnStore;
+    columnStore = 0;
     delete eventRootItem;
     eventRootItem = new EventTreeItem(Event());
+    eventRootItem->enableIdIndex();
+}
+
+bool EventModelPrivate::supportsColumnStorage() const
+{
+    return true;
+}
+
+bool EventModelPrivate::usesColumnStorage() const
+{
+    return columnStorage && supportsColumnStorage();
+}
+
+void EventModelPrivate::fillColumns(EventColumnStore *columns)
+{
+    Q_Q(EventModel);
+    DEBUG() << __PRETTY_FUNCTION__ << ": read" << columns->count() << "events";
+
+    if (columns->isEmpty()) {
+        delete columns;
+        return;
+    }
+
+    startContactListening();
+
+    // Request contacts for the addresses; data() reads them from the cache
+    if (contactListening) {
+        typedef QPair<QString, QString> Address;
+        foreach (const Address &address, columns->addresses())
+            contactCache->resolve(address.first, address.second);
+    }
+
+    if (eventRootItem->childCount() > 0) {
+        // The model has been changed since the query started
+        QList<Event> events;
+        for (int row = 0; row < columns->count(); row++)
+            events.append(columns->event(row));
+        delete columns;
+        eventsReceivedSlot(0, events.size(), events);
+        return;
+    }
+
+    int first = columnStore ? columnStore->count() : 0;
+    q->beginInsertRows(QModelIndex(), first, first + columns->count() - 1);
+    if (columnStore) {
+        columnStore->append(*columns);
+        delete columns;
+    } else {
+        columnStore = columns;
+    }
+    q->endInsertRows();
+}
+
+void EventModelPrivate::materializeColumns()
+{
+    if (!columnStore)
+        return;
+
+    Q_Q(EventModel);
+    DEBUG() << __PRETTY_FUNCTION__ << columnStore->count();
+
+    // Rows keep their positions, but their indexes now point to items
+    emit q->layoutAboutToBeChanged();
+
+    EventColumnStore *columns = columnStore;
+    columnStore = 0;
+    for (int row = 0; row < columns->count(); row++)
+        eventRootItem->appendChild(new EventTreeItem(columnEvent(row, columns), eventRootItem));
+
+    foreach (const QModelIndex &index, q->persistentIndexList()) {
+        if (!index.internalPointer() && index.row() < eventRootItem->childCount())
+            q->changePersistentIndex(index, q->createIndex(index.row(), index.column(),
+                                                           eventRootItem->child(index.row())));
+    }
+
+    emit q->layoutChanged();
+    delete columns;
+}
+
+Event EventModelPrivate::columnEvent(int row) const
+{
+    return columnEvent(row, columnStore);
+}
+
+Event EventModelPrivate::columnEvent(int row, const EventColumnStore *columns) const
+{
+    Event event = columns->event(row);
+
+    QList<Event::Contact> contacts = contactCache->contacts(event.localUid(), event.remoteUid());
+    if (!contacts.isEmpty())
+        event.setContacts(contacts);
+
+    return event;
+}
+
+QVariant EventModelPrivate::columnData(int row, int column, int role) const
+{
+    if (!columnStore || row >= columnStore->count())
+        return QVariant();
+
+    if (role == Qt::UserRole)
+        return QVariant::fromValue(columnEvent(row));
+
+    if (role >= EventModel::BaseRole)
+        column = role - EventModel::BaseRole;
+
+    if (column == EventModel::Contacts) {
+        return QVariant::fromValue(contactCache->contacts(columnStore->localUid(row),
+                                                          columnStore->remoteUid(row)));
+    }
+
+    return columnStore->value(row, column);
+}
+
+void EventModelPrivate::changeColumnContacts()
+{
+    Q_Q(EventModel);
+
+    if (!columnStore || columnStore->isEmpty())
+        return;
+
+    emit q->dataChanged(q->createIndex(0, EventModel::Contacts),
+                        q->createIndex(columnStore->count() - 1, EventModel::Contacts));
 }
 
 void EventModelPrivate::addToModel(Event &event)
@@ -186,8 +453,10 @@ void EventModelPrivate::addToModel(Event &event)
     Q_Q(EventModel);
     DEBUG() << Q_FUNC_INFO << event.toString();
 
+    materializeColumns();
+
     if (!event.contacts().isEmpty()) {
-        contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), event.contacts());
+        contactCache->insert(event.localUid(), event.remoteUid(), event.contacts());
     } else {
         setContactFromCache(event);
     }
@@ -204,12 +473,59 @@ void EventModelPrivate::addToModel(Event &event)
     q->endInsertRows();
 }
 
+void EventModelPrivate::addEventsToModel(QList<Event> &events)
+{
+    Q_Q(EventModel);
+    DEBUG() << Q_FUNC_INFO << events.count();
+
+    if (events.isEmpty())
+        return;
+
+    materializeColumns();
+
+    for (int i = 0; i < events.count(); i++) {
+        Event &event = events[i];
+        if (!event.contacts().isEmpty()) {
+            contactCache->insert(event.localUid(), event.remoteUid(), event.contacts());
+        } else {
+            setContactFromCache(event);
+        }
+    }
+
+    // Each event is prepended to its parent, so a run of events with the
+    // same parent is inserted as rows 0..n-1 in reverse order
+    int first = 0;
+    while (first < events.count()) {
+        QModelIndex index = findParent(events.at(first));
+        int last = first + 1;
+        while (last < events.count() && findParent(events.at(last)) == index)
+            last++;
+
+        EventTreeItem *item = static_cast<EventTreeItem *>(index.internalPointer());
+        if (!item) item = eventRootItem;
+
+        q->beginInsertRows(index, 0, last - first - 1);
+        for (int i = first; i < last; i++)
+            item->prependChild(new EventTreeItem(events.at(i), item));
+        q->endInsertRows();
+
+        first = last;
+    }
+}
+
 void EventModelPrivate::modifyInModel(Event &event)
 {
     Q_Q(EventModel);
     DEBUG() << __PRETTY_FUNCTION__ << event.id();
 
-    if (!event.validProperties().contains(Event::Contacts)) {
+    if (columnStore && columnStore->findRow(event.id()) < 0)
+        return;
+    materializeColumns();
+
+    // Updates may carry only the modified properties; contacts are
+    // resolved again only when the address has changed
+    if (!event.validProperties().contains(Event::Contacts)
+        && event.validProperties().contains(Event::RemoteUid)) {
         setContactFromCache(event);
     }
 
@@ -222,14 +538,17 @@ void EventModelPrivate::modifyInModel(Event &event)
         item->setEvent(oldEvent);
 
         // move event if endTime has changed
-        if (index.row() > 0 && oldTime < event.endTime()) {
+        int row = item->row();
+        if (row > 0 && oldTime < oldEvent.endTime()) {
             EventTreeItem *parent = item->parent();
             if (!parent)
                 parent = eventRootItem;
-            // TODO: beginMoveRows if/when view supports it
-            emit q->layoutAboutToBeChanged();
-            parent->moveChild(index.row(), 0);
-            emit q->layoutChanged();
+            QModelIndex parentIndex = index.parent();
+            if (q->beginMoveRows(parentIndex, row, row, parentIndex, 0)) {
+                parent->moveChild(row, 0);
+                q->endMoveRows();
+            }
+            emitDataChanged(0, item);
         } else {
             emitDataChanged(index.row(), index.internalPointer());
         }
@@ -240,6 +559,11 @@ void EventModelPrivate::deleteFromModel(int id)
 {
     Q_Q(EventModel);
     DEBUG() << __PRETTY_FUNCTION__ << id;
+
+    if (columnStore && columnStore->findRow(id) < 0)
+        return;
+    materializeColumns();
+
     QModelIndex index = findEvent(id);
     if (index.isValid()) {
         q->beginRemoveRows(index.parent(), index.row(), index.row());
@@ -254,6 +578,8 @@ void EventModelPrivate::eventsReceivedSlot(int start, int end, QList<Event> even
 {
     DEBUG() << __PRETTY_FUNCTION__ << ":" << start << end << events.count();
 
+    materializeColumns();
+
     QMutableListIterator<Event> i(events);
     while (i.hasNext()) {
         Event event = i.next();
@@ -265,7 +591,7 @@ void EventModelPrivate::eventsReceivedSlot(int start, int end, QList<Event> even
         }
 
         if (!event.contacts().isEmpty()) {
-            contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), event.contacts());
+            contactCache->insert(event.localUid(), event.remoteUid(), event.contacts());
         }  else {
             setContactFromCache(event);
         }
@@ -325,14 +651,19 @@ void EventModelPrivate::eventsAddedSlot(const QList<Event> &events)
 {
     DEBUG() << __PRETTY_FUNCTION__ << ":" << events.count() << "events";
 
+    QList<Event> accepted;
     foreach (const Event &event, events) {
+        // Batches can hold additions from other models in the process,
+        // so events already in the model are skipped, not the rest
         QModelIndex index = findEvent(event.id());
-        if (index.isValid()) return;
+        if (index.isValid())
+            continue;
 
-        Event e = event;
-        if (acceptsEvent(e))
-            addToModel(e);
+        if (acceptsEvent(event))
+            accepted.append(event);
     }
+
+    addEventsToModel(accepted);
 }
 
 void EventModelPrivate::eventsUpdatedSlot(const QList<Event> &events)
@@ -354,6 +685,114 @@ void EventModelPrivate::eventsUpdatedSlot(const QList<Event> &events)
     }
 }
 
+void EventModelPrivate::eventPropertiesUpdatedSlot(const QList<CommHistory::Event> &updated)
+{
+    DEBUG() << __PRETTY_FUNCTION__ << ":" << updated.count();
+
+    // Only the modified properties are sent, so events that are new to
+    // the model are read from the database if the model may want them,
+    // all with one query
+    QList<Event> events;
+    QList<int> missing;
+    foreach (const Event &event, updated) {
+        if (findEvent(event.id()).isValid())
+            events.append(event);
+        else if (acceptsUpdatedEvent(event))
+            missing.append(event.id());
+    }
+
+    QList<Event> stored;
+    if (!missing.isEmpty() && database()->getEvents(missing, stored))
+        events.append(stored);
+
+    if (!events.isEmpty())
+        eventsUpdatedSlot(events);
+}
+
+void EventModelPrivate::emitEventsUpdated(const QList<Event> &events,
+                                          const QHash<int, Event> &previous)
+{
+    QList<QByteArray> encoded;
+    QStringList previousPaths;
+    foreach (const Event &event, events) {
+        Event::PropertySet properties = event.modifiedProperties() + updateKeyProperties();
+
+        QHash<int, Event>::const_iterator it = previous.constFind(event.id());
+        if (it != previous.constEnd()) {
+            encoded.append(event.encodeProperties(properties, *it));
+        } else {
+            encoded.append(event.encodeProperties(properties));
+        }
+
+        // Models of the old group must learn that the event has left it
+        if (it != previous.constEnd() && it->groupId() != event.groupId()) {
+            Event moved = event;
+            moved.setGroupId(it->groupId());
+            previousPaths.append(UpdatesEmitter::feedPath(moved));
+        } else {
+            previousPaths.append(QString());
+        }
+    }
+
+    // Full events for clients of the deprecated eventsUpdated signal,
+    // dropped by the emitter unless they are enabled
+    emit eventsUpdated(events);
+    emit eventPropertiesUpdated(encoded, previousPaths);
+}
+
+bool EventModelPrivate::readPreviousStates(const QList<Event> &events, QHash<int, Event> &states)
+{
+    states.clear();
+
+    QList<int> ids;
+    foreach (const Event &event, events) {
+        if (event.id() != -1 && event.modifiedProperties().intersects(stateProperties()))
+            ids.append(event.id());
+    }
+
+    if (ids.isEmpty())
+        return true;
+
+    QList<Event> stored;
+    if (!database()->getEventStates(ids, stored))
+        return false;
+
+    foreach (const Event &event, stored)
+        states.insert(event.id(), event);
+    return true;
+}
+
+Event::PropertySet EventModelPrivate::stateProperties()
+{
+    static Event::PropertySet properties;
+    if (properties.isEmpty()) {
+        properties << Event::GroupId
+                   << Event::StartTime
+                   << Event::Direction
+                   << Event::IsRead
+                   << Event::IsDraft;
+    }
+    return properties;
+}
+
+Event::PropertySet EventModelPrivate::updateKeyProperties()
+{
+    static Event::PropertySet properties;
+    if (properties.isEmpty()) {
+        properties << Event::StartTime
+                   << Event::EndTime
+                   << Event::Direction
+                   << Event::IsDraft
+                   << Event::IsMissedCall
+                   << Event::LocalUid
+                   << Event::RemoteUid
+                   << Event::GroupId
+                   << Event::MessageToken
+                   << Event::MmsId;
+    }
+    return properties;
+}
+
 void EventModelPrivate::eventDeletedSlot(int id)
 {
     DEBUG() << __PRETTY_FUNCTION__ << ":" << id;
@@ -375,19 +814,22 @@ bool EventModelPrivate::canFetchMore() const
 void EventModelPrivate::changeContactsRecursive(ContactChangeType changeType,
                                                 quint32 contactId,
                                                 const QString &contactName,
-                                                const QList< QPair<QString,QString> > &contactAddresses,
+                                                const QSet<ContactCache::Key> &contactKeys,
                                                 EventTreeItem *parent)
 {
     DEBUG() << Q_FUNC_INFO;
 
+    // changed rows are announced in contiguous ranges
+    int firstChanged = -1;
+    int lastChanged = -1;
+
     for (int row = 0; row < parent->childCount(); row++) {
 
         Event *event = &(parent->eventAt(row));
         bool eventChanged = false;
         QList<Event::Contact> contacts = event->contacts();
-        bool addressMatchesList = ContactListener::addressMatchesList(event->localUid(),
-                                                                      event->remoteUid(),
-                                                                      contactAddresses);
+        bool addressMatchesList = contactKeys.contains(ContactCache::key(event->localUid(),
+                                                                         event->remoteUid()));
 
         // the contact was removed
         if (changeType == ContactRemoved ||
@@ -410,9 +852,6 @@ void EventModelPrivate::changeContactsRecursive(ContactChangeType changeType,
 
             // create new contact, i.e. <id, name> pair
             Event::Contact newContact((int)contactId, contactName);
-            // create cache key
-            QPair<QString, QString> cacheKey = qMakePair(event->localUid(), event->remoteUid());
-            contactCache.insert(cacheKey, QList<Event::Contact>() << newContact);
 
             for (int i = 0; i < contacts.count(); i++) {
                 // if contact is already resolved, change name to new one
@@ -443,7 +882,12 @@ void EventModelPrivate::changeContactsRecursive(ContactChangeType changeType,
             // save the modified list back to the event
             event->setContacts(contacts);
 
-            emitDataChanged(row, parent->child(row));
+            if (firstChanged < 0)
+                firstChanged = row;
+            lastChanged = row;
+        } else if (firstChanged >= 0) {
+            emitDataChanged(firstChanged, lastChanged, parent);
+            firstChanged = -1;
         }
 
         // dig down to children
@@ -451,60 +895,25 @@ void EventModelPrivate::changeContactsRecursive(ContactChangeType changeType,
             changeContactsRecursive(changeType,
                                     contactId,
                                     contactName,
-                                    contactAddresses,
+                                    contactKeys,
                                     parent->child(row));
         }
     }
+
+    if (firstChanged >= 0)
+        emitDataChanged(firstChanged, lastChanged, parent);
 }
 
 void EventModelPrivate::slotContactUpdated(quint32 localId,
                                            const QString &contactName,
                                            const QList<ContactAddress> &contactAddresses)
 {
-    Event::Contact contact(localId, contactName);
-
-    // (local id, remote id) -> (contact id, name)
-    QMap<QPair<QString,QString>, QList<Event::Contact> >::iterator cacheIt = contactCache.begin();
-    for ( ; cacheIt != contactCache.end(); ++cacheIt) {
-        const QPair<QString, QString> &uidPair(cacheIt.key());
-        QList<Event::Contact> &contacts(cacheIt.value());
-
-        if (ContactListener::addressMatchesList(uidPair.first,  // local id
-                                                uidPair.second, // remote id
-                                                contactAddresses)) {
-            QList<Event::Contact>::iterator it = contacts.begin(), end = contacts.end();
-            for ( ; it != end; ++it) {
-                if ((*it).first == contact.first) {
-                    // change name for existing contact
-                    (*it).second = contact.second;
-                    break;
-                }
-            }
-            if (it == end) {
-                // add new contact to key
-                contacts.append(contact);
-            }
-        }
-        // address not found, but we've got the contact in the cache
-        // -> contact was updated -> address removed
-        else if (contacts.contains(contact)) {
-            // delete our record since the address doesn't match anymore
-            contacts.removeOne(contact);
-            if (contacts.isEmpty()) {
-                contactCache.erase(cacheIt);
-            }
-            break;
-        }
-    }
-
-    QList<QPair<QString, QString> > uidPairs;
-
+    // The shared contact cache has already been updated
     bool hasAddressType[3] = { false, false, false };
     foreach (const ContactAddress &address, contactAddresses) {
         Q_ASSERT((address.type >= ContactListener::IMAccountType) && (address.type <= ContactListener::EmailAddressType));
 
         hasAddressType[address.type - 1] = true;
-        uidPairs.append(address.uidPair());
     }
 
     QSet<quint32> * const typeSet[3] = { &imContacts, &phoneContacts, &emailContacts };
@@ -516,34 +925,13 @@ void EventModelPrivate::slotContactUpdated(quint32 localId,
         }
     }
 
-    changeContactsRecursive(ContactUpdated, localId, contactName, uidPairs, eventRootItem);
+    changeContactsRecursive(ContactUpdated, localId, contactName,
+                            ContactCache::addressKeys(contactAddresses), eventRootItem);
+    changeColumnContacts();
 }
 
 void EventModelPrivate::slotContactRemoved(quint32 localId)
 {
-    QList<QPair<QString,QString> > contactAddresses;
-
-    QMap<QPair<QString,QString>, QList<Event::Contact> >::iterator cacheIt = contactCache.begin();
-    while (cacheIt != contactCache.end()) {
-        QList<Event::Contact> &contacts(cacheIt.value());
-
-        QList<Event::Contact>::iterator it = contacts.begin();
-        while (it != contacts.end()) {
-            if (static_cast<quint32>((*it).first) == localId) {
-                contactAddresses.append(cacheIt.key());
-                it = contacts.erase(it);
-            } else {
-                ++it;
-            }
-        }
-
-        if (contacts.isEmpty()) {
-            cacheIt = contactCache.erase(cacheIt);
-        } else {
-            ++cacheIt;
-        }
-    }
-
     QSet<quint32> * const typeSet[3] = { &imContacts, &phoneContacts, &emailContacts };
     for (int i = 0; i < 3; ++i) {
         typeSet[i]->remove(localId);
@@ -552,8 +940,9 @@ void EventModelPrivate::slotContactRemoved(quint32 localId)
     changeContactsRecursive(ContactRemoved,
                             localId,
                             QString(), // contactName
-                            contactAddresses,
+                            QSet<ContactCache::Key>(),
                             eventRootItem);
+    changeColumnContacts();
 }
 
 void EventModelPrivate::slotContactUnknown(const QPair<QString, QString> &address)
@@ -568,39 +957,36 @@ DatabaseIO* EventModelPrivate::database()
 
 bool EventModelPrivate::setContactFromCache(CommHistory::Event &event)
 {
-    QMap<QPair<QString,QString>, QList<Event::Contact> >::Iterator it = contactCache.find(qMakePair(event.localUid(), event.remoteUid()));
-    if (it != contactCache.end()) {
-        if (!it.value().isEmpty()) {
-            event.setContacts(it.value());
-            return true;
-        }
-    } else {
-        // Insert an empty item into the cache to prevent duplicate requests
-        contactCache.insert(qMakePair(event.localUid(), event.remoteUid()), QList<Event::Contact>());
-
-        startContactListening();
-        if (contactListener)
-            contactListener->resolveContact(event.localUid(), event.remoteUid());
+    QList<Event::Contact> contacts = contactCache->contacts(event.localUid(), event.remoteUid());
+    if (!contacts.isEmpty()) {
+        event.setContacts(contacts);
+        return true;
     }
 
+    // The cache skips addresses that are already being resolved
+    startContactListening();
+    if (contactListening)
+        contactCache->resolve(event.localUid(), event.remoteUid());
+
     return false;
 }
 
 void EventModelPrivate::startContactListening()
 {
-    if (contactChangesEnabled && !contactListener) {
-        contactListener = ContactListener::instance();
-        connect(contactListener.data(),
+    if (contactChangesEnabled && !contactListening) {
+        contactListening = true;
+        contactCache->startListening();
+        connect(contactCache.data(),
                 SIGNAL(contactUpdated(quint32, const QString&, const QList<ContactAddress>&)),
                 this,
                 SLOT(slotContactUpdated(quint32, const QString&, const QList<ContactAddress>&)),
                 Qt::UniqueConnection);
-        connect(contactListener.data(),
+        connect(contactCache.data(),
                 SIGNAL(contactRemoved(quint32)),
                 this,
                 SLOT(slotContactRemoved(quint32)),
                 Qt::UniqueConnection);
-        connect(contactListener.data(),
+        connect(contactCache.data(),
                 SIGNAL(contactUnknown(const QPair<QString, QString>&)),
                 this,
                 SLOT(slotContactUnknown(const QPair<QString, QString>&)),
@@ -628,3 +1014,12 @@ void EventModelPrivate::emitDataChanged(int row, void *data)
     emit q->dataChanged(left, right);
 }
 
+void EventModelPrivate::emitDataChanged(int first, int last, EventTreeItem *parent)
+{
+    Q_Q(EventModel);
+
+    const QModelIndex left(q->createIndex(first, 0, parent->child(first)));
+    const QModelIndex right(q->createIndex(last, EventModel::NumberOfColumns - 1, parent->child(last)));
+    emit q->dataChanged(left, right);
+}
+
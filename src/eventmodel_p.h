@@ -26,6 +26,7 @@
 
 #include <QList>
 #include <QGenericArgument>
+#include <QStringList>
 
 #include "eventmodel.h"
 #include "event.h"
@@ -34,12 +35,15 @@
 #include "databaseio.h"
 #include "libcommhistoryexport.h"
 #include "contactlistener.h"
+#include "contactcache.h"
 
 class QSqlQuery;
 
 namespace CommHistory {
 
 class UpdatesEmitter;
+class QueryWorker;
+class EventColumnStore;
 
 /*!
  * \class EventModelPrivate
@@ -75,6 +79,32 @@ public:
      */
     virtual bool acceptsEvent(const Event &event) const;
 
+    /*!
+     * Updates from other models only carry the modified properties and
+     * updateKeyProperties(). This should return true if the full data
+     * of an updated event that is not in the model is needed; it is
+     * then read from the database. Uses acceptsEvent() by default.
+     *
+     * \param event Updated event with partial data.
+     * \return true if the event should be read.
+     */
+    virtual bool acceptsUpdatedEvent(const Event &event) const;
+
+    /*!
+     * Returns the feed paths (see constants.h) that the model listens to
+     * for added and updated events. An empty list, the default, listens
+     * to all changes. Models must call updateSubscriptions() when the
+     * result changes.
+     *
+     * \return D-Bus object paths.
+     */
+    virtual QStringList subscriptionPaths() const;
+
+    /*!
+     * Connects to the feeds from subscriptionPaths().
+     */
+    void updateSubscriptions();
+
     /*!
      * Tries to find the event with the specified id in the internal
      * tree storage.
@@ -98,9 +128,34 @@ public:
      * Executes a database query. fillModel() is called when new events
      * are received, and modelReady() is emitted when the query is
      * finished.
+     *
+     * If a background thread is set and the query mode is not SyncQuery,
+     * the query is executed in the background thread and the results
+     * are delivered in chunks of resultChunkSize() events.
      */
     bool executeQuery(QSqlQuery &query);
 
+    /*!
+     * Event properties read by model queries: the property mask, plus the
+     * properties models need for sorting, grouping and contact resolution.
+     * Queries must select DatabaseIOPrivate::eventQueryBase(queryProperties()).
+     * Event::EventCount is not included; reimplement to add it for
+     * queries that compute it.
+     */
+    virtual Event::PropertySet queryProperties() const;
+
+    /*!
+     * Number of events passed to fillModel() at a time by asynchronous
+     * queries. Reimplement to return 0 if fillModel() needs all results
+     * at once.
+     */
+    virtual uint resultChunkSize() const;
+
+    /*!
+     * Discard results of the pending asynchronous query, if any.
+     */
+    virtual void cancelQuery();
+
     /*!
      * Add new events from the query results to the internal event
      * structure. You can reimplement this for non-trivial models, such
@@ -122,27 +177,72 @@ public:
     virtual void clearEvents();
 
     virtual void addToModel(Event &event);
+
+    /*!
+     * Adds accepted events to the model as if addToModel() was called for
+     * each, in order. Events with the same parent are inserted as one
+     * range of rows. Reimplement if addToModel() places or announces
+     * events individually.
+     */
+    virtual void addEventsToModel(QList<Event> &events);
+
     virtual void modifyInModel(Event &event);
     virtual void deleteFromModel(int id);
 
-    QModelIndex findEventRecursive(int id, EventTreeItem *parent) const;
+    /*!
+     * Returns true if query results can be kept in a column store instead
+     * of the event tree (see EventModel::setColumnStorage()). Models that
+     * restructure the results in fillModel() must return false.
+     */
+    virtual bool supportsColumnStorage() const;
+
+    /*!
+     * True if the next query fills the column store.
+     */
+    bool usesColumnStorage() const;
+
+    /*!
+     * Append query results to the column store and the model. Takes
+     * ownership of columns.
+     */
+    void fillColumns(EventColumnStore *columns);
+
+    /*!
+     * Move rows from the column store to the event tree. Called before
+     * any change to the model contents, as only the event tree supports
+     * changes.
+     */
+    void materializeColumns();
+
+    /*!
+     * Event of a column store row, with contacts from the contact cache.
+     */
+    Event columnEvent(int row) const;
+    Event columnEvent(int row, const EventColumnStore *columns) const;
+    QVariant columnData(int row, int column, int role) const;
+
+    /*!
+     * Notify views of a contact change for column store rows, which read
+     * their contacts from the contact cache.
+     */
+    void changeColumnContacts();
 
     bool canFetchMore() const;
 
     /*
      * Called when contacts are somehow modified. Traverses through the
      * event list and updates event.contactId() and event.contactName()
-     * as necessary. Also updates contact cache.
+     * as necessary.
      * \param changeType Contact change type (removed, updated (= added or modified)).
      * \param contactId LocalId of the modified contact.
      * \param contactName Name of the modified contact. Empty for removed contacts.
-     * \param contactAddresses List of all IM addresses and phone numbers for the contact. Empty for removed contacts.
+     * \param contactKeys ContactCache keys of all IM addresses and phone numbers for the contact. Empty for removed contacts.
      * \param parent Current top item for recursion (start with eventRootItem).
      */
     void changeContactsRecursive(ContactChangeType changeType,
                                  quint32 contactId,
                                  const QString &contactName,
-                                 const QList< QPair<QString,QString> > &contactAddresses,
+                                 const QSet<ContactCache::Key> &contactKeys,
                                  EventTreeItem *parent);
 
     DatabaseIO *database();
@@ -152,6 +252,36 @@ public:
     bool contactHasAddress(int types, quint32 contactId) const;
 
     void emitDataChanged(int row, void *data);
+    void emitDataChanged(int first, int last, EventTreeItem *parent);
+
+    /*
+     * Announces committed modifications to all models. Only the
+     * modified properties and updateKeyProperties() are sent.
+     *
+     * \param previous States read with readPreviousStates() before the
+     *        modification, sent along so that GroupManager can update
+     *        group counters without a query.
+     */
+    void emitEventsUpdated(const QList<Event> &events,
+                           const QHash<int, Event> &previous = QHash<int, Event>());
+
+    /*
+     * Reads the stateProperties() of the events whose modification
+     * changes one of them. Called in the transaction, before the events
+     * are modified.
+     */
+    bool readPreviousStates(const QList<Event> &events, QHash<int, Event> &states);
+
+    /*
+     * Properties of an event that the group statistics depend on.
+     */
+    static Event::PropertySet stateProperties();
+
+    /*
+     * Properties sent with every update, so that models that do not
+     * have the event can decide with acceptsEvent() whether to read it.
+     */
+    static Event::PropertySet updateKeyProperties();
 
     // This is the root node for the internal event tree. In a standard
     // flat model, eventRootNode has rowCount() children with events.
@@ -172,18 +302,25 @@ public:
 
     Event::PropertySet propertyMask;
 
-    QSharedPointer<ContactListener> contactListener;
+    bool columnStorage;
+    // Rows of the model while query results are kept in columns; in that
+    // case eventRootItem has no children. Null otherwise.
+    EventColumnStore *columnStore;
 
-    // (local id, remote id) -> (contact id, name)
-    QMap<QPair<QString,QString>, QList<Event::Contact> > contactCache;
+    // Shared by all models; (local id, remote id) -> (contact id, name)
+    QSharedPointer<ContactCache> contactCache;
+    bool contactListening;
 
     QSet<quint32> phoneContacts;
     QSet<quint32> imContacts;
     QSet<quint32> emailContacts;
 
     QThread *bgThread;
+    QueryWorker *queryWorker;
+    int activeQueryId;
 
     QSharedPointer<UpdatesEmitter> emitter;
+    QStringList subscribedPaths;
 
 public Q_SLOTS:
     virtual void eventsReceivedSlot(int start, int end, QList<CommHistory::Event> events);
@@ -198,10 +335,16 @@ public Q_SLOTS:
 
     virtual void eventsUpdatedSlot(const QList<CommHistory::Event> &events);
 
+    void eventPropertiesUpdatedSlot(const QList<CommHistory::Event> &events);
+
     virtual void eventDeletedSlot(int id);
 
     virtual void canFetchMoreChangedSlot(bool canFetch);
 
+    void queryEventsReceivedSlot(int queryId, int start, int end, QList<CommHistory::Event> events);
+    void queryColumnsReceivedSlot(int queryId, CommHistory::EventColumnStore *columns);
+    void queryFinishedSlot(int queryId, bool successful);
+
     virtual void slotContactUpdated(quint32 localId,
                                     const QString &contactName,
                                     const QList<ContactAddress> &contactAddresses);
@@ -214,8 +357,10 @@ Q_SIGNALS:
     void eventsAdded(const QList<CommHistory::Event> &events);
 
     void eventsUpdated(const QList<CommHistory::Event> &events);
+    void eventPropertiesUpdated(const QList<QByteArray> &events, const QStringList &previousPaths);
 
     void eventDeleted(int id);
+    void eventsDeleted(const QList<CommHistory::Event> &events);
 
     void groupsUpdated(const QList<int> &groupIds);
     void groupsUpdatedFull(const QList<CommHistory::Group> &groups);
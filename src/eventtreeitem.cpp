@@ -21,32 +21,76 @@
 ******************************************************************************/
 
 #include <QDebug>
-#include <QList>
 #include "event.h"
 #include "eventtreeitem.h"
+#include "itempool.h"
 
 using namespace CommHistory;
 
+namespace {
+
+Q_GLOBAL_STATIC(ItemPool<EventTreeItem>, itemPool)
+
+}
+
+void *EventTreeItem::operator new(size_t size)
+{
+    ItemPool<EventTreeItem> *pool = itemPool();
+    if (size != sizeof(EventTreeItem) || !pool)
+        return ::operator new(size);
+
+    return pool->allocate();
+}
+
+void EventTreeItem::operator delete(void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+
+    if (size != sizeof(EventTreeItem)) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    // Items freed after the pool is destroyed at exit belong to leaked
+    // chunks; items allocated while it was gone were not pooled
+    ItemPool<EventTreeItem> *pool = itemPool();
+    if (!pool)
+        return;
+    if (!pool->release(ptr))
+        ::operator delete(ptr);
+}
+
 EventTreeItem::EventTreeItem(const Event &event, EventTreeItem *parent)
+    : eventData(event),
+      parentItem(parent),
+      rowIndex(0),
+      rowBase(0),
+      idIndex(0),
+      indexedIn(0),
+      indexedId(-1)
 {
-    parentItem = parent;
-    eventData = new Event( event );
 }
 
 EventTreeItem::~EventTreeItem()
 {
-    delete eventData;
+    removeFromIndex();
     qDeleteAll(children);
+    delete idIndex;
 }
 
 void EventTreeItem::appendChild(EventTreeItem *child)
 {
+    child->rowIndex = rowBase + children.count();
     children.append(child);
+    attach(child);
 }
 
 void EventTreeItem::prependChild(EventTreeItem *child)
 {
+    child->rowIndex = --rowBase;
     children.prepend(child);
+    attach(child);
 }
 
 void EventTreeItem::moveChild( int fromRow, int toRow )
@@ -60,16 +104,25 @@ void EventTreeItem::moveChild( int fromRow, int toRow )
     }
 
     children.insert( toRow, children.takeAt( fromRow ) );
+    renumber(qMin(fromRow, toRow), qMax(fromRow, toRow) + 1);
 }
 
 void EventTreeItem::insertChildAt(int row, EventTreeItem *child)
 {
     children.insert(row, child);
+    renumber(row, children.count());
+    attach(child);
 }
 
 void EventTreeItem::removeAt(int row)
 {
-    delete children.takeAt(row);
+    EventTreeItem *child = children.takeAt(row);
+    if (row == 0)
+        rowBase++;
+    else
+        renumber(row, children.count());
+    detach(child);
+    delete child;
 }
 
 EventTreeItem *EventTreeItem::child(int row)
@@ -90,16 +143,19 @@ int EventTreeItem::childCount() const
 
 Event &EventTreeItem::event()
 {
-    return *eventData;
+    return eventData;
 }
 
 void EventTreeItem::setEvent(const Event &event)
 {
-    if ( eventData )
-    {
-        delete eventData;
+    eventData = event;
+
+    if (indexedIn && indexedId != eventData.id()) {
+        indexedIn->remove(indexedId, this);
+        indexedId = eventData.id();
+        if (indexedId >= 0)
+            indexedIn->insert(indexedId, this);
     }
-    eventData = new Event( event );
 }
 
 EventTreeItem *EventTreeItem::parent()
@@ -110,8 +166,100 @@ EventTreeItem *EventTreeItem::parent()
 int EventTreeItem::row() const
 {
     if (parentItem) {
-        return parentItem->children.indexOf(const_cast<EventTreeItem *>(this));
+        Q_ASSERT(parentItem->children.value(rowIndex - parentItem->rowBase) == this);
+        return rowIndex - parentItem->rowBase;
     }
 
     return 0;
 }
+
+void EventTreeItem::enableIdIndex()
+{
+    if (idIndex)
+        return;
+
+    idIndex = new IdIndex;
+    foreach (EventTreeItem *child, children)
+        child->addToIndex(idIndex);
+}
+
+EventTreeItem *EventTreeItem::findItem(int id) const
+{
+    if (!idIndex || id < 0)
+        return 0;
+
+    IdIndex::const_iterator it = idIndex->constFind(id);
+    if (it == idIndex->constEnd())
+        return 0;
+
+    EventTreeItem *item = it.value();
+    for (++it; it != idIndex->constEnd() && it.key() == id; ++it) {
+        int depth = it.value()->depth();
+        if (depth < item->depth() || (depth == item->depth() && it.value()->row() < item->row()))
+            item = it.value();
+    }
+
+    return item;
+}
+
+void EventTreeItem::attach(EventTreeItem *child)
+{
+    // Items may be created without a parent and inserted afterwards
+    child->parentItem = this;
+
+    IdIndex *index = treeIndex();
+    if (index)
+        child->addToIndex(index);
+}
+
+void EventTreeItem::detach(EventTreeItem *child)
+{
+    child->removeFromIndex();
+}
+
+EventTreeItem::IdIndex *EventTreeItem::treeIndex() const
+{
+    if (idIndex)
+        return idIndex;
+    return indexedIn;
+}
+
+void EventTreeItem::addToIndex(IdIndex *index)
+{
+    if (indexedIn != index) {
+        removeFromIndex();
+        indexedIn = index;
+        indexedId = eventData.id();
+        if (indexedId >= 0)
+            indexedIn->insert(indexedId, this);
+    }
+
+    foreach (EventTreeItem *child, children)
+        child->addToIndex(index);
+}
+
+void EventTreeItem::removeFromIndex()
+{
+    if (indexedIn) {
+        indexedIn->remove(indexedId, this);
+        indexedIn = 0;
+        indexedId = -1;
+    }
+
+    foreach (EventTreeItem *child, children)
+        child->removeFromIndex();
+}
+
+int EventTreeItem::depth() const
+{
+    int depth = 0;
+    for (const EventTreeItem *item = parentItem; item; item = item->parentItem)
+        depth++;
+    return depth;
+}
+
+void EventTreeItem::renumber(int from, int to)
+{
+    for (int i = from; i < to; i++)
+        children.at(i)->rowIndex = rowBase + i;
+}
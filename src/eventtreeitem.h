@@ -24,15 +24,20 @@
 #define COMMHISTORY_EVENTTREEITEM_H
 
 #include <QList>
+#include <QMultiHash>
 
-namespace CommHistory {
+#include "event.h"
 
-class Event;
+namespace CommHistory {
 
 /*!
  * \class EventTreeItem
  *
  * Event container for CommHistoryModels.
+ *
+ * Items are allocated from a shared pool and hold their event by value.
+ * Each child caches its position in the parent, so row() does not need
+ * to search the parent's child list.
  */
 class EventTreeItem
 {
@@ -53,10 +58,49 @@ public:
     EventTreeItem *parent();
     int row() const;
 
+    /*!
+     * Maintain an index from event id to item for all items below this
+     * one, used by findItem(). Enabled for the root item of a model.
+     */
+    void enableIdIndex();
+
+    /*!
+     * Find the item of an event below this item. If several items have
+     * the same event (e.g. call groups and their first call), the item
+     * closest to this one is returned.
+     *
+     * \param id Event id.
+     * \return item, or 0 if not found or the index is not enabled.
+     */
+    EventTreeItem *findItem(int id) const;
+
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+
 private:
+    typedef QMultiHash<int, EventTreeItem *> IdIndex;
+
+    void attach(EventTreeItem *child);
+    void detach(EventTreeItem *child);
+    IdIndex *treeIndex() const;
+    void addToIndex(IdIndex *index);
+    void removeFromIndex();
+    int depth() const;
+    void renumber(int from, int to);
+
     QList<EventTreeItem *> children;
-    Event *eventData;
+    Event eventData;
     EventTreeItem *parentItem;
+
+    // row() is rowIndex - parentItem->rowBase; prepending only moves the base
+    int rowIndex;
+    int rowBase;
+
+    // Owned by the item with the index enabled
+    IdIndex *idIndex;
+    // Index of the tree this item is in, and the id it is listed under
+    IdIndex *indexedIn;
+    int indexedId;
 };
 
 }
@@ -0,0 +1,121 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QDebug>
+
+#include "fieldencoding.h"
+
+namespace {
+
+void appendString(QByteArray &data, const QString &string)
+{
+    const QByteArray utf8 = string.toUtf8();
+
+    quint32 length = utf8.size();
+    do {
+        char byte = length & 0x7f;
+        length >>= 7;
+        if (length)
+            byte |= 0x80;
+        data.append(byte);
+    } while (length);
+
+    data.append(utf8);
+}
+
+bool readString(const QByteArray &data, int &pos, QString &string)
+{
+    quint32 length = 0;
+    int shift = 0;
+    for (;;) {
+        if (pos >= data.size() || shift > 28)
+            return false;
+
+        const uchar byte = data.at(pos++);
+        length |= quint32(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+        shift += 7;
+    }
+
+    if (length > quint32(data.size() - pos))
+        return false;
+
+    string = QString::fromUtf8(data.constData() + pos, length);
+    pos += length;
+    return true;
+}
+
+}
+
+namespace CommHistory {
+
+QByteArray encodeStringList(const QStringList &list)
+{
+    QByteArray data;
+    foreach (const QString &string, list)
+        appendString(data, string);
+    return data;
+}
+
+QStringList decodeStringList(const QByteArray &data)
+{
+    QStringList list;
+    int pos = 0;
+    QString string;
+    while (pos < data.size()) {
+        if (!readString(data, pos, string)) {
+            qWarning() << Q_FUNC_INFO << "Invalid string list data";
+            break;
+        }
+        list.append(string);
+    }
+    return list;
+}
+
+QByteArray encodeStringHash(const QHash<QString, QString> &hash)
+{
+    QByteArray data;
+    QHash<QString, QString>::const_iterator it = hash.constBegin();
+    for (; it != hash.constEnd(); ++it) {
+        appendString(data, it.key());
+        appendString(data, it.value());
+    }
+    return data;
+}
+
+QHash<QString, QString> decodeStringHash(const QByteArray &data)
+{
+    QHash<QString, QString> hash;
+    int pos = 0;
+    QString key, value;
+    while (pos < data.size()) {
+        if (!readString(data, pos, key) || !readString(data, pos, value)) {
+            qWarning() << Q_FUNC_INFO << "Invalid string hash data";
+            break;
+        }
+        hash.insert(key, value);
+    }
+    return hash;
+}
+
+}
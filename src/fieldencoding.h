@@ -0,0 +1,48 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_FIELDENCODING_H
+#define COMMHISTORY_FIELDENCODING_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+namespace CommHistory {
+
+/*
+ * Binary storage format for multi-valued database columns (Events.headers
+ * and Groups.remoteUids). Each string is stored as its UTF-8 length in
+ * bytes, as a base-128 varint, followed by the UTF-8 data. A hash is
+ * stored as alternating keys and values. Empty lists and hashes are
+ * stored as NULL.
+ */
+QByteArray encodeStringList(const QStringList &list);
+QStringList decodeStringList(const QByteArray &data);
+
+QByteArray encodeStringHash(const QHash<QString, QString> &hash);
+QHash<QString, QString> decodeStringHash(const QByteArray &data);
+
+}
+
+#endif
@@ -39,6 +39,17 @@
 
 namespace {
 static const int defaultChunkSize = 50;
+
+inline uint timeValue(const QDateTime &time)
+{
+    return time.isValid() ? time.toTime_t() : 0;
+}
+
+// Same order as the last event of GroupStats: by start time, then by id
+inline bool isLaterEvent(uint time, int id, uint lastTime, int lastId)
+{
+    return lastId == -1 || time > lastTime || (time == lastTime && id > lastId);
+}
 }
 
 using namespace CommHistory;
@@ -63,45 +74,30 @@ GroupManagerPrivate::GroupManagerPrivate(GroupManager *manager)
 
     emitter = UpdatesEmitter::instance();
 
-    QDBusConnection::sessionBus().connect(
-        QString(),
-        QString(),
-        COMM_HISTORY_SERVICE_NAME,
-        EVENTS_ADDED_SIGNAL,
-        this,
-        SLOT(eventsAddedSlot(const QList<CommHistory::Event> &)));
-    QDBusConnection::sessionBus().connect(
-        QString(),
-        QString(),
-        COMM_HISTORY_SERVICE_NAME,
-        GROUPS_ADDED_SIGNAL,
-        this,
-        SLOT(groupsAddedSlot(const QList<CommHistory::Group> &)));
-    QDBusConnection::sessionBus().connect(
-        QString(),
-        QString(),
-        COMM_HISTORY_SERVICE_NAME,
-        GROUPS_UPDATED_SIGNAL,
-        this,
-        SLOT(groupsUpdatedSlot(const QList<int> &)));
-    QDBusConnection::sessionBus().connect(
-        QString(),
-        QString(),
-        COMM_HISTORY_SERVICE_NAME,
-        GROUPS_UPDATED_FULL_SIGNAL,
-        this,
-        SLOT(groupsUpdatedFullSlot(const QList<CommHistory::Group> &)));
-    QDBusConnection::sessionBus().connect(
-        QString(),
-        QString(),
-        COMM_HISTORY_SERVICE_NAME,
-        GROUPS_DELETED_SIGNAL,
-        this,
-        SLOT(groupsDeletedSlot(const QList<int> &)));
+    emitter->subscribe(QStringList());
+    connect(emitter.data(), SIGNAL(receivedEventsAdded(const QList<CommHistory::Event> &)),
+            this, SLOT(eventsAddedSlot(const QList<CommHistory::Event> &)));
+    connect(emitter.data(), SIGNAL(receivedEventPropertiesUpdated(const QList<CommHistory::Event> &,
+                                                                  const QList<CommHistory::Event> &)),
+            this, SLOT(eventPropertiesUpdatedSlot(const QList<CommHistory::Event> &,
+                                                  const QList<CommHistory::Event> &)));
+    connect(emitter.data(), SIGNAL(receivedEventsDeleted(const QList<CommHistory::Event> &)),
+            this, SLOT(eventsDeletedSlot(const QList<CommHistory::Event> &)));
+    connect(emitter.data(), SIGNAL(receivedGroupsAdded(const QList<CommHistory::Group> &)),
+            this, SLOT(groupsAddedSlot(const QList<CommHistory::Group> &)));
+    connect(emitter.data(), SIGNAL(receivedGroupsUpdated(const QList<int> &)),
+            this, SLOT(groupsUpdatedSlot(const QList<int> &)));
+    connect(emitter.data(), SIGNAL(receivedGroupsMarkedRead(const QList<int> &)),
+            this, SLOT(groupsMarkedReadSlot(const QList<int> &)));
+    connect(emitter.data(), SIGNAL(receivedGroupsUpdatedFull(const QList<CommHistory::Group> &)),
+            this, SLOT(groupsUpdatedFullSlot(const QList<CommHistory::Group> &)));
+    connect(emitter.data(), SIGNAL(receivedGroupsDeleted(const QList<int> &)),
+            this, SLOT(groupsDeletedSlot(const QList<int> &)));
 }
 
 GroupManagerPrivate::~GroupManagerPrivate()
 {
+    emitter->unsubscribe(QStringList());
 }
 
 bool GroupManagerPrivate::commitTransaction(const QList<int> &groupIds)
@@ -134,44 +130,116 @@ void GroupManagerPrivate::modifyInModel(Group &group, bool query)
         }
         go->set(newGroup);
     } else {
+        int total = go->totalMessages();
+        int unread = go->unreadMessages();
+        int sent = go->sentMessages();
         go->copyValidProperties(group);
+
+        // The counters follow the event changes, which come first, and
+        // marking the group as read is announced with groupsMarkedRead
+        appliedGroups.remove(group.id());
+        go->setTotalMessages(total);
+        go->setUnreadMessages(unread);
+        go->setSentMessages(sent);
     }
 
     emit q->groupUpdated(go);
     DEBUG() << __PRETTY_FUNCTION__ << ": updated" << go->toString();
 }
 
+void GroupManagerPrivate::checkGroup(GroupObject *go)
+{
+    if (go->totalMessages() >= 0
+        && go->unreadMessages() >= 0 && go->unreadMessages() <= go->totalMessages()
+        && go->sentMessages() >= 0 && go->sentMessages() <= go->totalMessages()) {
+        return;
+    }
+
+    qWarning() << Q_FUNC_INFO << "Group" << go->id() << "out of sync, reading from database";
+
+    Group group;
+    if (!database()->getGroup(go->id(), group))
+        return;
+
+    // preserve contact info if necessary
+    if (!group.validProperties().contains(Group::Contacts)
+        && go->validProperties().contains(Group::Contacts)) {
+        group.setContacts(go->contacts());
+    }
+    go->set(group);
+}
+
+void GroupManagerPrivate::refreshLastEvent(GroupObject *go)
+{
+    DEBUG() << __PRETTY_FUNCTION__ << go->id();
+
+    // The counters in the database may already include changes that have
+    // not been received yet, so only the last event is taken
+    Group group;
+    if (!database()->getGroup(go->id(), group))
+        return;
+
+    go->setLastEventId(group.lastEventId());
+    go->setLastMessageText(group.lastMessageText());
+    go->setLastVCardFileName(group.lastVCardFileName());
+    go->setLastVCardLabel(group.lastVCardLabel());
+    go->setLastEventStatus(group.lastEventStatus());
+    go->setLastEventType(group.lastEventType());
+    go->setStartTime(group.startTime());
+    go->setEndTime(group.endTime());
+}
+
+void GroupManagerPrivate::addCounts(GroupObject *go, const Event &state, int sign)
+{
+    go->setTotalMessages(go->totalMessages() + sign);
+    if (!state.isRead())
+        go->setUnreadMessages(go->unreadMessages() + sign);
+    if (state.direction() == Event::Outbound)
+        go->setSentMessages(go->sentMessages() + sign);
+}
+
+void GroupManagerPrivate::setLastEvent(GroupObject *go, const Event &event)
+{
+    go->setLastEventId(event.id());
+    if (event.type() == Event::MMSEvent) {
+        go->setLastMessageText(event.subject().isEmpty() ? event.freeText() : event.subject());
+    } else {
+        go->setLastMessageText(event.freeText());
+    }
+    go->setLastVCardFileName(event.fromVCardFileName());
+    go->setLastVCardLabel(event.fromVCardLabel());
+    go->setLastEventStatus(event.status());
+    go->setLastEventType(event.type());
+    go->setStartTime(event.startTime());
+    go->setEndTime(event.endTime());
+}
+
 void GroupManagerPrivate::eventsAddedSlot(const QList<Event> &events)
 {
     Q_Q(GroupManager);
     DEBUG() << __PRETTY_FUNCTION__ << events.count();
 
     foreach (const Event &event, events) {
+        GroupObject *go = groups.value(event.groupId());
+        if (!go)
+            continue;
+
+        // Counted like in GroupStats
+        addCounts(go, event, 1);
+
         // drafts and statusmessages are not shown in group model
         if (event.isDraft()
             || event.type() == Event::StatusMessageEvent
             || event.type() == Event::ClassZeroSMSEvent) {
+            checkGroup(go);
+            emit q->groupUpdated(go);
             continue;
         }
 
-        GroupObject *go = groups.value(event.groupId());
-        if (!go)
-            continue;
-
-        if (event.startTime() >= go->startTime()) {
+        if (isLaterEvent(timeValue(event.startTime()), event.id(),
+                         timeValue(go->startTime()), go->lastEventId())) {
             DEBUG() << __PRETTY_FUNCTION__ << ": updating group" << go->id();
-            go->setLastEventId(event.id());
-            if (event.type() == Event::MMSEvent) {
-                go->setLastMessageText(event.subject().isEmpty() ? event.freeText() : event.subject());
-            } else {
-                go->setLastMessageText(event.freeText());
-            }
-            go->setLastVCardFileName(event.fromVCardFileName());
-            go->setLastVCardLabel(event.fromVCardLabel());
-            go->setLastEventStatus(event.status());
-            go->setLastEventType(event.type());
-            go->setStartTime(event.startTime());
-            go->setEndTime(event.endTime());
+            setLastEvent(go, event);
 
             if ((event.type() == Event::SMSEvent || event.type() == Event::MMSEvent) &&
                 !event.remoteUid().isEmpty() &&
@@ -211,14 +279,115 @@ void GroupManagerPrivate::eventsAddedSlot(const QList<Event> &events)
             go->setRemoteUids(uids);
         }
 
-        go->setTotalMessages(go->totalMessages() + 1);
-        if (!event.isRead()) {
-            go->setUnreadMessages(go->unreadMessages() + 1);
+        checkGroup(go);
+        emit q->groupUpdated(go);
+    }
+}
+
+void GroupManagerPrivate::eventPropertiesUpdatedSlot(const QList<CommHistory::Event> &events,
+                                                     const QList<CommHistory::Event> &previous)
+{
+    Q_Q(GroupManager);
+    DEBUG() << __PRETTY_FUNCTION__ << events.count();
+
+    // Updates carry the previous state of the event if they change the
+    // group, direction, read or draft state or start time
+    for (int i = 0; i < events.size(); i++) {
+        const Event &event = events.at(i);
+        Event state = previous.value(i);
+        bool changed = state.validProperties().contains(Event::GroupId);
+        if (!changed) {
+            if (!event.validProperties().contains(Event::GroupId))
+                continue;
+            state = event;
         }
-        if (event.direction() == Event::Outbound) {
-            go->setSentMessages(go->sentMessages() + 1);
+        Event current = state;
+        current.copyValidProperties(event);
+
+        GroupObject *oldGo = groups.value(state.groupId());
+        GroupObject *go = groups.value(current.groupId());
+
+        if (state.groupId() != current.groupId()) {
+            // Moved; neither group can tell its new last event
+            if (oldGo) {
+                addCounts(oldGo, state, -1);
+                if (oldGo->lastEventId() == event.id())
+                    refreshLastEvent(oldGo);
+                checkGroup(oldGo);
+                appliedGroups.insert(oldGo->id());
+                emit q->groupUpdated(oldGo);
+            }
+            if (go) {
+                addCounts(go, current, 1);
+                if (isLaterEvent(timeValue(current.startTime()), event.id(),
+                                 timeValue(go->startTime()), go->lastEventId()))
+                    refreshLastEvent(go);
+            }
+        } else if (go) {
+            go->setUnreadMessages(go->unreadMessages() + int(state.isRead()) - int(current.isRead()));
+            go->setSentMessages(go->sentMessages()
+                                + int(current.direction() == Event::Outbound)
+                                - int(state.direction() == Event::Outbound));
+
+            Event::PropertySet properties = event.validProperties();
+            uint startTime = timeValue(current.startTime());
+            if (changed && startTime != timeValue(state.startTime())
+                && (go->lastEventId() == event.id()
+                    || isLaterEvent(startTime, event.id(),
+                                    timeValue(go->startTime()), go->lastEventId()))) {
+                // The event that follows it is not known here
+                refreshLastEvent(go);
+            } else if (go->lastEventId() == event.id()) {
+                if (properties.contains(Event::Status))
+                    go->setLastEventStatus(event.status());
+                if (properties.contains(Event::FreeText) || properties.contains(Event::Subject)) {
+                    if (event.type() == Event::MMSEvent && !event.subject().isEmpty())
+                        go->setLastMessageText(event.subject());
+                    else if (properties.contains(Event::FreeText))
+                        go->setLastMessageText(event.freeText());
+                }
+                if (properties.contains(Event::FromVCardFileName)) {
+                    go->setLastVCardFileName(event.fromVCardFileName());
+                    go->setLastVCardLabel(event.fromVCardLabel());
+                }
+                if (properties.contains(Event::EndTime))
+                    go->setEndTime(event.endTime());
+            }
         }
 
+        if (!go)
+            continue;
+
+        checkGroup(go);
+
+        // EventModel::modifyEvents() follows changes to non-draft events
+        // with groupsUpdated, which needs no query now
+        if (!current.isDraft())
+            appliedGroups.insert(go->id());
+
+        emit q->groupUpdated(go);
+    }
+}
+
+void GroupManagerPrivate::eventsDeletedSlot(const QList<CommHistory::Event> &events)
+{
+    Q_Q(GroupManager);
+    DEBUG() << __PRETTY_FUNCTION__ << events.count();
+
+    foreach (const Event &event, events) {
+        GroupObject *go = groups.value(event.groupId());
+        if (!go)
+            continue;
+
+        addCounts(go, event, -1);
+        if (go->lastEventId() == event.id())
+            refreshLastEvent(go);
+        checkGroup(go);
+
+        // Deletions of non-draft events are followed by groupsUpdated
+        if (!event.isDraft())
+            appliedGroups.insert(go->id());
+
         emit q->groupUpdated(go);
     }
 }
@@ -258,11 +427,33 @@ void GroupManagerPrivate::groupsUpdatedSlot(const QList<int> &groupIds)
     DEBUG() << __PRETTY_FUNCTION__ << groupIds.count();
 
     foreach (int id, groupIds) {
+        // Already applied from the event changes that caused the update
+        if (appliedGroups.contains(id))
+            continue;
+
         Group g;
         g.setId(id);
 
         modifyInModel(g);
     }
+
+    // Each batch of event changes is followed by its group updates
+    appliedGroups.clear();
+}
+
+void GroupManagerPrivate::groupsMarkedReadSlot(const QList<int> &groupIds)
+{
+    Q_Q(GroupManager);
+    DEBUG() << __PRETTY_FUNCTION__ << groupIds.count();
+
+    foreach (int id, groupIds) {
+        GroupObject *go = groups.value(id);
+        if (!go)
+            continue;
+
+        go->setUnreadMessages(0);
+        emit q->groupUpdated(go);
+    }
 }
 
 void GroupManagerPrivate::groupsUpdatedFullSlot(const QList<CommHistory::Group> &groups)
@@ -281,6 +472,8 @@ void GroupManagerPrivate::groupsDeletedSlot(const QList<int> &groupIds)
     DEBUG() << __PRETTY_FUNCTION__ << groupIds.count();
 
     foreach (int id, groupIds) {
+        appliedGroups.remove(id);
+
         GroupObject *go = groups.value(id);
         if (!go)
             continue;
@@ -496,7 +689,7 @@ bool GroupManager::addGroup(Group &group)
         d->add(group);
     }
 
-    d->emitter->groupsAdded(QList<Group>() << group);
+    d->emitter->queueGroupsAdded(QList<Group>() << group);
 
     return true;
 }
@@ -531,7 +724,7 @@ bool GroupManager::addGroups(QList<Group> &groups)
     if (!d->commitTransaction(addedIds))
         return false;
 
-    d->emitter->groupsAdded(addedGroups);
+    d->emitter->queueGroupsAdded(addedGroups);
     return true;
 }
 
@@ -559,7 +752,7 @@ bool GroupManager::modifyGroup(Group &group)
     if (!d->commitTransaction(QList<int>() << group.id()))
         return false;
 
-    emit d->emitter->groupsUpdatedFull(QList<Group>() << group);
+    d->emitter->queueGroupsUpdatedFull(QList<Group>() << group);
     return true;
 }
 
@@ -576,6 +769,7 @@ bool GroupManager::getGroups(const QString &localUid,
         qDeleteAll(d->groups);
         d->groups.clear();
     }
+    d->appliedGroups.clear();
 
     d->startContactListening();
 
@@ -626,10 +820,12 @@ bool GroupManager::markAsReadGroup(int id)
         }
     }
 
+    // Unread counters are cleared from this, in this and other processes
+    d->emitter->queueGroupsMarkedRead(QList<int>() << id);
     if (group)
-        emit d->emitter->groupsUpdatedFull(QList<Group>() << group->toGroup());
+        d->emitter->queueGroupsUpdatedFull(QList<Group>() << group->toGroup());
     else
-        emit d->emitter->groupsUpdated(QList<int>() << id);
+        d->emitter->queueGroupsUpdated(QList<int>() << id);
 
     return true;
 }
@@ -639,7 +835,7 @@ void GroupManager::updateGroups(QList<Group> &groups)
     // no need to update d->groups
     // cause they will be updated on the emitted signal as well
     if (!groups.isEmpty())
-        emit d->emitter->groupsUpdatedFull(groups);
+        d->emitter->queueGroupsUpdatedFull(groups);
 }
 
 bool GroupManager::deleteGroups(const QList<int> &groupIds)
@@ -657,7 +853,7 @@ bool GroupManager::deleteGroups(const QList<int> &groupIds)
     if (!d->commitTransaction(groupIds))
         return false;
 
-    emit d->emitter->groupsDeleted(groupIds);
+    d->emitter->queueGroupsDeleted(groupIds);
     return true;
 }
 
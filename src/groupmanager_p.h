@@ -26,6 +26,8 @@
 
 #include <QList>
 #include <QPair>
+#include <QHash>
+#include <QSet>
 
 #include "groupmanager.h"
 #include "eventmodel.h"
@@ -56,6 +58,21 @@ public:
     void add(Group &group);
     void modifyInModel(Group &group, bool query = true);
 
+    /*!
+     * Reads the group again if the counters kept up to date from event
+     * changes are out of range.
+     */
+    void checkGroup(GroupObject *go);
+    /*!
+     * Reads the last event of the group, when an event change leaves it
+     * unknown.
+     */
+    void refreshLastEvent(GroupObject *go);
+    // Adds (sign 1) or removes (sign -1) an event with the given state
+    // from the counters
+    void addCounts(GroupObject *go, const Event &state, int sign);
+    void setLastEvent(GroupObject *go, const Event &event);
+
     bool canFetchMore() const;
 
     bool commitTransaction(const QList<int> &groupIds);
@@ -65,10 +82,14 @@ public:
 
 public Q_SLOTS:
     void eventsAddedSlot(const QList<CommHistory::Event> &events);
+    void eventPropertiesUpdatedSlot(const QList<CommHistory::Event> &events,
+                                    const QList<CommHistory::Event> &previous);
+    void eventsDeletedSlot(const QList<CommHistory::Event> &events);
 
     void groupsAddedSlot(const QList<CommHistory::Group> &addedGroups);
 
     void groupsUpdatedSlot(const QList<int> &groupIds);
+    void groupsMarkedReadSlot(const QList<int> &groupIds);
     void groupsUpdatedFullSlot(const QList<CommHistory::Group> &groups);
 
     void groupsDeletedSlot(const QList<int> &groupIds);
@@ -88,6 +109,9 @@ public:
     bool isReady;
     QHash<int,GroupObject*> groups;
 
+    // Groups whose pending groupsUpdated is already applied from events
+    QSet<int> appliedGroups;
+
     QString filterLocalUid;
     QString filterRemoteUid;
 
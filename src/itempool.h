@@ -0,0 +1,156 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_ITEMPOOL_H
+#define COMMHISTORY_ITEMPOOL_H
+
+#include <QList>
+#include <QMap>
+#include <QMutex>
+
+namespace CommHistory {
+
+/*
+ * Fixed size allocator for the class-specific operator new of T. Items
+ * are carved out of chunks, so items allocated together are close to each
+ * other in memory and filling a large model does not cost one malloc per
+ * item. A chunk is returned to the system as soon as its last item is
+ * freed, except for the last chunk of the pool, which is kept so that
+ * short-lived items do not reallocate a chunk each time. Long-lived items
+ * thus pin only their own chunks, not the high-water mark of the pool.
+ *
+ * Pools are global statics. Items may outlive the pool at exit, so the
+ * chunks are leaked instead of freed if items are still allocated, and
+ * operator delete must ignore items once the pool is gone.
+ */
+template <typename T>
+class ItemPool
+{
+public:
+    ItemPool() : live(0) {}
+
+    ~ItemPool()
+    {
+        if (live != 0)
+            return;
+
+        foreach (Chunk *chunk, chunks)
+            freeChunk(chunk);
+    }
+
+    void *allocate()
+    {
+        QMutexLocker locker(&mutex);
+        if (available.isEmpty())
+            addChunk();
+
+        Chunk *chunk = available.last();
+        FreeBlock *block = chunk->freeList;
+        chunk->freeList = block->next;
+        if (!chunk->freeList)
+            available.removeLast();
+        chunk->live++;
+        live++;
+        return block;
+    }
+
+    // Returns false if ptr was not allocated from this pool
+    bool release(void *ptr)
+    {
+        QMutexLocker locker(&mutex);
+        Chunk *chunk = findChunk(static_cast<char *>(ptr));
+        if (!chunk)
+            return false;
+
+        FreeBlock *block = static_cast<FreeBlock *>(ptr);
+        if (!chunk->freeList)
+            available.append(chunk);
+        block->next = chunk->freeList;
+        chunk->freeList = block;
+        live--;
+
+        if (--chunk->live == 0 && chunks.size() > 1) {
+            available.removeOne(chunk);
+            chunks.remove(chunk->items);
+            freeChunk(chunk);
+        }
+        return true;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct Chunk {
+        char *items;
+        FreeBlock *freeList;
+        int live;
+    };
+
+    enum { ItemsPerChunk = 256 };
+
+    void addChunk()
+    {
+        Chunk *chunk = new Chunk;
+        chunk->items = static_cast<char *>(::operator new(ItemsPerChunk * sizeof(T)));
+        chunk->freeList = 0;
+        chunk->live = 0;
+        for (int i = ItemsPerChunk - 1; i >= 0; i--) {
+            FreeBlock *block = reinterpret_cast<FreeBlock *>(chunk->items + i * sizeof(T));
+            block->next = chunk->freeList;
+            chunk->freeList = block;
+        }
+
+        chunks.insert(chunk->items, chunk);
+        available.append(chunk);
+    }
+
+    Chunk *findChunk(char *ptr) const
+    {
+        // The chunk with the highest start address not above ptr
+        typename QMap<char *, Chunk *>::const_iterator it = chunks.upperBound(ptr);
+        if (it == chunks.constBegin())
+            return 0;
+        --it;
+        if (ptr >= (*it)->items + ItemsPerChunk * sizeof(T))
+            return 0;
+        return *it;
+    }
+
+    static void freeChunk(Chunk *chunk)
+    {
+        ::operator delete(chunk->items);
+        delete chunk;
+    }
+
+    QMutex mutex;
+    // By start address, to find the chunk of an item
+    QMap<char *, Chunk *> chunks;
+    // Chunks with free items; new items come from the last one
+    QList<Chunk *> available;
+    int live;
+};
+
+}
+
+#endif
@@ -0,0 +1,239 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_PROPERTYSET_H
+#define COMMHISTORY_PROPERTYSET_H
+
+#include <QtGlobal>
+#include <QList>
+
+namespace CommHistory {
+
+/*!
+ * \class PropertyBitSet
+ *
+ * Fixed size set of enum values, stored as a bitset. It provides the
+ * parts of the QSet API used for property sets, and iterates in enum order.
+ * Enum values must be in the range [0, Count).
+ */
+template <typename Enum, int Count>
+class PropertyBitSet
+{
+public:
+    class const_iterator
+    {
+    public:
+        const_iterator() : set(0), pos(Count) {}
+
+        Enum operator*() const { return static_cast<Enum>(pos); }
+        bool operator==(const const_iterator &o) const { return pos == o.pos; }
+        bool operator!=(const const_iterator &o) const { return pos != o.pos; }
+        const_iterator &operator++() { pos = set->next(pos + 1); return *this; }
+        const_iterator operator++(int) { const_iterator it = *this; ++*this; return it; }
+
+    private:
+        friend class PropertyBitSet;
+        const_iterator(const PropertyBitSet *s, int p) : set(s), pos(p) {}
+
+        const PropertyBitSet *set;
+        int pos;
+    };
+    typedef const_iterator iterator;
+    typedef Enum value_type;
+
+    PropertyBitSet() { clear(); }
+
+    static PropertyBitSet all()
+    {
+        PropertyBitSet set;
+        for (int i = 0; i < Words; i++)
+            set.bits[i] = ~quint64(0);
+        set.bits[Words - 1] &= LastWordMask;
+        return set;
+    }
+
+    bool contains(Enum value) const
+    {
+        return (bits[word(value)] & bit(value)) != 0;
+    }
+
+    bool contains(const PropertyBitSet &other) const
+    {
+        for (int i = 0; i < Words; i++) {
+            if ((bits[i] & other.bits[i]) != other.bits[i])
+                return false;
+        }
+        return true;
+    }
+
+    bool intersects(const PropertyBitSet &other) const
+    {
+        for (int i = 0; i < Words; i++) {
+            if (bits[i] & other.bits[i])
+                return true;
+        }
+        return false;
+    }
+
+    void insert(Enum value)
+    {
+        bits[word(value)] |= bit(value);
+    }
+
+    bool remove(Enum value)
+    {
+        bool found = contains(value);
+        bits[word(value)] &= ~bit(value);
+        return found;
+    }
+
+    void clear()
+    {
+        for (int i = 0; i < Words; i++)
+            bits[i] = 0;
+    }
+
+    bool isEmpty() const
+    {
+        for (int i = 0; i < Words; i++) {
+            if (bits[i])
+                return false;
+        }
+        return true;
+    }
+
+    int count() const
+    {
+        int n = 0;
+        for (int i = 0; i < Words; i++) {
+            for (quint64 w = bits[i]; w; w &= w - 1)
+                n++;
+        }
+        return n;
+    }
+    int size() const { return count(); }
+
+    PropertyBitSet &unite(const PropertyBitSet &other)
+    {
+        for (int i = 0; i < Words; i++)
+            bits[i] |= other.bits[i];
+        return *this;
+    }
+
+    PropertyBitSet &subtract(const PropertyBitSet &other)
+    {
+        for (int i = 0; i < Words; i++)
+            bits[i] &= ~other.bits[i];
+        return *this;
+    }
+
+    PropertyBitSet &intersect(const PropertyBitSet &other)
+    {
+        for (int i = 0; i < Words; i++)
+            bits[i] &= other.bits[i];
+        return *this;
+    }
+
+    QList<Enum> toList() const
+    {
+        QList<Enum> list;
+        for (const_iterator it = begin(); it != end(); ++it)
+            list.append(*it);
+        return list;
+    }
+    QList<Enum> values() const { return toList(); }
+
+    const_iterator begin() const { return const_iterator(this, next(0)); }
+    const_iterator end() const { return const_iterator(this, Count); }
+    const_iterator constBegin() const { return begin(); }
+    const_iterator constEnd() const { return end(); }
+
+    bool operator==(const PropertyBitSet &other) const
+    {
+        for (int i = 0; i < Words; i++) {
+            if (bits[i] != other.bits[i])
+                return false;
+        }
+        return true;
+    }
+    bool operator!=(const PropertyBitSet &other) const { return !(*this == other); }
+
+    PropertyBitSet &operator<<(Enum value) { insert(value); return *this; }
+    PropertyBitSet &operator+=(Enum value) { insert(value); return *this; }
+    PropertyBitSet &operator-=(Enum value) { remove(value); return *this; }
+    PropertyBitSet &operator|=(Enum value) { insert(value); return *this; }
+
+    PropertyBitSet &operator+=(const PropertyBitSet &other) { return unite(other); }
+    PropertyBitSet &operator|=(const PropertyBitSet &other) { return unite(other); }
+    PropertyBitSet &operator-=(const PropertyBitSet &other) { return subtract(other); }
+    PropertyBitSet &operator&=(const PropertyBitSet &other) { return intersect(other); }
+
+    PropertyBitSet operator+(const PropertyBitSet &other) const { PropertyBitSet r = *this; return r.unite(other); }
+    PropertyBitSet operator|(const PropertyBitSet &other) const { PropertyBitSet r = *this; return r.unite(other); }
+    PropertyBitSet operator-(const PropertyBitSet &other) const { PropertyBitSet r = *this; return r.subtract(other); }
+    PropertyBitSet operator&(const PropertyBitSet &other) const { PropertyBitSet r = *this; return r.intersect(other); }
+
+    uint hash() const
+    {
+        quint64 h = 0;
+        for (int i = 0; i < Words; i++)
+            h = h * 31 + bits[i];
+        return uint(h ^ (h >> 32));
+    }
+
+private:
+    enum { Words = (Count + 63) / 64 };
+    static const quint64 LastWordMask = (Count % 64) ? ((quint64(1) << (Count % 64)) - 1) : ~quint64(0);
+
+    static int word(int value) { Q_ASSERT(value >= 0 && value < Count); return value / 64; }
+    static quint64 bit(int value) { return quint64(1) << (value % 64); }
+
+    // First set position at or after pos, or Count
+    int next(int pos) const
+    {
+        while (pos < Count) {
+            quint64 w = bits[pos / 64] >> (pos % 64);
+            if (!w) {
+                pos = (pos / 64 + 1) * 64;
+                continue;
+            }
+            while (!(w & 1)) {
+                w >>= 1;
+                pos++;
+            }
+            return pos;
+        }
+        return Count;
+    }
+
+    quint64 bits[Words];
+};
+
+template <typename Enum, int Count>
+inline uint qHash(const PropertyBitSet<Enum, Count> &set)
+{
+    return set.hash();
+}
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QDebug>
+
+#include "queryworker.h"
+#include "eventcolumnstore.h"
+#include "databaseio_p.h"
+#include "commhistorydatabase.h"
+#include "debug.h"
+
+using namespace CommHistory;
+
+QueryWorker::QueryWorker(QObject *parent)
+    : QObject(parent)
+{
+}
+
+bool QueryWorker::execQuery(QSqlQuery &query, int queryId, const QString &statement,
+                            const QVariantMap &values)
+{
+    query.setForwardOnly(true);
+    if (!query.prepare(statement)) {
+        qWarning() << "Failed to prepare query";
+        qWarning() << query.lastError();
+        qWarning() << statement;
+        emit queryFinished(queryId, false);
+        return false;
+    }
+
+    QVariantMap::const_iterator it = values.constBegin();
+    for (; it != values.constEnd(); ++it)
+        query.bindValue(it.key(), it.value());
+
+    if (!query.exec()) {
+        qWarning() << "Failed to execute query";
+        qWarning() << query.lastError();
+        qWarning() << query.lastQuery();
+        emit queryFinished(queryId, false);
+        return false;
+    }
+
+    return true;
+}
+
+void QueryWorker::runQuery(int queryId, const QString &statement, const QVariantMap &values,
+                           const CommHistory::Event::PropertySet &properties,
+                           int firstChunkSize, int chunkSize)
+{
+    DEBUG() << Q_FUNC_INFO << queryId;
+
+    // Runs on the read connection of the worker thread
+    QSqlQuery query(DatabaseIOPrivate::instance()->readConnection());
+    if (!execQuery(query, queryId, statement, values))
+        return;
+
+    DatabaseIOPrivate::EventProjection projection = DatabaseIOPrivate::eventProjection(properties);
+    QList<Event> events;
+    int start = 0;
+    int limit = firstChunkSize > 0 ? firstChunkSize : chunkSize;
+    while (query.next()) {
+        Event e;
+        DatabaseIOPrivate::readEventResult(query, e, projection);
+        events.append(e);
+
+        if (limit > 0 && events.size() >= limit) {
+            emit eventsReceived(queryId, start, start + events.size(), events);
+            start += events.size();
+            events.clear();
+            limit = chunkSize;
+        }
+    }
+    query.finish();
+
+    if (!events.isEmpty())
+        emit eventsReceived(queryId, start, start + events.size(), events);
+
+    emit queryFinished(queryId, true);
+}
+
+void QueryWorker::runColumnQuery(int queryId, const QString &statement, const QVariantMap &values,
+                                 const CommHistory::Event::PropertySet &properties,
+                                 int firstChunkSize, int chunkSize)
+{
+    DEBUG() << Q_FUNC_INFO << queryId;
+
+    QSqlQuery query(DatabaseIOPrivate::instance()->readConnection());
+    if (!execQuery(query, queryId, statement, values))
+        return;
+
+    DatabaseIOPrivate::EventProjection projection = DatabaseIOPrivate::eventProjection(properties);
+    EventColumnStore *columns = new EventColumnStore(properties);
+    int limit = firstChunkSize > 0 ? firstChunkSize : chunkSize;
+    while (query.next()) {
+        columns->appendRow(query, projection);
+
+        if (limit > 0 && columns->count() >= limit) {
+            emit columnsReceived(queryId, columns);
+            columns = new EventColumnStore(properties);
+            limit = chunkSize;
+        }
+    }
+    query.finish();
+
+    if (!columns->isEmpty())
+        emit columnsReceived(queryId, columns);
+    else
+        delete columns;
+
+    emit queryFinished(queryId, true);
+}
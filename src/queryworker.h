@@ -0,0 +1,91 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef COMMHISTORY_QUERYWORKER_H
+#define COMMHISTORY_QUERYWORKER_H
+
+#include <QObject>
+#include <QList>
+#include <QVariantMap>
+
+#include "event.h"
+
+class QSqlQuery;
+
+namespace CommHistory {
+
+class EventColumnStore;
+
+/*!
+ * \class QueryWorker
+ *
+ * Executes event queries for EventModel in a background thread, using the
+ * read connection of that thread. Results are delivered in
+ * chunks through eventsReceived() or columnsReceived(), followed by
+ * queryFinished().
+ */
+class QueryWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    QueryWorker(QObject *parent = 0);
+
+public Q_SLOTS:
+    /*!
+     * Execute an event query.
+     *
+     * \param queryId Identifier passed back with the results.
+     * \param statement SQL statement selecting the event query columns.
+     * \param values Bound values, by placeholder name.
+     * \param properties Event properties selected by the statement.
+     * \param firstChunkSize Number of events in the first chunk.
+     * \param chunkSize Number of events in the following chunks. If 0,
+     *                  all events are delivered at once.
+     */
+    void runQuery(int queryId, const QString &statement, const QVariantMap &values,
+                  const CommHistory::Event::PropertySet &properties,
+                  int firstChunkSize, int chunkSize);
+
+    /*!
+     * Execute an event query, delivering the results as column chunks
+     * instead of Event instances. Arguments are as for runQuery().
+     * Ownership of each EventColumnStore is passed to the receiver of
+     * columnsReceived().
+     */
+    void runColumnQuery(int queryId, const QString &statement, const QVariantMap &values,
+                        const CommHistory::Event::PropertySet &properties,
+                        int firstChunkSize, int chunkSize);
+
+Q_SIGNALS:
+    void eventsReceived(int queryId, int start, int end, QList<CommHistory::Event> events);
+    void columnsReceived(int queryId, CommHistory::EventColumnStore *columns);
+    void queryFinished(int queryId, bool successful);
+
+private:
+    bool execQuery(QSqlQuery &query, int queryId, const QString &statement,
+                   const QVariantMap &values);
+};
+
+}
+
+#endif
@@ -51,6 +51,9 @@ public:
     }
 
     bool fillModel(int start, int end, QList<Event> events);
+    bool acceptsUpdatedEvent(const Event &event) const;
+    uint resultChunkSize() const;
+    bool supportsColumnStorage() const;
 
     void eventsAddedSlot(const QList<Event> &events);
     void eventsUpdatedSlot(const QList<Event> &events);
@@ -112,6 +115,44 @@ bool RecentContactsModelPrivate::fillModel(int start, int end, QList<Event> even
     return false;
 }
 
+bool RecentContactsModelPrivate::acceptsUpdatedEvent(const Event &event) const
+{
+    // Updates carry the start time and addresses; other events can only
+    // matter if they are at least as recent as the event shown for their
+    // address, and recent enough to be within the limit
+    if (!event.validProperties().contains(Event::StartTime)
+        || !event.validProperties().contains(Event::LocalUid)
+        || !event.validProperties().contains(Event::RemoteUid)) {
+        return true;
+    }
+
+    const int rowCount = eventRootItem->childCount();
+    if (queryLimit && rowCount >= queryLimit
+        && eventRootItem->eventAt(rowCount - 1).startTime() > event.startTime()) {
+        return false;
+    }
+
+    for (int row = 0; row < rowCount; ++row) {
+        const Event &existing(eventRootItem->eventAt(row));
+        if (existing.localUid() == event.localUid() && existing.remoteUid() == event.remoteUid())
+            return existing.startTime() <= event.startTime();
+    }
+
+    return true;
+}
+
+uint RecentContactsModelPrivate::resultChunkSize() const
+{
+    // The limit is applied to the results of each fillModel() call
+    return 0;
+}
+
+bool RecentContactsModelPrivate::supportsColumnStorage() const
+{
+    // Events are filtered by contact in fillModel()
+    return false;
+}
+
 void RecentContactsModelPrivate::eventsAddedSlot(const QList<Event> &events)
 {
     EventModelPrivate::eventsAddedSlot(events);
@@ -121,9 +162,19 @@ void RecentContactsModelPrivate::eventsAddedSlot(const QList<Event> &events)
 
 void RecentContactsModelPrivate::eventsUpdatedSlot(const QList<Event> &events)
 {
+    Q_Q(RecentContactsModel);
+
     EventModelPrivate::eventsUpdatedSlot(events);
 
-    updatePendingEvents(events);
+    // Updates may carry only the modified properties; use the merged
+    // data for events that are in the model
+    QList<Event> updated;
+    foreach (const Event &event, events) {
+        QModelIndex index = findEvent(event.id());
+        updated.append(index.isValid() ? q->event(index) : event);
+    }
+
+    updatePendingEvents(updated);
 }
 
 void RecentContactsModelPrivate::slotContactUpdated(quint32 localId,
@@ -233,7 +284,7 @@ void RecentContactsModelPrivate::updatePendingEvent(Event *event)
             Event &pending(*it);
             if (pending.id() == event->id()) {
                 // This event is already pending - this is an update
-                pending = *event;
+                pending.copyValidProperties(*event);
                 addEvent = false;
             }
 
@@ -433,7 +484,7 @@ bool RecentContactsModel::getEvents()
         limitClause = QString::fromLatin1(" LIMIT %1").arg(2 * d->queryLimit);
     }
 
-    QString q = DatabaseIOPrivate::eventQueryBase() + QString::fromLatin1(
+    QString q = DatabaseIOPrivate::eventQueryBase(d->queryProperties()) + QString::fromLatin1(
 " WHERE Events.id IN ("
   " SELECT lastId FROM ("
     " SELECT max(id) AS lastId, max(startTime) FROM Events"
@@ -96,7 +96,7 @@ bool SingleEventModel::getEventById(int eventId)
     d->m_eventId = eventId;
 
     QSqlQuery query = DatabaseIOPrivate::instance()->createQuery();
-    QString q = DatabaseIOPrivate::eventQueryBase() + QString::fromLatin1(" WHERE id = %1").arg(eventId);
+    QString q = DatabaseIOPrivate::eventQueryBase(d->queryProperties()) + QString::fromLatin1(" WHERE id = %1").arg(eventId);
 
     if (!query.prepare(q)) {
         qWarning() << "Failed to execute query";
@@ -125,7 +125,7 @@ bool SingleEventModel::getEventByTokens(const QString &token,
 
     QSqlQuery query = DatabaseIOPrivate::instance()->createQuery();
 
-    QString q = DatabaseIOPrivate::eventQueryBase();
+    QString q = DatabaseIOPrivate::eventQueryBase(d->queryProperties());
     q += "WHERE ";
 
     if (groupId > -1) { 
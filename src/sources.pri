@@ -16,6 +16,7 @@ HEADERS += commonutils.h \
            classzerosmsmodel.h \
            mmscontentdeleter.h \
            contactlistener.h \
+           contactcache.h \
            libcommhistoryexport.h \
            singleeventmodel.h \
            recentcontactsmodel.h \
@@ -30,6 +31,12 @@ HEADERS += commonutils.h \
            databaseio.h \
            databaseio_p.h \
            commhistorydatabase.h \
+           queryworker.h \
+           eventcolumnstore.h \
+           databasemaintenance.h \
+           fieldencoding.h \
+           itempool.h \
+           propertyset.h \
            debug.h
 
 SOURCES += commonutils.cpp \
@@ -46,6 +53,7 @@ SOURCES += commonutils.cpp \
            classzerosmsmodel.cpp \
            mmscontentdeleter.cpp \
            contactlistener.cpp \
+           contactcache.cpp \
            singleeventmodel.cpp \
            recentcontactsmodel.cpp \
            updatesemitter.cpp \
@@ -54,4 +62,8 @@ SOURCES += commonutils.cpp \
            contactgroupmodel.cpp \
            contactgroup.cpp \
            databaseio.cpp \
-           commhistorydatabase.cpp
+           commhistorydatabase.cpp \
+           queryworker.cpp \
+           eventcolumnstore.cpp \
+           databasemaintenance.cpp \
+           fieldencoding.cpp
@@ -21,27 +21,68 @@
 ******************************************************************************/
 
 #include <QtDBus/QtDBus>
+#include <QThread>
 
 #include "adaptor.h"
 
 #include "updatesemitter.h"
 #include "constants.h"
+#include "debug.h"
+
+namespace {
+static const int defaultFlushInterval = 20;
+}
 
 namespace CommHistory {
 
 QWeakPointer<UpdatesEmitter> UpdatesEmitter::m_Instance;
 
 UpdatesEmitter::UpdatesEmitter()
+    : m_flushing(false),
+      m_fullEventUpdates(qgetenv("COMMHISTORY_FULL_EVENT_UPDATES") == "1"),
+      m_queuedCount(0),
+      m_emittedCount(0)
 {
+    // Used by queued calls of the queue slots from other threads
+    qRegisterMetaType<QList<CommHistory::Event> >();
+    qRegisterMetaType<QList<CommHistory::Group> >();
+    qRegisterMetaType<QList<QByteArray> >();
+    qRegisterMetaType<QList<int> >();
+
     new Adaptor(this);
-    if (!QDBusConnection::sessionBus().registerObject(COMM_HISTORY_OBJECT_PATH,
-                                                      this)) {
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    if (!bus.registerObject(COMM_HISTORY_OBJECT_PATH, this)) {
         qWarning() << Q_FUNC_INFO << ": error registering object";
     }
+
+    // Added and updated events are connected by subscription
+    m_busName = bus.baseService();
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, EVENT_DELETED_SIGNAL,
+                this, SLOT(busEventDeleted(const QDBusMessage &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, EVENTS_DELETED_SIGNAL,
+                this, SLOT(busEventsDeleted(const QDBusMessage &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_ADDED_SIGNAL,
+                this, SLOT(busGroupsAdded(const QDBusMessage &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_UPDATED_SIGNAL,
+                this, SLOT(busGroupsUpdated(const QDBusMessage &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_UPDATED_FULL_SIGNAL,
+                this, SLOT(busGroupsUpdatedFull(const QDBusMessage &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_MARKED_READ_SIGNAL,
+                this, SLOT(busGroupsMarkedRead(const QDBusMessage &)));
+    bus.connect(QString(), QString(), COMM_HISTORY_SERVICE_NAME, GROUPS_DELETED_SIGNAL,
+                this, SLOT(busGroupsDeleted(const QDBusMessage &)));
+
+    bool ok = false;
+    int interval = qgetenv("COMMHISTORY_UPDATES_INTERVAL").toInt(&ok);
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(ok && interval >= 0 ? interval : defaultFlushInterval);
+    connect(&m_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
 }
 
 UpdatesEmitter::~UpdatesEmitter()
 {
+    // Changes are committed already, they must not be lost
+    flush();
     QDBusConnection::sessionBus().unregisterObject(COMM_HISTORY_OBJECT_PATH);
 }
 
@@ -58,4 +99,561 @@ QSharedPointer<UpdatesEmitter> UpdatesEmitter::instance()
     return result;
 }
 
+void UpdatesEmitter::setFlushInterval(int msec)
+{
+    m_flushTimer.setInterval(qMax(msec, 0));
+    if (!msec)
+        flush();
+}
+
+int UpdatesEmitter::flushInterval() const
+{
+    return m_flushTimer.interval();
+}
+
+void UpdatesEmitter::setFullEventUpdates(bool enabled)
+{
+    m_fullEventUpdates = enabled;
+    if (!enabled) {
+        m_eventsUpdatedFull.clear();
+        m_eventsUpdatedFullRows.clear();
+    }
+}
+
+bool UpdatesEmitter::fullEventUpdates() const
+{
+    return m_fullEventUpdates;
+}
+
+quint64 UpdatesEmitter::queuedCount() const
+{
+    return m_queuedCount;
+}
+
+quint64 UpdatesEmitter::emittedCount() const
+{
+    return m_emittedCount;
+}
+
+QString UpdatesEmitter::feedPath(const Event &event)
+{
+    if (event.type() == Event::CallEvent || event.type() == Event::VoicemailEvent)
+        return COMM_HISTORY_CALLS_PATH;
+    if (event.validProperties().contains(Event::GroupId) && event.groupId() >= 0)
+        return QString(COMM_HISTORY_GROUP_PATH).arg(event.groupId());
+    return COMM_HISTORY_UNSORTED_PATH;
+}
+
+void UpdatesEmitter::changeQueued()
+{
+    m_queuedCount++;
+
+    // The timer is not restarted by later changes, so a steady stream of
+    // changes is still sent once per interval
+    if (!m_flushTimer.interval() && !m_flushing)
+        flush();
+    else if (!m_flushTimer.isActive())
+        m_flushTimer.start();
+}
+
+void UpdatesEmitter::subscribe(const QStringList &paths)
+{
+    if (paths.isEmpty()) {
+        m_subscriptions[QString()]++;
+    } else {
+        foreach (const QString &path, paths)
+            m_subscriptions[path]++;
+    }
+    updateFeeds();
+}
+
+void UpdatesEmitter::unsubscribe(const QStringList &paths)
+{
+    QStringList keys = paths;
+    if (keys.isEmpty())
+        keys << QString();
+
+    foreach (const QString &key, keys) {
+        QHash<QString, int>::iterator it = m_subscriptions.find(key);
+        if (it != m_subscriptions.end() && --*it <= 0)
+            m_subscriptions.erase(it);
+    }
+    updateFeeds();
+}
+
+void UpdatesEmitter::updateFeeds()
+{
+    // The global signals carry every feed, so listening to both would
+    // deliver changes twice
+    QStringList feeds;
+    if (m_subscriptions.contains(QString()))
+        feeds << QString();
+    else
+        feeds = m_subscriptions.keys();
+
+    foreach (const QString &path, m_connectedFeeds) {
+        if (!feeds.contains(path))
+            connectFeed(path, false);
+    }
+    foreach (const QString &path, feeds) {
+        if (!m_connectedFeeds.contains(path))
+            connectFeed(path, true);
+    }
+
+    m_connectedFeeds = feeds;
+}
+
+void UpdatesEmitter::connectFeed(const QString &path, bool enable)
+{
+    // An empty path is the global signal, with every change
+    QString interface = path.isEmpty() ? COMM_HISTORY_SERVICE_NAME
+                                       : COMM_HISTORY_FEED_INTERFACE;
+    QDBusConnection bus = QDBusConnection::sessionBus();
+
+    if (enable) {
+        bus.connect(QString(), path, interface, EVENTS_ADDED_SIGNAL,
+                    this, SLOT(busEventsAdded(const QDBusMessage &)));
+        bus.connect(QString(), path, interface, EVENT_PROPERTIES_UPDATED_SIGNAL,
+                    this, SLOT(busEventPropertiesUpdated(const QDBusMessage &)));
+    } else {
+        bus.disconnect(QString(), path, interface, EVENTS_ADDED_SIGNAL,
+                       this, SLOT(busEventsAdded(const QDBusMessage &)));
+        bus.disconnect(QString(), path, interface, EVENT_PROPERTIES_UPDATED_SIGNAL,
+                       this, SLOT(busEventPropertiesUpdated(const QDBusMessage &)));
+    }
+}
+
+bool UpdatesEmitter::isOwnMessage(const QDBusMessage &message) const
+{
+    // Changes of this process were delivered locally when they were sent
+    return message.service() == m_busName;
+}
+
+void UpdatesEmitter::busEventsAdded(const QDBusMessage &message)
+{
+    if (!isOwnMessage(message))
+        emit receivedEventsAdded(qdbus_cast<QList<Event> >(message.arguments().value(0)));
+}
+
+void UpdatesEmitter::busEventPropertiesUpdated(const QDBusMessage &message)
+{
+    if (isOwnMessage(message))
+        return;
+
+    QList<Event> events, previous;
+    foreach (const QByteArray &data, qdbus_cast<QList<QByteArray> >(message.arguments().value(0))) {
+        Event state;
+        events.append(Event::decodeProperties(data, &state));
+        previous.append(state);
+    }
+    emit receivedEventPropertiesUpdated(events, previous);
+}
+
+void UpdatesEmitter::busEventDeleted(const QDBusMessage &message)
+{
+    if (!isOwnMessage(message))
+        emit receivedEventDeleted(message.arguments().value(0).toInt());
+}
+
+void UpdatesEmitter::busEventsDeleted(const QDBusMessage &message)
+{
+    if (isOwnMessage(message))
+        return;
+
+    QList<Event> events;
+    foreach (const QByteArray &data, qdbus_cast<QList<QByteArray> >(message.arguments().value(0)))
+        events.append(Event::decodeProperties(data));
+    emit receivedEventsDeleted(events);
+}
+
+void UpdatesEmitter::busGroupsAdded(const QDBusMessage &message)
+{
+    if (!isOwnMessage(message))
+        emit receivedGroupsAdded(qdbus_cast<QList<Group> >(message.arguments().value(0)));
+}
+
+void UpdatesEmitter::busGroupsUpdated(const QDBusMessage &message)
+{
+    if (!isOwnMessage(message))
+        emit receivedGroupsUpdated(qdbus_cast<QList<int> >(message.arguments().value(0)));
+}
+
+void UpdatesEmitter::busGroupsUpdatedFull(const QDBusMessage &message)
+{
+    if (!isOwnMessage(message))
+        emit receivedGroupsUpdatedFull(qdbus_cast<QList<Group> >(message.arguments().value(0)));
+}
+
+void UpdatesEmitter::busGroupsMarkedRead(const QDBusMessage &message)
+{
+    if (!isOwnMessage(message))
+        emit receivedGroupsMarkedRead(qdbus_cast<QList<int> >(message.arguments().value(0)));
+}
+
+void UpdatesEmitter::busGroupsDeleted(const QDBusMessage &message)
+{
+    if (!isOwnMessage(message))
+        emit receivedGroupsDeleted(qdbus_cast<QList<int> >(message.arguments().value(0)));
+}
+
+void UpdatesEmitter::queueEventsAdded(const QList<Event> &events)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueEventsAdded", Qt::QueuedConnection, Q_ARG(QList<CommHistory::Event>, events));
+        return;
+    }
+
+    if (events.isEmpty())
+        return;
+
+    // A moved event is deleted and added with the same id; receivers must
+    // see the deletion first, but batches send additions before deletions
+    foreach (const Event &event, events) {
+        if (m_eventsDeleted.contains(event.id())) {
+            flush();
+            break;
+        }
+    }
+
+    m_eventsAdded.append(events);
+    foreach (const Event &event, events)
+        m_eventsAddedPaths.append(feedPath(event));
+    changeQueued();
+}
+
+void UpdatesEmitter::queueEventsUpdated(const QList<Event> &events)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueEventsUpdated", Qt::QueuedConnection, Q_ARG(QList<CommHistory::Event>, events));
+        return;
+    }
+
+    if (events.isEmpty() || !m_fullEventUpdates)
+        return;
+
+    foreach (const Event &event, events) {
+        QHash<int, int>::const_iterator it = m_eventsUpdatedFullRows.constFind(event.id());
+        if (it == m_eventsUpdatedFullRows.constEnd()) {
+            m_eventsUpdatedFullRows.insert(event.id(), m_eventsUpdatedFull.size());
+            m_eventsUpdatedFull.append(event);
+        } else {
+            m_eventsUpdatedFull[*it].copyValidProperties(event);
+        }
+    }
+    changeQueued();
+}
+
+void UpdatesEmitter::queueEventPropertiesUpdated(const QList<QByteArray> &events,
+                                                 const QStringList &previousPaths)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueEventPropertiesUpdated", Qt::QueuedConnection,
+                                  Q_ARG(QList<QByteArray>, events), Q_ARG(QStringList, previousPaths));
+        return;
+    }
+
+    if (events.isEmpty())
+        return;
+
+    for (int i = 0; i < events.size(); i++) {
+        const QByteArray &data = events.at(i);
+        const QString previousPath = previousPaths.value(i);
+        Event previous;
+        Event event = Event::decodeProperties(data, &previous);
+        QHash<int, int>::const_iterator it = m_eventsUpdatedRows.constFind(event.id());
+        if (it == m_eventsUpdatedRows.constEnd()) {
+            m_eventsUpdatedRows.insert(event.id(), m_eventsUpdated.size());
+            m_eventsUpdated.append(data);
+            m_eventsUpdatedPaths.append(feedPath(event));
+            m_eventsUpdatedPreviousPaths.append(previousPath);
+        } else {
+            // Later values win, and the properties of both updates are sent.
+            // The previous state is the one before the first update that
+            // changed it; updates that do not change it carry none.
+            Event mergedPrevious;
+            Event merged = Event::decodeProperties(m_eventsUpdated.at(*it), &mergedPrevious);
+            merged.copyValidProperties(event);
+            previous.copyValidProperties(mergedPrevious);
+            m_eventsUpdated[*it] = merged.encodeProperties(merged.validProperties(), previous);
+            m_eventsUpdatedPaths[*it] = feedPath(merged);
+            // The feed the event was on before the batch is the one to tell
+            if (m_eventsUpdatedPreviousPaths.at(*it).isEmpty())
+                m_eventsUpdatedPreviousPaths[*it] = previousPath;
+        }
+    }
+    changeQueued();
+}
+
+void UpdatesEmitter::queueEventDeleted(int id)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueEventDeleted", Qt::QueuedConnection, Q_ARG(int, id));
+        return;
+    }
+
+    if (!m_eventsDeleted.contains(id))
+        m_eventsDeleted.append(id);
+    changeQueued();
+}
+
+void UpdatesEmitter::queueEventsDeleted(const QList<Event> &events)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueEventsDeleted", Qt::QueuedConnection, Q_ARG(QList<CommHistory::Event>, events));
+        return;
+    }
+
+    if (events.isEmpty())
+        return;
+
+    static Event::PropertySet stateProperties;
+    if (stateProperties.isEmpty()) {
+        stateProperties << Event::GroupId
+                        << Event::StartTime
+                        << Event::Direction
+                        << Event::IsRead
+                        << Event::IsDraft;
+    }
+
+    foreach (const Event &event, events) {
+        if (m_eventsDeleted.contains(event.id()))
+            continue;
+        m_eventsDeleted.append(event.id());
+        if (event.validProperties().contains(Event::GroupId))
+            m_eventsDeletedStates.append(event.encodeProperties(stateProperties));
+    }
+    changeQueued();
+}
+
+void UpdatesEmitter::queueGroupsAdded(const QList<Group> &groups)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueGroupsAdded", Qt::QueuedConnection, Q_ARG(QList<CommHistory::Group>, groups));
+        return;
+    }
+
+    if (groups.isEmpty())
+        return;
+
+    m_groupsAdded.append(groups);
+    changeQueued();
+}
+
+void UpdatesEmitter::queueGroupsUpdated(const QList<int> &groupIds)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueGroupsUpdated", Qt::QueuedConnection, Q_ARG(QList<int>, groupIds));
+        return;
+    }
+
+    if (groupIds.isEmpty())
+        return;
+
+    foreach (int id, groupIds) {
+        if (!m_groupsUpdated.contains(id))
+            m_groupsUpdated.append(id);
+    }
+    changeQueued();
+}
+
+void UpdatesEmitter::queueGroupsUpdatedFull(const QList<Group> &groups)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueGroupsUpdatedFull", Qt::QueuedConnection, Q_ARG(QList<CommHistory::Group>, groups));
+        return;
+    }
+
+    if (groups.isEmpty())
+        return;
+
+    foreach (const Group &group, groups) {
+        QHash<int, int>::const_iterator it = m_groupsUpdatedFullRows.constFind(group.id());
+        if (it == m_groupsUpdatedFullRows.constEnd()) {
+            m_groupsUpdatedFullRows.insert(group.id(), m_groupsUpdatedFull.size());
+            m_groupsUpdatedFull.append(group);
+        } else {
+            m_groupsUpdatedFull[*it] = group;
+        }
+    }
+    changeQueued();
+}
+
+void UpdatesEmitter::queueGroupsMarkedRead(const QList<int> &groupIds)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueGroupsMarkedRead", Qt::QueuedConnection, Q_ARG(QList<int>, groupIds));
+        return;
+    }
+
+    if (groupIds.isEmpty())
+        return;
+
+    foreach (int id, groupIds) {
+        if (!m_groupsMarkedRead.contains(id))
+            m_groupsMarkedRead.append(id);
+    }
+    changeQueued();
+}
+
+void UpdatesEmitter::queueGroupsDeleted(const QList<int> &groupIds)
+{
+    // The queues and the timer belong to the thread of the emitter
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "queueGroupsDeleted", Qt::QueuedConnection, Q_ARG(QList<int>, groupIds));
+        return;
+    }
+
+    if (groupIds.isEmpty())
+        return;
+
+    foreach (int id, groupIds) {
+        if (!m_groupsDeleted.contains(id))
+            m_groupsDeleted.append(id);
+    }
+    changeQueued();
+}
+
+template <typename T>
+void UpdatesEmitter::sendFeed(const QString &signal, const QList<T> &items,
+                              const QStringList &paths)
+{
+    QMap<QString, QList<T> > feeds;
+    for (int i = 0; i < items.size(); i++)
+        feeds[paths.at(i)].append(items.at(i));
+
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    typename QMap<QString, QList<T> >::const_iterator it = feeds.constBegin();
+    for (; it != feeds.constEnd(); ++it) {
+        QDBusMessage message = QDBusMessage::createSignal(it.key(),
+                                                          COMM_HISTORY_FEED_INTERFACE,
+                                                          signal);
+        message << QVariant::fromValue(it.value());
+        if (!bus.send(message))
+            qWarning() << Q_FUNC_INFO << "Failed to send" << signal << "on" << it.key();
+        m_emittedCount++;
+    }
+}
+
+void UpdatesEmitter::flush()
+{
+    if (m_flushing)
+        return;
+    m_flushTimer.stop();
+    m_flushing = true;
+
+    // Take the queues first, receivers in this process may queue more
+    QList<Group> addedGroups, fullGroups;
+    QList<Event> addedEvents, fullEvents;
+    QList<QByteArray> updatedEvents, deletedStates;
+    QStringList addedPaths, updatedPaths, previousPaths;
+    QList<int> updatedGroups, readGroups, deletedEvents, deletedGroups;
+    addedGroups.swap(m_groupsAdded);
+    addedEvents.swap(m_eventsAdded);
+    addedPaths.swap(m_eventsAddedPaths);
+    fullEvents.swap(m_eventsUpdatedFull);
+    updatedEvents.swap(m_eventsUpdated);
+    updatedPaths.swap(m_eventsUpdatedPaths);
+    previousPaths.swap(m_eventsUpdatedPreviousPaths);
+    fullGroups.swap(m_groupsUpdatedFull);
+    updatedGroups.swap(m_groupsUpdated);
+    readGroups.swap(m_groupsMarkedRead);
+    deletedEvents.swap(m_eventsDeleted);
+    deletedStates.swap(m_eventsDeletedStates);
+    deletedGroups.swap(m_groupsDeleted);
+    m_eventsUpdatedFullRows.clear();
+    m_eventsUpdatedRows.clear();
+    m_groupsUpdatedFullRows.clear();
+
+    quint64 emitted = m_emittedCount;
+
+    // Each batch is sent on the bus for other processes and then
+    // delivered to the receivers in this process
+    if (!addedGroups.isEmpty()) {
+        emit groupsAdded(addedGroups);
+        m_emittedCount++;
+        emit receivedGroupsAdded(addedGroups);
+    }
+    if (!addedEvents.isEmpty()) {
+        emit eventsAdded(addedEvents);
+        m_emittedCount++;
+        sendFeed(EVENTS_ADDED_SIGNAL, addedEvents, addedPaths);
+        emit receivedEventsAdded(addedEvents);
+    }
+    if (!fullEvents.isEmpty()) {
+        emit eventsUpdated(fullEvents);
+        m_emittedCount++;
+    }
+    if (!updatedEvents.isEmpty()) {
+        emit eventPropertiesUpdated(updatedEvents);
+        m_emittedCount++;
+
+        // Events moved to another feed are sent on the old one as well
+        QList<QByteArray> feedEvents = updatedEvents;
+        QStringList feedPaths = updatedPaths;
+        for (int i = 0; i < previousPaths.size(); i++) {
+            if (!previousPaths.at(i).isEmpty() && previousPaths.at(i) != updatedPaths.at(i)) {
+                feedEvents.append(updatedEvents.at(i));
+                feedPaths.append(previousPaths.at(i));
+            }
+        }
+        sendFeed(EVENT_PROPERTIES_UPDATED_SIGNAL, feedEvents, feedPaths);
+
+        QList<Event> events, previous;
+        foreach (const QByteArray &data, updatedEvents) {
+            Event state;
+            events.append(Event::decodeProperties(data, &state));
+            previous.append(state);
+        }
+        emit receivedEventPropertiesUpdated(events, previous);
+    }
+    foreach (int id, deletedEvents) {
+        emit eventDeleted(id);
+        m_emittedCount++;
+        emit receivedEventDeleted(id);
+    }
+    if (!deletedStates.isEmpty()) {
+        emit eventsDeleted(deletedStates);
+        m_emittedCount++;
+
+        QList<Event> events;
+        foreach (const QByteArray &data, deletedStates)
+            events.append(Event::decodeProperties(data));
+        emit receivedEventsDeleted(events);
+    }
+    if (!readGroups.isEmpty()) {
+        emit groupsMarkedRead(readGroups);
+        m_emittedCount++;
+        emit receivedGroupsMarkedRead(readGroups);
+    }
+    if (!fullGroups.isEmpty()) {
+        emit groupsUpdatedFull(fullGroups);
+        m_emittedCount++;
+        emit receivedGroupsUpdatedFull(fullGroups);
+    }
+    if (!updatedGroups.isEmpty()) {
+        emit groupsUpdated(updatedGroups);
+        m_emittedCount++;
+        emit receivedGroupsUpdated(updatedGroups);
+    }
+    if (!deletedGroups.isEmpty()) {
+        emit groupsDeleted(deletedGroups);
+        m_emittedCount++;
+        emit receivedGroupsDeleted(deletedGroups);
+    }
+
+    m_flushing = false;
+
+    if (m_emittedCount != emitted)
+        DEBUG() << Q_FUNC_INFO << "queued" << m_queuedCount << "emitted" << m_emittedCount;
+}
+
 }
@@ -26,12 +26,60 @@
 #include <QObject>
 #include <QSharedPointer>
 #include <QWeakPointer>
+#include <QTimer>
+#include <QHash>
+#include <QStringList>
 
 #include "event.h"
 #include "group.h"
 
+class QDBusMessage;
+
 namespace CommHistory {
 
+/*!
+ * \class UpdatesEmitter
+ *
+ * Sends change notifications of all models in the process on the session
+ * bus. Changes are queued and sent in batches at most once per flush
+ * interval; updates to the same event or group within a batch are merged.
+ * Batches keep the order that receivers depend on: added groups, added
+ * events, event updates, deleted events, groups marked as read, group
+ * updates, deleted groups.
+ * Event changes come before the group updates they cause, so that
+ * GroupManager can apply them and skip the group query. For that, event
+ * updates that change the group statistics carry the previous state of
+ * the event, see Event::encodeProperties(), and deleted events are also
+ * sent with their state in eventsDeleted. An event that is added again
+ * after it was deleted, as moveEvent() does, first sends the pending
+ * batch, so that the deletion is not sent after the addition.
+ *
+ * There is no flush when a transaction is committed. Changes are queued
+ * after the commit, so everything from one commit goes out in the same
+ * batch, at most one flush interval later. Pending changes are sent when
+ * flush() is called and when the emitter is destroyed. A process that
+ * crashes or exits without destroying the emitter loses the notifications
+ * of its last interval, although the changes are committed; other
+ * processes see them only on their next query.
+ *
+ * The queue slots may be called from any thread; calls from other threads
+ * are queued to the thread of the emitter.
+ *
+ * Added and updated events are sent both on COMM_HISTORY_OBJECT_PATH and,
+ * split by feedPath(), on the feed paths from constants.h. This costs the
+ * sender a second message for each batch, but receivers never get both:
+ * each process listens either to the global signals or to its feeds, see
+ * updateFeeds(). The global signals keep every change for clients that
+ * do not use feeds. The deprecated eventsUpdated signal, which sends
+ * updated events in full, is only sent if setFullEventUpdates() enabled
+ * it; it is not received by this library.
+ *
+ * It is also the change bus of the process: changes made in the process
+ * are delivered to the received*() signals directly when a batch is sent,
+ * and changes from other processes are read from the bus once for all
+ * receivers. The bus echo of own changes is dropped by sender before the
+ * arguments are demarshalled.
+ */
 class UpdatesEmitter : public QObject
 {
     Q_OBJECT
@@ -39,22 +87,148 @@ public:
     static QSharedPointer<UpdatesEmitter> instance();
     ~UpdatesEmitter();
 
+    /*!
+     * Set the time in milliseconds that changes are collected before
+     * they are sent. 0 sends every change immediately. The default is
+     * 20 ms, or COMMHISTORY_UPDATES_INTERVAL from the environment.
+     */
+    void setFlushInterval(int msec);
+    int flushInterval() const;
+
+    /*!
+     * Also send updated events in full with the deprecated eventsUpdated
+     * signal, for clients that do not read eventPropertiesUpdated. This
+     * marshals every property of each updated event. Disabled by
+     * default, unless COMMHISTORY_FULL_EVENT_UPDATES is set to 1.
+     */
+    void setFullEventUpdates(bool enabled);
+    bool fullEventUpdates() const;
+
+    // Number of queued changes and of signals sent on the bus
+    quint64 queuedCount() const;
+    quint64 emittedCount() const;
+
+    /*!
+     * Returns the feed path that changes of the event are sent on: calls,
+     * the group of a message, or unsorted for events without a group.
+     */
+    static QString feedPath(const Event &event);
+
+    /*!
+     * Listen to added and updated events from other processes on the
+     * given feed paths. An empty list listens to all changes. Every
+     * subscribe() must be paired with an unsubscribe() with the same
+     * paths. Other changes are always received.
+     */
+    void subscribe(const QStringList &paths);
+    void unsubscribe(const QStringList &paths);
+
+public Q_SLOTS:
+    void queueEventsAdded(const QList<CommHistory::Event> &events);
+    void queueEventsUpdated(const QList<CommHistory::Event> &events);
+    /*!
+     * Queue event updates encoded with Event::encodeProperties().
+     * previousPaths may list the old feed path of each event whose
+     * update moved it to another feed, or an empty string; such updates
+     * are sent on both feeds.
+     */
+    void queueEventPropertiesUpdated(const QList<QByteArray> &events,
+                                     const QStringList &previousPaths = QStringList());
+    void queueEventDeleted(int id);
+    /*!
+     * Queue deleted events with the state read before the deletion;
+     * events without a valid group id are sent by id only.
+     */
+    void queueEventsDeleted(const QList<CommHistory::Event> &events);
+    void queueGroupsAdded(const QList<CommHistory::Group> &groups);
+    void queueGroupsUpdated(const QList<int> &groupIds);
+    void queueGroupsUpdatedFull(const QList<CommHistory::Group> &groups);
+    void queueGroupsMarkedRead(const QList<int> &groupIds);
+    void queueGroupsDeleted(const QList<int> &groupIds);
+
+    /*!
+     * Send all queued changes now.
+     */
+    void flush();
+
 Q_SIGNALS:
-#ifndef Q_MOC_RUN
-public:
-#endif
+    // Relayed to the bus by Adaptor
     void eventsAdded(const QList<CommHistory::Event> &events);
     void eventsUpdated(const QList<CommHistory::Event> &events);
+    void eventPropertiesUpdated(const QList<QByteArray> &events);
     void eventDeleted(int id);
+    void eventsDeleted(const QList<QByteArray> &events);
     void groupsAdded(const QList<CommHistory::Group> &groups);
     void groupsUpdated(const QList<int> &groupIds);
     void groupsUpdatedFull(const QList<CommHistory::Group> &groups);
+    void groupsMarkedRead(const QList<int> &groupIds);
     void groupsDeleted(const QList<int> &groupIds);
 
+    // Changes from this and other processes
+    void receivedEventsAdded(const QList<CommHistory::Event> &events);
+    // previous holds the group, start time, direction, read and draft
+    // state of each event before the update, or only the id and type if
+    // the update did not change them
+    void receivedEventPropertiesUpdated(const QList<CommHistory::Event> &events,
+                                        const QList<CommHistory::Event> &previous);
+    void receivedEventDeleted(int id);
+    void receivedEventsDeleted(const QList<CommHistory::Event> &events);
+    void receivedGroupsAdded(const QList<CommHistory::Group> &groups);
+    void receivedGroupsUpdated(const QList<int> &groupIds);
+    void receivedGroupsUpdatedFull(const QList<CommHistory::Group> &groups);
+    void receivedGroupsMarkedRead(const QList<int> &groupIds);
+    void receivedGroupsDeleted(const QList<int> &groupIds);
+
+private Q_SLOTS:
+    void busEventsAdded(const QDBusMessage &message);
+    void busEventPropertiesUpdated(const QDBusMessage &message);
+    void busEventDeleted(const QDBusMessage &message);
+    void busEventsDeleted(const QDBusMessage &message);
+    void busGroupsAdded(const QDBusMessage &message);
+    void busGroupsUpdated(const QDBusMessage &message);
+    void busGroupsUpdatedFull(const QDBusMessage &message);
+    void busGroupsMarkedRead(const QDBusMessage &message);
+    void busGroupsDeleted(const QDBusMessage &message);
+
 private:
     UpdatesEmitter();
 
+    bool isOwnMessage(const QDBusMessage &message) const;
+    void connectFeed(const QString &path, bool enable);
+    void updateFeeds();
+
+    void changeQueued();
+    template <typename T>
+    void sendFeed(const QString &signal, const QList<T> &items, const QStringList &paths);
+
     static QWeakPointer<UpdatesEmitter> m_Instance;
+
+    QTimer m_flushTimer;
+    bool m_flushing;
+    bool m_fullEventUpdates;
+    quint64 m_queuedCount;
+    quint64 m_emittedCount;
+
+    QString m_busName;
+    QHash<QString, int> m_subscriptions;
+    QStringList m_connectedFeeds;
+
+    QList<Group> m_groupsAdded;
+    QList<Event> m_eventsAdded;
+    QStringList m_eventsAddedPaths;
+    QList<Event> m_eventsUpdatedFull;
+    QHash<int, int> m_eventsUpdatedFullRows;
+    QList<QByteArray> m_eventsUpdated;
+    QStringList m_eventsUpdatedPaths;
+    QStringList m_eventsUpdatedPreviousPaths;
+    QHash<int, int> m_eventsUpdatedRows;
+    QList<Group> m_groupsUpdatedFull;
+    QHash<int, int> m_groupsUpdatedFullRows;
+    QList<int> m_groupsUpdated;
+    QList<int> m_groupsMarkedRead;
+    QList<int> m_eventsDeleted;
+    QList<QByteArray> m_eventsDeletedStates;
+    QList<int> m_groupsDeleted;
 };
 
 }
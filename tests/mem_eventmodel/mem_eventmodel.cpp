@@ -25,6 +25,8 @@
 #include <malloc.h>
 #include "eventmodel.h"
 #include "callmodel.h"
+#include "conversationmodel.h"
+#include "databaseio.h"
 #include "common.h"
 
 #include "mem_eventmodel.h"
@@ -218,6 +220,58 @@ void MemEventModelTest::callSetFilter()
     MALLINFO_DUMP("don");
 }
 
+void MemEventModelTest::scrollModel()
+{
+    const int eventCount = 2000;
+
+    QList<Event> events;
+    for (int i = 0; i < eventCount; i++) {
+        Event e;
+        e.setGroupId(group.id());
+        e.setType(Event::IMEvent);
+        e.setDirection(i & 1 ? Event::Inbound : Event::Outbound);
+        e.setStartTime(QDateTime::currentDateTime().addSecs(-i));
+        e.setEndTime(e.startTime());
+        e.setLocalUid("/org/freedesktop/Telepathy/Account/gabble/jabber/dut_40localhost0");
+        e.setRemoteUid("td@localhost");
+        e.setFreeText(QString("scroll %1").arg(i));
+        events.append(e);
+    }
+    QVERIFY(DatabaseIO::instance()->addEvents(events));
+
+    MALLINFO_DUMP("start");
+
+    ConversationModel *model = new ConversationModel();
+    model->enableContactChanges(false);
+    model->setQueryMode(EventModel::SyncQuery);
+    QVERIFY(model->getEvents(group.id()));
+    QVERIFY(model->rowCount() >= eventCount);
+
+    MALLINFO_DUMP("model filled");
+
+    // Walk the rows the way a view does while scrolling
+    int rows = model->rowCount();
+    QBENCHMARK {
+        for (int row = 0; row < rows; row++) {
+            QModelIndex index = model->index(row, 0);
+            QCOMPARE(index.row(), row);
+            QVERIFY(!model->parent(index).isValid());
+            model->data(index, Qt::DisplayRole);
+        }
+    }
+
+    int start = model->rowCount() / 2;
+    QModelIndex index = model->findEvent(model->event(model->index(start, 0)).id());
+    QCOMPARE(index.row(), start);
+
+    delete model;
+    MALLINFO_DUMP("del");
+
+    QVERIFY(DatabaseIO::instance()->deleteAllEvents(Event::IMEvent));
+    QTest::qWait(CALM_TIMEOUT);
+    MALLINFO_DUMP("don");
+}
+
 void MemEventModelTest::cleanupTestCase()
 {
     MALLINFO_DUMP("CLEANUP");
@@ -38,6 +38,7 @@ private slots:
     void deleteEvent();
 
     void callSetFilter();
+    void scrollModel();
 
     void cleanupTestCase();
 };
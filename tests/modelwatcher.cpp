@@ -57,8 +57,8 @@ void ModelWatcher::setModel(CommHistory::EventModel *model)
             QString(), QString(), "com.nokia.commhistory", "eventsAdded",
             this, SLOT(eventsAddedSlot(const QList<CommHistory::Event> &)));
         QDBusConnection::sessionBus().connect(
-            QString(), QString(), "com.nokia.commhistory", "eventsUpdated",
-            this, SLOT(eventsUpdatedSlot(const QList<CommHistory::Event> &)));
+            QString(), QString(), "com.nokia.commhistory", "eventPropertiesUpdated",
+            this, SLOT(eventPropertiesUpdatedSlot(const QList<QByteArray> &)));
         QDBusConnection::sessionBus().connect(
             QString(), QString(), "com.nokia.commhistory", "eventDeleted",
             this, SLOT(eventDeletedSlot(int)));
@@ -194,6 +194,14 @@ void ModelWatcher::eventsUpdatedSlot(const QList<CommHistory::Event> &events)
     m_dbusSignalReceived = true;
 }
 
+void ModelWatcher::eventPropertiesUpdatedSlot(const QList<QByteArray> &events)
+{
+    QList<CommHistory::Event> decoded;
+    foreach (const QByteArray &data, events)
+        decoded << CommHistory::Event::decodeProperties(data);
+    eventsUpdatedSlot(decoded);
+}
+
 void ModelWatcher::eventDeletedSlot(int id)
 {
     qDebug() << Q_FUNC_INFO;
@@ -51,6 +51,7 @@ public:
 public Q_SLOTS:
     void eventsAddedSlot(const QList<CommHistory::Event> &events);
     void eventsUpdatedSlot(const QList<CommHistory::Event> &events);
+    void eventPropertiesUpdatedSlot(const QList<QByteArray> &events);
     void eventDeletedSlot(int eventId);
     void eventsCommittedSlot(const QList<CommHistory::Event> &events, bool successful);
     void modelReadySlot(bool success);
@@ -0,0 +1,201 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <cstdlib>
+#include "addeventsperftest.h"
+#include "common.h"
+#include "databaseio.h"
+#include "eventmodel.h"
+
+using namespace CommHistory;
+
+Group group1, group2;
+
+const int TIMEOUT = 5000;
+
+void AddEventsPerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+}
+
+void AddEventsPerfTest::init()
+{
+    deleteAll();
+    QTest::qWait(TIMEOUT);
+    waitForIdle();
+}
+
+QList<Event> AddEventsPerfTest::createEvents(int count, int groupId)
+{
+    QList<Event> events;
+    QDateTime when = QDateTime::currentDateTime();
+
+    for (int i = 0; i < count; i++) {
+        Event e;
+        e.setType(Event::SMSEvent);
+        e.setDirection(qrand() % 2 > 0 ? Event::Inbound : Event::Outbound);
+        e.setGroupId(groupId);
+        e.setStartTime(when.addSecs(i));
+        e.setEndTime(when.addSecs(i));
+        e.setLocalUid(ACCOUNT1);
+        e.setRemoteUid(QString().setNum(qrand() % 10000000));
+        e.setFreeText(randomMessage(qrand() % 49 + 1)); // Max 50 words / message
+        e.setIsDraft(false);
+        e.setIsMissedCall(false);
+        events << e;
+    }
+
+    return events;
+}
+
+void AddEventsPerfTest::addEvents_data()
+{
+    // Number of events added in one call
+    QTest::addColumn<int>("events");
+
+    // Add events one by one instead of using the batched path
+    QTest::addColumn<bool>("single");
+
+    QTest::newRow("100 events, one by one") << 100 << true;
+    QTest::newRow("100 events, batched") << 100 << false;
+    QTest::newRow("1000 events, one by one") << 1000 << true;
+    QTest::newRow("1000 events, batched") << 1000 << false;
+    QTest::newRow("10000 events, one by one") << 10000 << true;
+    QTest::newRow("10000 events, batched") << 10000 << false;
+}
+
+void AddEventsPerfTest::addEvents()
+{
+    QFETCH(int, events);
+    QFETCH(bool, single);
+
+    QDateTime startTime = QDateTime::currentDateTime();
+
+    addTestGroups( group1, group2 );
+
+    int iterations = 10;
+    QList<int> times;
+    int sum = 0;
+
+    #ifdef PERF_ITERATIONS
+    iterations = PERF_ITERATIONS;
+    #endif
+
+    char *iterVar = getenv("PERF_ITERATIONS");
+    if (iterVar) {
+        int iters = QString::fromLatin1(iterVar).toInt();
+        if (iters > 0) {
+            iterations = iters;
+        }
+    }
+
+    DatabaseIO *database = DatabaseIO::instance();
+
+    qDebug() << __FUNCTION__ << "- Adding" << events << "events." << iterations << "iterations";
+    for (int i = 0; i < iterations; i++) {
+        QList<Event> eventList = createEvents(events, group1.id());
+
+        QTime time;
+        time.start();
+
+        if (single) {
+            // The pre-batching behaviour of EventModel::addEvents
+            QVERIFY(database->transaction());
+            for (int j = 0; j < eventList.size(); j++)
+                QVERIFY(database->addEvent(eventList[j]));
+            QVERIFY(database->commit());
+        } else {
+            QVERIFY(database->addEvents(eventList));
+        }
+
+        int elapsed = time.elapsed();
+        times << elapsed;
+        sum += elapsed;
+        qDebug("Time elapsed: %d ms", elapsed);
+
+        foreach (const Event &e, eventList)
+            QVERIFY(e.id() != -1);
+
+        // Start every iteration from an empty table
+        QVERIFY(database->deleteAllEvents(Event::UnknownType));
+        addTestGroups( group1, group2 );
+    }
+
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ", " << iterations << " iterations)"
+            << "\n";
+
+        for (int i = 0; i < times.size(); i++) {
+            out << times.at(i) << " ";
+        }
+        out << "\n";
+    }
+
+    qSort(times);
+    float median = 0.0;
+    if(iterations % 2 > 0) {
+        median = times[(int)(iterations / 2)];
+    } else {
+        median = (times[iterations / 2] + times[iterations / 2 - 1]) / 2.0f;
+    }
+
+    float mean = sum / (float)iterations;
+    float rate = median > 0 ? events * 1000.0f / median : 0;
+    int testSecs = startTime.secsTo(QDateTime::currentDateTime());
+
+    qDebug("##### Mean: %.1f; Median: %.1f; Events/s: %.0f; Test time: %dsec", mean, median, rate, testSecs);
+
+    if(logFile) {
+        QTextStream out(logFile);
+        out << "Median average: " << (int)median << " ms, " << (int)rate << " events/s. Test time: ";
+        if (testSecs > 3600) { out << (testSecs / 3600) << "h "; }
+        if (testSecs > 60) { out << ((testSecs % 3600) / 60) << "m "; }
+        out << ((testSecs % 3600) % 60) << "s\n";
+    }
+}
+
+void AddEventsPerfTest::cleanupTestCase()
+{
+    deleteAll();
+    QTest::qWait(TIMEOUT);
+    waitForIdle();
+
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+QTEST_MAIN(AddEventsPerfTest)
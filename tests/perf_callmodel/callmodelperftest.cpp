@@ -25,6 +25,7 @@
 #include <QDBusConnection>
 #include <cstdlib>
 #include "callmodelperftest.h"
+#include "databaseio.h"
 #include "common.h"
 
 using namespace CommHistory;
@@ -224,6 +225,60 @@ void CallModelPerfTest::getEvents()
     }
 }
 
+void CallModelPerfTest::groupByContact_data()
+{
+    QTest::addColumn<int>("events");
+    QTest::addColumn<int>("numbers");
+
+    QTest::newRow("50000 events, 50 numbers") << 50000 << 50;
+    QTest::newRow("50000 events, 5000 numbers") << 50000 << 5000;
+}
+
+void CallModelPerfTest::groupByContact()
+{
+    QFETCH(int, events);
+    QFETCH(int, numbers);
+
+    // Calls to each number use both the local and the international
+    // form, so grouping has to match them by their short form
+    QStringList localNumbers;
+    QStringList internationalNumbers;
+    for (int i = 0; i < numbers; i++) {
+        QString subscriber = QString::number(1000000 + i);
+        localNumbers << QString("050") + subscriber;
+        internationalNumbers << QString("+35850") + subscriber;
+    }
+
+    QDateTime when = QDateTime::currentDateTime().addSecs(-events);
+    QList<Event> eventList;
+    for (int i = 0; i < events; i++) {
+        int number = qrand() % numbers;
+
+        Event e;
+        e.setType(Event::CallEvent);
+        e.setDirection(i % 2 ? Event::Inbound : Event::Outbound);
+        e.setGroupId(-1);
+        e.setStartTime(when.addSecs(i));
+        e.setEndTime(when.addSecs(i));
+        e.setLocalUid(RING_ACCOUNT);
+        e.setRemoteUid(qrand() % 2 ? localNumbers.at(number) : internationalNumbers.at(number));
+        e.setIsMissedCall(i % 5 == 0);
+        eventList << e;
+    }
+    QVERIFY(DatabaseIO::instance()->addEvents(eventList));
+    eventList.clear();
+    waitForIdle();
+
+    QBENCHMARK {
+        CallModel model;
+        model.enableContactChanges(false);
+        model.setQueryMode(EventModel::SyncQuery);
+        model.setFilter(CallModel::SortByContact);
+        QVERIFY(model.getEvents());
+        QVERIFY(model.rowCount() > 0);
+    }
+}
+
 void CallModelPerfTest::cleanupTestCase()
 {
     deleteAll();
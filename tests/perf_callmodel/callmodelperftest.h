@@ -40,6 +40,8 @@ private slots:
     void init();
     void getEvents_data();
     void getEvents();
+    void groupByContact_data();
+    void groupByContact();
     void cleanupTestCase();
 
 private:
@@ -0,0 +1,246 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QDateTime>
+#include <cstdlib>
+#include "concurrentreadsperftest.h"
+#include "common.h"
+#include "databaseio.h"
+#include "groupmanager.h"
+#include "groupobject.h"
+#include "conversationmodel.h"
+
+using namespace CommHistory;
+
+const int TIMEOUT = 5000;
+
+ReaderThread::ReaderThread(const QList<int> &groupIds, QObject *parent)
+    : QThread(parent),
+      reads(0),
+      errors(0),
+      m_groupIds(groupIds),
+      m_stop(0)
+{
+}
+
+void ReaderThread::stop()
+{
+    m_stop.fetchAndStoreOrdered(1);
+}
+
+void ReaderThread::run()
+{
+    while (m_stop.fetchAndAddOrdered(0) == 0) {
+        if (!readOnce())
+            errors++;
+        reads++;
+    }
+
+    // One more pass after the writer has finished, to compare the
+    // final counts
+    if (!readOnce())
+        errors++;
+}
+
+bool ReaderThread::readOnce()
+{
+    // Models are created in this thread, so their queries run on the
+    // read connection of this thread.
+    GroupManager manager;
+    manager.enableContactChanges(false);
+    manager.setQueryMode(EventModel::SyncQuery);
+    if (!manager.getGroups()) {
+        qWarning() << "getGroups failed";
+        return false;
+    }
+
+    if (manager.groups().size() != m_groupIds.size()) {
+        qWarning() << "Unexpected number of groups" << manager.groups().size();
+        return false;
+    }
+
+    int groupId = m_groupIds.at(qrand() % m_groupIds.size());
+    int total = manager.group(groupId) ? manager.group(groupId)->totalMessages() : -1;
+    if (total < eventCounts.value(groupId)) {
+        qWarning() << "Group" << groupId << "total went back from"
+                   << eventCounts.value(groupId) << "to" << total;
+        return false;
+    }
+
+    ConversationModel model;
+    model.enableContactChanges(false);
+    model.setQueryMode(EventModel::SyncQuery);
+    if (!model.getEvents(groupId)) {
+        qWarning() << "getEvents failed";
+        return false;
+    }
+
+    // Events are only added, so a later snapshot can not have less
+    if (model.rowCount() < total) {
+        qWarning() << "Group" << groupId << "has" << model.rowCount()
+                   << "events, group stats had" << total;
+        return false;
+    }
+
+    eventCounts.insert(groupId, model.rowCount());
+    return true;
+}
+
+void ConcurrentReadsPerfTest::initTestCase()
+{
+    logFile = new QFile("libcommhistory-performance-test.log");
+    if(!logFile->open(QIODevice::Append)) {
+        qDebug() << "!!!! Failed to open log file !!!!";
+        logFile = 0;
+    }
+
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+}
+
+void ConcurrentReadsPerfTest::init()
+{
+    deleteAll();
+    QTest::qWait(TIMEOUT);
+    waitForIdle();
+}
+
+void ConcurrentReadsPerfTest::readWhileWriting_data()
+{
+    QTest::addColumn<int>("readers");
+    QTest::addColumn<int>("groups");
+    QTest::addColumn<int>("batches");
+
+    QTest::newRow("1 reader, 10 groups") << 1 << 10 << 200;
+    QTest::newRow("4 readers, 10 groups") << 4 << 10 << 200;
+    QTest::newRow("8 readers, 50 groups") << 8 << 50 << 200;
+}
+
+void ConcurrentReadsPerfTest::readWhileWriting()
+{
+    QFETCH(int, readers);
+    QFETCH(int, groups);
+    QFETCH(int, batches);
+
+    const int batchSize = 10;
+
+    DatabaseIO *database = DatabaseIO::instance();
+    QDateTime when = QDateTime::currentDateTime();
+
+    QList<int> groupIds;
+    for (int gi = 0; gi < groups; gi++) {
+        Group grp;
+        grp.setLocalUid(ACCOUNT1);
+        grp.setRemoteUids(QStringList() << QString().setNum(qrand() % 10000000));
+        QVERIFY(database->addGroup(grp));
+        groupIds << grp.id();
+    }
+
+    QList<ReaderThread *> threads;
+    for (int i = 0; i < readers; i++) {
+        ReaderThread *thread = new ReaderThread(groupIds, this);
+        threads << thread;
+        thread->start();
+    }
+
+    qDebug() << __FUNCTION__ << "- Adding" << batches * batchSize << "events with"
+             << readers << "concurrent readers";
+
+    // All writes go through the writer connection of this thread
+    QHash<int, int> eventCounts;
+    QTime time;
+    time.start();
+    for (int b = 0; b < batches; b++) {
+        int groupId = groupIds.at(qrand() % groupIds.size());
+
+        QList<Event> eventList;
+        for (int i = 0; i < batchSize; i++) {
+            Event e;
+            e.setType(Event::SMSEvent);
+            e.setDirection(qrand() % 2 ? Event::Inbound : Event::Outbound);
+            e.setGroupId(groupId);
+            e.setStartTime(when.addSecs(b * batchSize + i));
+            e.setEndTime(when.addSecs(b * batchSize + i));
+            e.setLocalUid(ACCOUNT1);
+            e.setRemoteUid(QString().setNum(qrand() % 10000000));
+            e.setFreeText(randomMessage(qrand() % 9 + 1));
+            eventList << e;
+        }
+
+        QVERIFY(database->addEvents(eventList));
+        eventCounts[groupId] += batchSize;
+    }
+    int writeElapsed = time.elapsed();
+
+    foreach (ReaderThread *thread, threads)
+        thread->stop();
+
+    int reads = 0;
+    int errors = 0;
+    foreach (ReaderThread *thread, threads) {
+        QVERIFY(thread->wait(60000));
+        reads += thread->reads;
+        errors += thread->errors;
+
+        // The last pass ran after all writes were committed
+        QHash<int, int>::const_iterator it = thread->eventCounts.constBegin();
+        for (; it != thread->eventCounts.constEnd(); ++it)
+            QVERIFY(it.value() <= eventCounts.value(it.key()));
+    }
+    int readElapsed = time.elapsed();
+
+    qDeleteAll(threads);
+
+    QCOMPARE(errors, 0);
+    QVERIFY(database->checkGroupStats());
+
+    float writeRate = batches * batchSize * 1000.0f / qMax(writeElapsed, 1);
+    float readRate = reads * 1000.0f / qMax(readElapsed, 1);
+
+    qDebug("##### Inserts: %.1f/s; Reads: %.1f/s (%d readers)", writeRate, readRate, readers);
+
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ")"
+            << "\n";
+        out << "Inserts: " << (int)writeRate << "/s. Reads: " << (int)readRate << "/s. "
+            << reads << " reads in " << readElapsed << " ms.\n";
+    }
+}
+
+void ConcurrentReadsPerfTest::cleanupTestCase()
+{
+    deleteAll();
+    QTest::qWait(TIMEOUT);
+    waitForIdle();
+
+    if(logFile) {
+        logFile->close();
+        delete logFile;
+        logFile = 0;
+    }
+}
+
+QTEST_MAIN(ConcurrentReadsPerfTest)
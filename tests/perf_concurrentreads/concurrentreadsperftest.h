@@ -0,0 +1,76 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#ifndef CONCURRENTREADSPERFTEST_H
+#define CONCURRENTREADSPERFTEST_H
+
+#include <QObject>
+#include <QFile>
+#include <QThread>
+#include <QAtomicInt>
+#include "event.h"
+
+using namespace CommHistory;
+
+/*
+ * Reads groups and conversations in a loop from its own thread, checking
+ * that every snapshot it sees only grows while events are being added.
+ */
+class ReaderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    ReaderThread(const QList<int> &groupIds, QObject *parent = 0);
+
+    void stop();
+
+    int reads;
+    int errors;
+    QHash<int, int> eventCounts;
+
+protected:
+    void run();
+
+private:
+    bool readOnce();
+
+    QList<int> m_groupIds;
+    QAtomicInt m_stop;
+};
+
+class ConcurrentReadsPerfTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void readWhileWriting_data();
+    void readWhileWriting();
+    void cleanupTestCase();
+
+private:
+    QFile *logFile;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/******************************************************************************
+**
+** This file is part of libcommhistory.
+**
+** Copyright (C) 2013 Jolla Ltd.
+** Contact: John Brooks <john.brooks@jollamobile.com>
+**
+** This library is free software; you can redistribute it and/or modify it
+** under the terms of the GNU Lesser General Public License version 2.1 as
+** published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+** or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+** License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this library; if not, write to the Free Software Foundation, Inc.,
+** 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+**
+******************************************************************************/
+
+#include <QtTest/QtTest>
+#include "eventperftest.h"
+#include "common.h"
+#include "conversationmodel.h"
+#include "databaseio.h"
+
+using namespace CommHistory;
+
+namespace {
+
+Group group;
+
+Event createEvent(int i)
+{
+    Event e;
+    e.setType(Event::SMSEvent);
+    e.setDirection(i & 1 ? Event::Inbound : Event::Outbound);
+    e.setGroupId(group.id());
+    e.setStartTime(QDateTime::currentDateTime().addSecs(-i));
+    e.setEndTime(e.startTime());
+    e.setLocalUid(ACCOUNT1);
+    e.setRemoteUid("+15551234567");
+    e.setFreeText(QString("perf event %1").arg(i));
+    e.setIsRead(true);
+    return e;
+}
+
+}
+
+void EventPerfTest::initTestCase()
+{
+    deleteAll();
+}
+
+void EventPerfTest::construct()
+{
+    // Every setter marks its property valid and modified
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++) {
+            Event e = createEvent(i);
+            QVERIFY(e.validProperties().contains(Event::FreeText));
+        }
+    }
+}
+
+void EventPerfTest::copyAndDetach()
+{
+    Event original = createEvent(0);
+    original.resetModifiedProperties();
+
+    // The first write to a copy detaches the shared data, including
+    // both property sets
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++) {
+            Event copy = original;
+            copy.setIsRead(false);
+            QVERIFY(copy.modifiedProperties().contains(Event::IsRead));
+        }
+    }
+}
+
+void EventPerfTest::propertySets()
+{
+    Event::PropertySet unused = Event::PropertySet()
+        << Event::IsDraft
+        << Event::FreeText
+        << Event::MessageToken
+        << Event::MessageParts;
+    Event event = createEvent(0);
+
+    // Mask calculation and copyValidProperties() as done by the models
+    QBENCHMARK {
+        for (int i = 0; i < 1000; i++) {
+            Event::PropertySet mask = Event::allProperties();
+            mask -= unused;
+            QCOMPARE(mask.count(), Event::NumProperties - 4);
+
+            Event copy;
+            copy.copyValidProperties(event);
+        }
+    }
+}
+
+void EventPerfTest::readEvents_data()
+{
+    QTest::addColumn<int>("events");
+
+    QTest::newRow("100 events") << 100;
+    QTest::newRow("1000 events") << 1000;
+    QTest::newRow("5000 events") << 5000;
+}
+
+void EventPerfTest::readEvents()
+{
+    QFETCH(int, events);
+
+    // Deleting the events also removes the group, so add it for every row
+    addTestGroup(group, ACCOUNT1, "+15551234567");
+    QVERIFY(group.id() != -1);
+
+    QList<Event> eventList;
+    for (int i = 0; i < events; i++)
+        eventList.append(createEvent(i));
+    QVERIFY(DatabaseIO::instance()->addEvents(eventList));
+
+    // Filling the model goes through readEventResult() for every row
+    QBENCHMARK {
+        ConversationModel model;
+        model.enableContactChanges(false);
+        model.setQueryMode(EventModel::SyncQuery);
+        QVERIFY(model.getEvents(group.id()));
+        QCOMPARE(model.rowCount(), events);
+    }
+
+    QVERIFY(DatabaseIO::instance()->deleteAllEvents(Event::SMSEvent));
+}
+
+void EventPerfTest::cleanupTestCase()
+{
+    deleteAll();
+}
+
+QTEST_MAIN(EventPerfTest)
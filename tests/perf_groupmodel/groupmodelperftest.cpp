@@ -27,6 +27,7 @@
 #include <cstdlib>
 #include "groupmodelperftest.h"
 #include "common.h"
+#include "databaseio.h"
 
 using namespace CommHistory;
 
@@ -215,6 +216,131 @@ void GroupModelPerfTest::getGroups()
     }
 }
 
+void GroupModelPerfTest::getGroupsLargeDatabase_data()
+{
+    QTest::addColumn<int>("groups");
+    QTest::addColumn<int>("messages");
+
+    QTest::newRow("50 groups, 10000 messages each") << 50 << 10000;
+    QTest::newRow("500 groups, 1000 messages each") << 500 << 1000;
+}
+
+void GroupModelPerfTest::getGroupsLargeDatabase()
+{
+    QDateTime startTime = QDateTime::currentDateTime();
+
+    QFETCH(int, groups);
+    QFETCH(int, messages);
+
+    DatabaseIO *database = DatabaseIO::instance();
+    QDateTime when = QDateTime::currentDateTime();
+
+    qDebug() << __FUNCTION__ << "- Creating" << groups << "groups with"
+             << messages << "messages each";
+
+    for (int gi = 0; gi < groups; gi++) {
+        Group grp;
+        grp.setLocalUid(ACCOUNT1);
+        grp.setRemoteUids(QStringList() << QString().setNum(qrand() % 10000000));
+        QVERIFY(database->addGroup(grp));
+
+        // Bypass the models; only the database size matters here
+        QList<Event> eventList;
+        for (int i = 0; i < messages; i++) {
+            Event e;
+            e.setType(Event::SMSEvent);
+            e.setDirection(qrand() % 2 ? Event::Inbound : Event::Outbound);
+            e.setGroupId(grp.id());
+            e.setStartTime(when.addSecs(i));
+            e.setEndTime(when.addSecs(i));
+            e.setLocalUid(ACCOUNT1);
+            e.setRemoteUid(grp.remoteUids().at(0));
+            e.setFreeText(randomMessage(qrand() % 9 + 1));
+            e.setIsRead(qrand() % 2);
+            eventList << e;
+        }
+        QVERIFY(database->addEvents(eventList));
+    }
+
+    int iterations = 10;
+    int sum = 0;
+    QList<int> times;
+
+    #ifdef PERF_ITERATIONS
+    iterations = PERF_ITERATIONS;
+    #endif
+
+    char *iterVar = getenv("PERF_ITERATIONS");
+    if (iterVar) {
+        int iters = QString::fromLatin1(iterVar).toInt();
+        if (iters > 0) {
+            iterations = iters;
+        }
+    }
+
+    qDebug() << __FUNCTION__ << "- Fetching groups." << iterations << "iterations";
+    for(int i = 0; i < iterations; i++) {
+        QList<Group> result;
+
+        QTime time;
+        time.start();
+        QVERIFY(database->getGroups(QString(), QString(), result));
+        int elapsed = time.elapsed();
+        times << elapsed;
+        sum += elapsed;
+        qDebug("Time elapsed: %d ms", elapsed);
+
+        QCOMPARE(result.size(), groups);
+    }
+
+    QTime checkTime;
+    checkTime.start();
+    QVERIFY(database->checkGroupStats());
+    int checkElapsed = checkTime.elapsed();
+
+    QTime rebuildTime;
+    rebuildTime.start();
+    QVERIFY(database->rebuildGroupStats());
+    int rebuildElapsed = rebuildTime.elapsed();
+
+    if(logFile) {
+        QTextStream out(logFile);
+
+        out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") << ": "
+            << metaObject()->className() << "::" << QTest::currentTestFunction() << "("
+            << QTest::currentDataTag() << ", " << iterations << " iterations)"
+            << "\n";
+
+        for (int i = 0; i < times.size(); i++) {
+            out << times.at(i) << " ";
+        }
+        out << "\n";
+    }
+
+    qSort(times);
+    float median = 0.0;
+    if(iterations % 2 > 0) {
+        median = times[(int)(iterations / 2)];
+    } else {
+        median = (times[iterations / 2] + times[iterations / 2 - 1]) / 2.0f;
+    }
+
+    float mean = sum / (float)iterations;
+    int testSecs = startTime.secsTo(QDateTime::currentDateTime());
+
+    qDebug("##### Mean: %.1f; Median: %.1f; Check: %d ms; Rebuild: %d ms; Test time: %dsec",
+           mean, median, checkElapsed, rebuildElapsed, testSecs);
+
+    if(logFile) {
+        QTextStream out(logFile);
+        out << "Median average: " << (int)median << " ms. Check: " << checkElapsed
+            << " ms. Rebuild: " << rebuildElapsed << " ms. Test time: ";
+        if (testSecs > 3600) { out << (testSecs / 3600) << "h "; }
+        if (testSecs > 60) { out << ((testSecs % 3600) / 60) << "m "; }
+        out << ((testSecs % 3600) % 60) << "s\n";
+    }
+}
+
 void GroupModelPerfTest::cleanupTestCase()
 {
     deleteAll();
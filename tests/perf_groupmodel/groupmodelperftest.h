@@ -40,6 +40,8 @@ private slots:
     void init();
     void getGroups_data();
     void getGroups();
+    void getGroupsLargeDatabase_data();
+    void getGroupsLargeDatabase();
     void cleanupTestCase();
 
 private:
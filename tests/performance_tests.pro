@@ -23,8 +23,11 @@
 !include( ../common-vars.pri ):error( "Unable to install common-vars.pri" )
 
 TEMPLATE = subdirs
-SUBDIRS = perf_callmodel \
+SUBDIRS = perf_addevents \
+		  perf_callmodel \
+		  perf_concurrentreads \
 		  perf_conversationmodel \
+		  perf_event \
 		  perf_groupmodel
 
 # make sure the destination path exists
@@ -41,12 +44,19 @@ SUBDIRS = perf_callmodel \
      error("Error running do_tests_xml.sh")
 QMAKE_CLEAN += $${OUT_PWD}/perf_bin/tests.xml
 
+#-----------------------------------------------------------------------------
+# benchmark: run all performance tests with each database tuning profile
+#-----------------------------------------------------------------------------
+benchmark.commands = $${PWD}/run_profile_benchmarks.sh $${OUT_PWD}/perf_bin
+QMAKE_EXTRA_TARGETS += benchmark
+
 #-----------------------------------------------------------------------------
 # installation setup
 #-----------------------------------------------------------------------------
 !include( ../common-installs-config.pri ) : \
          error( "Unable to include common-installs-config.pri!" )
 perftests.files = $${OUT_PWD}/perf_bin/* \
-                  run_all_performance_tests.sh
+                  run_all_performance_tests.sh \
+                  run_profile_benchmarks.sh
 perftests.path  = /opt/tests/$${PROJECT_NAME}-performance-tests
 INSTALLS += perftests
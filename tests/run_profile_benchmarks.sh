@@ -0,0 +1,47 @@
+#!/bin/sh
+###############################################################################
+#
+# This file is part of libcommhistory.
+#
+# Copyright (C) 2010 Nokia Corporation and/or its subsidiary(-ies).
+# Contact: Reto Zingg <reto.zingg@nokia.com>
+#
+# This library is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License version 2.1 as
+# published by the Free Software Foundation.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+# License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this library; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+#
+###############################################################################
+
+# Runs the performance tests once per database tuning profile (see
+# db_profiles in src/commhistorydatabase.cpp). Results are appended to
+# libcommhistory-performance-test.log in the current directory.
+#
+# usage: run_profile_benchmarks.sh [test dir] [profile...]
+
+TESTDIR=${1:-/opt/tests/libcommhistory-performance-tests}
+[ $# -gt 0 ] && shift
+PROFILES=${*:-"sqlite default lowmem performance"}
+LOG=libcommhistory-performance-test.log
+
+result=0
+for profile in $PROFILES; do
+  echo "##### Database profile: $profile" | tee -a $LOG
+  for f in $TESTDIR/perf_*; do
+    [ -x "$f" ] || continue
+    if ! COMMHISTORY_DATABASE_PROFILE=$profile $f -maxwarnings 0; then
+      echo "$f failed with profile $profile"
+      result=1
+    fi
+  done
+done
+
+exit $result
@@ -878,6 +878,216 @@ void CallModelTest::testSIPAddress()
     deleteTestContact(contactId2);
 }
 
+void CallModelTest::testFindEvent()
+{
+    deleteAll();
+
+    CallModel model;
+    model.setQueryMode(EventModel::SyncQuery);
+    model.enableContactChanges(false);
+    watcher.setModel(&model);
+
+    QString account("/org/freedesktop/Telepathy/Account/ring/tel/ring");
+    QDateTime when = QDateTime::currentDateTime();
+    QStringList numbers;
+    numbers << "0501234567" << "0507654321" << "0509876543";
+    for (int i = 0; i < 9; i++) {
+        addTestEvent(model, Event::CallEvent, i % 2 ? Event::Inbound : Event::Outbound, account,
+                     -1, "", false, false, when.addSecs(i), numbers.at(i % numbers.size()));
+        QVERIFY(watcher.waitForAdded());
+    }
+
+    // Grouped events are found at (group row, position in group), and
+    // groups in preference to their first event
+    QVERIFY(model.setFilter(CallModel::SortByContact));
+    QVERIFY(model.getEvents());
+    QCOMPARE(model.rowCount(), numbers.size());
+    for (int row = 0; row < model.rowCount(); row++) {
+        QModelIndex group = model.index(row, 0);
+        QModelIndex index = model.findEvent(model.event(group).id());
+        QCOMPARE(index.row(), row);
+        QCOMPARE(index.column(), 0);
+        QCOMPARE(index.internalPointer(), group.internalPointer());
+
+        for (int i = 1; i < model.rowCount(group); i++) {
+            int id = model.event(model.index(i, 0, group)).id();
+            index = model.findEvent(id);
+            QCOMPARE(index.row(), row);
+            QCOMPARE(index.column(), i);
+            QCOMPARE(model.event(model.index(i, 0, group)).id(), id);
+        }
+    }
+
+    model.setTreeMode(false);
+    QVERIFY(model.getEvents());
+    QCOMPARE(model.rowCount(), 9);
+    for (int row = 0; row < model.rowCount(); row++) {
+        QModelIndex index = model.findEvent(model.event(model.index(row, 0)).id());
+        QCOMPARE(index.row(), row);
+        QCOMPARE(model.event(index).id(), model.event(model.index(row, 0)).id());
+    }
+
+    // Deleted events are no longer found
+    int id = model.event(model.index(0, 0)).id();
+    QVERIFY(model.deleteEvent(id));
+    QVERIFY(watcher.waitForDeleted());
+    QVERIFY(!model.findEvent(id).isValid());
+    QVERIFY(!model.findEvent(-1).isValid());
+}
+
+void CallModelTest::testColumnStorage()
+{
+    deleteAll();
+
+    CallModel model;
+    model.setQueryMode(EventModel::SyncQuery);
+    model.enableContactChanges(false);
+    model.setTreeMode(false);
+    watcher.setModel(&model);
+
+    QDateTime when = QDateTime::currentDateTime();
+    QStringList numbers;
+    numbers << "0501234567" << "0507654321" << "0509876543";
+    for (int i = 0; i < 6; i++) {
+        addTestEvent(model, Event::CallEvent, i % 2 ? Event::Inbound : Event::Outbound, ACCOUNT1,
+                     -1, "", false, i == 3, when.addSecs(i), numbers.at(i % numbers.size()));
+        QVERIFY(watcher.waitForAdded());
+    }
+
+    CallModel columnModel;
+    columnModel.setQueryMode(EventModel::SyncQuery);
+    columnModel.enableContactChanges(false);
+    columnModel.setTreeMode(false);
+    columnModel.setColumnStorage(true);
+    QVERIFY(columnModel.columnStorage());
+
+    QVERIFY(model.getEvents());
+    QVERIFY(columnModel.getEvents());
+    QCOMPARE(columnModel.rowCount(), 6);
+    QCOMPARE(columnModel.rowCount(), model.rowCount());
+
+    // Rows read from columns match the events of a regular model
+    for (int row = 0; row < model.rowCount(); row++) {
+        for (int column = 0; column < EventModel::NumberOfColumns; column++) {
+            if (column == EventModel::Contacts)
+                continue;
+            QCOMPARE(columnModel.index(row, column).data(), model.index(row, column).data());
+        }
+        QCOMPARE(columnModel.index(row, 0).data(EventModel::BaseRole + EventModel::RemoteUid),
+                 model.index(row, 0).data(EventModel::BaseRole + EventModel::RemoteUid));
+        QVERIFY(!columnModel.parent(columnModel.index(row, 0)).isValid());
+        QVERIFY(!columnModel.hasChildren(columnModel.index(row, 0)));
+
+        Event e = columnModel.event(columnModel.index(row, 0));
+        Event expected = model.event(model.index(row, 0));
+        QCOMPARE(e.id(), expected.id());
+        QCOMPARE(e.startTime(), expected.startTime());
+        QCOMPARE(e.direction(), expected.direction());
+        QCOMPARE(e.isMissedCall(), expected.isMissedCall());
+        QCOMPARE(e.remoteUid(), expected.remoteUid());
+        QCOMPARE(columnModel.index(row, 0).data(Qt::UserRole).value<Event>().id(), e.id());
+
+        QModelIndex index = columnModel.findEvent(e.id());
+        QCOMPARE(index.row(), row);
+        QCOMPARE(columnModel.event(index).id(), e.id());
+    }
+    QVERIFY(!columnModel.findEvent(-1).isValid());
+
+    // Changes convert the rows to events; persistent indexes follow them
+    Event e = columnModel.event(columnModel.index(2, 0));
+    QPersistentModelIndex persistent(columnModel.index(2, 0));
+    e.setIsRead(!e.isRead());
+    watcher.setModel(&columnModel);
+    QVERIFY(columnModel.modifyEvent(e));
+    QVERIFY(watcher.waitForUpdated());
+
+    QCOMPARE(columnModel.rowCount(), 6);
+    QCOMPARE(persistent.row(), 2);
+    QCOMPARE(columnModel.event(persistent).id(), e.id());
+    QCOMPARE(columnModel.event(persistent).isRead(), e.isRead());
+    QCOMPARE(columnModel.findEvent(e.id()).row(), 2);
+
+    QVERIFY(columnModel.deleteEvent(e.id()));
+    QVERIFY(watcher.waitForDeleted());
+    QCOMPARE(columnModel.rowCount(), 5);
+    QVERIFY(!columnModel.findEvent(e.id()).isValid());
+}
+
+void CallModelTest::testDatabaseGrouping_data()
+{
+    QTest::addColumn<int>("sorting");
+
+    QTest::newRow("by contact") << (int)CallModel::SortByContact;
+    QTest::newRow("by contact and type") << (int)CallModel::SortByContactAndType;
+}
+
+void CallModelTest::testDatabaseGrouping()
+{
+    QFETCH(int, sorting);
+
+    deleteAll();
+
+    CallModel model;
+    model.setQueryMode(EventModel::SyncQuery);
+    model.enableContactChanges(false);
+    watcher.setModel(&model);
+
+    QDateTime when = QDateTime::currentDateTime();
+    QStringList numbers;
+    numbers << "0501234567" << "+358501234567" << "0507654321" << "0509876543";
+    for (int i = 0; i < 12; i++) {
+        bool missed = i % 3 == 0;
+        addTestEvent(model, Event::CallEvent, missed || i % 2 ? Event::Inbound : Event::Outbound, ACCOUNT1,
+                     -1, "", false, missed, when.addSecs(i), numbers.at(i % numbers.size()));
+        QVERIFY(watcher.waitForAdded());
+    }
+
+    CallModel groupedModel;
+    groupedModel.setQueryMode(EventModel::SyncQuery);
+    groupedModel.enableContactChanges(false);
+    groupedModel.setDatabaseGrouping(true);
+    QVERIFY(groupedModel.databaseGrouping());
+
+    QVERIFY(model.getEvents((CallModel::Sorting)sorting));
+    QVERIFY(groupedModel.getEvents((CallModel::Sorting)sorting));
+    QVERIFY(groupedModel.rowCount() > 1);
+    QCOMPARE(groupedModel.rowCount(), model.rowCount());
+
+    // The same groups, with calls read on demand
+    for (int row = 0; row < model.rowCount(); row++) {
+        QModelIndex index = model.index(row, 0);
+        QModelIndex groupedIndex = groupedModel.index(row, 0);
+        QCOMPARE(groupedModel.event(groupedIndex).id(), model.event(index).id());
+        QCOMPARE(groupedModel.event(groupedIndex).eventCount(), model.event(index).eventCount());
+
+        QVERIFY(groupedModel.hasChildren(groupedIndex));
+        QVERIFY(groupedModel.canFetchMore(groupedIndex));
+        QCOMPARE(groupedModel.rowCount(groupedIndex), 0);
+
+        groupedModel.fetchMore(groupedIndex);
+        QVERIFY(!groupedModel.canFetchMore(groupedIndex));
+        QCOMPARE(groupedModel.rowCount(groupedIndex), model.rowCount(index));
+        for (int i = 0; i < model.rowCount(index); i++) {
+            QCOMPARE(groupedModel.event(groupedModel.index(i, 0, groupedIndex)).id(),
+                     model.event(model.index(i, 0, index)).id());
+        }
+    }
+
+    // A new call to an unfetched group updates the row
+    QVERIFY(groupedModel.getEvents());
+    watcher.setModel(&groupedModel);
+    QModelIndex last = groupedModel.index(groupedModel.rowCount() - 1, 0);
+    Event e = groupedModel.event(last);
+    addTestEvent(groupedModel, Event::CallEvent, e.direction(), ACCOUNT1, -1, "", false,
+                 e.isMissedCall(), when.addSecs(20), e.remoteUid());
+    QVERIFY(watcher.waitForAdded());
+    QModelIndex top = groupedModel.index(0, 0);
+    QCOMPARE(groupedModel.event(top).startTime().toTime_t(), when.addSecs(20).toTime_t());
+    QVERIFY(groupedModel.canFetchMore(top));
+    groupedModel.fetchMore(top);
+    QCOMPARE(groupedModel.event(groupedModel.index(0, 0, top)).id(), groupedModel.event(top).id());
+}
+
 void CallModelTest::deleteAllCalls()
 {
     CallModel model;
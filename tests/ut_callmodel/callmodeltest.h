@@ -45,6 +45,10 @@ private slots:
     void testSortByContactUpdate();
     void testSortByTimeUpdate();
     void testSIPAddress();
+    void testFindEvent();
+    void testColumnStorage();
+    void testDatabaseGrouping_data();
+    void testDatabaseGrouping();
     void testLimit();
     void deleteAllCalls();
     void testMarkAllRead();
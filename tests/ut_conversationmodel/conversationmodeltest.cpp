@@ -27,6 +27,7 @@
 #include "conversationmodel.h"
 #include "adaptor.h"
 #include "event.h"
+#include "constants.h"
 #include "common.h"
 #include "databaseio.h"
 #include "modelwatcher.h"
@@ -363,6 +364,87 @@ void ConversationModelTest::sorting()
     QCOMPARE(conv.event(conv.index(4, 0)).freeText(), QLatin1String("I"));
 }
 
+void ConversationModelTest::fetchMore()
+{
+    Group group;
+    addTestGroup(group, ACCOUNT1, "fetchmore@localhost");
+
+    EventModel model;
+    model.enableContactChanges(false);
+    watcher.setModel(&model);
+
+    // 12 events, two of them sharing each end time
+    QDateTime when = QDateTime::currentDateTime();
+    for (int i = 0; i < 12; i++) {
+        addTestEvent(model, Event::SMSEvent, Event::Inbound, ACCOUNT1,
+                     group.id(), QString::number(i), false, false, when.addSecs(i / 2));
+    }
+    QVERIFY(watcher.waitForAdded(12));
+
+    ConversationModel conv;
+    conv.setQueryMode(EventModel::StreamedAsyncQuery);
+    conv.setFirstChunkSize(3);
+    conv.setChunkSize(4);
+    conv.enableContactChanges(false);
+    QSignalSpy modelReady(&conv, SIGNAL(modelReady(bool)));
+
+    QVERIFY(conv.getEvents(group.id()));
+    QCOMPARE(conv.rowCount(), 3);
+    QVERIFY(conv.canFetchMore(QModelIndex()));
+    QVERIFY(modelReady.isEmpty());
+
+    conv.fetchMore(QModelIndex());
+    QCOMPARE(conv.rowCount(), 7);
+    QVERIFY(conv.canFetchMore(QModelIndex()));
+
+    conv.fetchMore(QModelIndex());
+    QCOMPARE(conv.rowCount(), 11);
+    QVERIFY(conv.canFetchMore(QModelIndex()));
+
+    conv.fetchMore(QModelIndex());
+    QCOMPARE(conv.rowCount(), 12);
+    QVERIFY(!conv.canFetchMore(QModelIndex()));
+    QCOMPARE(modelReady.count(), 1);
+
+    // Newest first, with no events skipped or repeated across chunks
+    for (int i = 0; i < 12; i++)
+        QCOMPARE(conv.event(conv.index(i, 0)).freeText(), QString::number(11 - i));
+
+    // No chunk size fetches everything at once
+    ConversationModel unbounded;
+    unbounded.setQueryMode(EventModel::StreamedAsyncQuery);
+    unbounded.setChunkSize(0);
+    unbounded.enableContactChanges(false);
+    QSignalSpy unboundedReady(&unbounded, SIGNAL(modelReady(bool)));
+
+    QVERIFY(unbounded.getEvents(group.id()));
+    QCOMPARE(unbounded.rowCount(), 12);
+    QVERIFY(!unbounded.canFetchMore(QModelIndex()));
+    QCOMPARE(unboundedReady.count(), 1);
+
+    // A query cancelled by changing the thread does not block fetchMore()
+    ConversationModel cancelled;
+    cancelled.setQueryMode(EventModel::StreamedAsyncQuery);
+    cancelled.setFirstChunkSize(3);
+    cancelled.setChunkSize(4);
+    cancelled.enableContactChanges(false);
+    QVERIFY(cancelled.getEvents(group.id()));
+    QCOMPARE(cancelled.rowCount(), 3);
+
+    QThread thread;
+    thread.start();
+    cancelled.setBackgroundThread(&thread);
+    cancelled.fetchMore(QModelIndex());
+    cancelled.setBackgroundThread(0);
+    QVERIFY(cancelled.canFetchMore(QModelIndex()));
+    cancelled.fetchMore(QModelIndex());
+    QCOMPARE(cancelled.rowCount(), 7);
+    QTest::qWait(100);
+    QCOMPARE(cancelled.rowCount(), 7);
+    thread.quit();
+    thread.wait();
+}
+
 void ConversationModelTest::contacts_data()
 {
     QTest::addColumn<QString>("localId");
@@ -434,6 +516,130 @@ void ConversationModelTest::contacts()
     deleteTestContact(contactId);
 }
 
+void ConversationModelTest::propertyMask()
+{
+    ConversationModel model;
+    model.enableContactChanges(false);
+    model.setQueryMode(EventModel::SyncQuery);
+
+    Event::PropertySet p = Event::allProperties();
+    p.remove(Event::FreeText);
+    p.remove(Event::Subject);
+    model.setPropertyMask(p);
+
+    // Masked properties are not read, but the model still gets what it
+    // needs for sorting
+    QVERIFY(model.getEvents(group1.id()));
+    QVERIFY(model.rowCount() > 0);
+    for (int i = 0; i < model.rowCount(); i++) {
+        Event e = model.event(model.index(i, 0));
+        QVERIFY(e.id() != -1);
+        QVERIFY(e.endTime().isValid());
+        QCOMPARE(e.groupId(), group1.id());
+        QVERIFY(!e.validProperties().contains(Event::FreeText));
+        QVERIFY(e.freeText().isEmpty());
+    }
+
+    model.setPropertyMask(Event::allProperties());
+    QVERIFY(model.getEvents(group1.id()));
+    Event e = model.event(model.index(0, 0));
+    QVERIFY(e.validProperties().contains(Event::FreeText));
+    QVERIFY(!e.freeText().isEmpty());
+}
+
+void ConversationModelTest::feedEventsAdded(const QList<CommHistory::Event> &events)
+{
+    feedEvents.append(events);
+}
+
+void ConversationModelTest::feedEventPropertiesUpdated(const QList<QByteArray> &events)
+{
+    foreach (const QByteArray &data, events)
+        feedUpdates.append(Event::decodeProperties(data));
+}
+
+void ConversationModelTest::subscription()
+{
+    ConversationModel model;
+    model.enableContactChanges(false);
+    model.setQueryMode(EventModel::SyncQuery);
+    QVERIFY(model.getEvents(group1.id()));
+    int rows = model.rowCount();
+
+    feedEvents.clear();
+    QString path = QString(COMM_HISTORY_GROUP_PATH).arg(group1.id());
+    QVERIFY(QDBusConnection::sessionBus().connect(
+        QString(), path, COMM_HISTORY_FEED_INTERFACE, EVENTS_ADDED_SIGNAL,
+        this, SLOT(feedEventsAdded(const QList<CommHistory::Event> &))));
+
+    // Only events of the group are sent on its feed
+    EventModel eventModel;
+    watcher.setModel(&eventModel);
+    QVERIFY(addTestEvent(eventModel, Event::IMEvent, Event::Inbound, ACCOUNT1,
+                         group2.id(), "other group") != -1);
+    QVERIFY(watcher.waitForAdded());
+    QVERIFY(addTestEvent(eventModel, Event::CallEvent, Event::Inbound, ACCOUNT1, -1) != -1);
+    QVERIFY(watcher.waitForAdded());
+    QVERIFY(addTestEvent(eventModel, Event::IMEvent, Event::Inbound, ACCOUNT1,
+                         group1.id(), "subscribed group") != -1);
+    QVERIFY(watcher.waitForAdded());
+
+    QTRY_COMPARE(feedEvents.size(), 1);
+    QCOMPARE(feedEvents.first().groupId(), group1.id());
+    QTRY_COMPARE(model.rowCount(), rows + 1);
+    QCOMPARE(model.event(model.index(0, 0)).freeText(), QString("subscribed group"));
+
+    QDBusConnection::sessionBus().disconnect(
+        QString(), path, COMM_HISTORY_FEED_INTERFACE, EVENTS_ADDED_SIGNAL,
+        this, SLOT(feedEventsAdded(const QList<CommHistory::Event> &)));
+}
+
+void ConversationModelTest::groupChangedByUpdate()
+{
+    EventModel eventModel;
+    watcher.setModel(&eventModel);
+    int id = addTestEvent(eventModel, Event::IMEvent, Event::Inbound, ACCOUNT1,
+                          group1.id(), "changes group");
+    QVERIFY(id != -1);
+    QVERIFY(watcher.waitForAdded());
+
+    ConversationModel source;
+    source.enableContactChanges(false);
+    source.setQueryMode(EventModel::SyncQuery);
+    QVERIFY(source.getEvents(group1.id()));
+    QVERIFY(source.findEvent(id).isValid());
+
+    ConversationModel destination;
+    destination.enableContactChanges(false);
+    destination.setQueryMode(EventModel::SyncQuery);
+    QVERIFY(destination.getEvents(group2.id()));
+    QVERIFY(!destination.findEvent(id).isValid());
+
+    feedUpdates.clear();
+    QString path = QString(COMM_HISTORY_GROUP_PATH).arg(group1.id());
+    QVERIFY(QDBusConnection::sessionBus().connect(
+        QString(), path, COMM_HISTORY_FEED_INTERFACE, EVENT_PROPERTIES_UPDATED_SIGNAL,
+        this, SLOT(feedEventPropertiesUpdated(const QList<QByteArray> &))));
+
+    Event event;
+    QVERIFY(eventModel.databaseIO().getEvent(id, event));
+    event.setGroupId(group2.id());
+    QVERIFY(eventModel.modifyEvent(event));
+    QVERIFY(watcher.waitForUpdated());
+
+    // The update is sent on the feed of the old group as well
+    QTRY_COMPARE(feedUpdates.size(), 1);
+    QCOMPARE(feedUpdates.first().id(), id);
+    QCOMPARE(feedUpdates.first().groupId(), group2.id());
+
+    QTRY_VERIFY(!source.findEvent(id).isValid());
+    QTRY_VERIFY(destination.findEvent(id).isValid());
+
+    QDBusConnection::sessionBus().disconnect(
+        QString(), path, COMM_HISTORY_FEED_INTERFACE, EVENT_PROPERTIES_UPDATED_SIGNAL,
+        this, SLOT(feedEventPropertiesUpdated(const QList<QByteArray> &)));
+}
+
 void ConversationModelTest::reset() {
     ConversationModel conv;
     conv.enableContactChanges(false);
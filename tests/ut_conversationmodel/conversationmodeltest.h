@@ -34,6 +34,10 @@ class ConversationModelTest : public QObject
 {
     Q_OBJECT
 
+public slots:
+    void feedEventsAdded(const QList<CommHistory::Event> &events);
+    void feedEventPropertiesUpdated(const QList<QByteArray> &events);
+
 private slots:
     void initTestCase();
     void getEvents_data();
@@ -43,10 +47,18 @@ private slots:
     void deleteEvent();
     void asyncMode();
     void sorting();
+    void fetchMore();
     void contacts_data();
     void contacts();
+    void propertyMask();
+    void subscription();
+    void groupChangedByUpdate();
     void reset();
     void cleanupTestCase();
+
+private:
+    QList<Event> feedEvents;
+    QList<Event> feedUpdates;
 };
 
 #endif
@@ -21,6 +21,8 @@
 ******************************************************************************/
 
 #include <QtTest/QtTest>
+#include <QSqlDatabase>
+#include <QSqlQuery>
 
 #include <time.h>
 #include "eventmodeltest.h"
@@ -28,9 +30,11 @@
 #include "conversationmodel.h"
 #include "groupmodel.h"
 #include "adaptor.h"
+#include "updatesemitter.h"
 #include "event.h"
 #include "common.h"
 #include "databaseio.h"
+#include "contactcache.h"
 
 #include "modelwatcher.h"
 
@@ -218,6 +222,12 @@ void EventModelTest::testAddEvents()
     QVERIFY(model.databaseIO().getEvent(events[1].id(), event));
     QVERIFY(compareEvents(event, events[1]));
 
+    QList<Event> stored;
+    QVERIFY(model.databaseIO().getEvents(QList<int>() << events[1].id() << events[0].id() << -1, stored));
+    QCOMPARE(stored.size(), 2);
+    foreach (const Event &e, stored)
+        QVERIFY(compareEvents(e, e.id() == events[0].id() ? events[0] : events[1]));
+
     e3.setGroupId(group1.id());
     e3.setType(Event::IMEvent);
     e3.setDirection(Event::Inbound);
@@ -231,6 +241,22 @@ void EventModelTest::testAddEvents()
     events << e3;
     QVERIFY(model.addEvents(events,true)); // Add to model only, not into tracker.
     QVERIFY(watcher.waitForAdded(1, 0)); // 0 -> Do not wait for committed signal because we do not store
+
+    // A failure in the middle of a batch adds none of the events, and
+    // none of them keeps the id of a rolled back row
+    int total = -1;
+    QVERIFY(model.databaseIO().totalEventsInGroup(group1.id(), total));
+    e1.setFreeText("addEvents failed 1");
+    e2.setFreeText("addEvents failed 2");
+    e3.setGroupId(999999); // violates the foreign key of the group
+    events.clear();
+    events << e1 << e2 << e3;
+    QVERIFY(!model.addEvents(events));
+    foreach (const Event &e, events)
+        QCOMPARE(e.id(), -1);
+    int after = -1;
+    QVERIFY(model.databaseIO().totalEventsInGroup(group1.id(), after));
+    QCOMPARE(after, total);
 }
 
 void EventModelTest::testModifyEvent()
@@ -1450,10 +1476,22 @@ void EventModelTest::testMoveEvent()
     QVERIFY(model.addEvent(event));
     QVERIFY(watcher.waitForAdded());
 
+    ConversationModel destination;
+    destination.enableContactChanges(false);
+    destination.setQueryMode(EventModel::SyncQuery);
+    QVERIFY(destination.getEvents(group2.id()));
+    QVERIFY(!destination.findEvent(event.id()).isValid());
+
     QVERIFY(model.moveEvent(event,group2.id()));
     QVERIFY(watcher.waitForCommitted());
     QCOMPARE(event.groupId(), group2.id());
 
+    // The deletion from the old group must not remove the moved event
+    // from the conversation of the new group
+    QTRY_VERIFY(destination.findEvent(event.id()).isValid());
+    QTest::qWait(100);
+    QVERIFY(destination.findEvent(event.id()).isValid());
+
     Event eventFromTracker;
     QVERIFY(model.databaseIO().getEvent(event.id(), eventFromTracker));
     QCOMPARE(eventFromTracker.groupId(), group2.id());
@@ -1473,6 +1511,47 @@ void EventModelTest::testMoveEvent()
     QTRY_COMPARE(groupDeleted, group2.id());
 }
 
+void EventModelTest::testHeaders()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    Event event;
+    event.setLocalUid(ACCOUNT1);
+    event.setRemoteUid("td@localhost");
+    event.setType(Event::IMEvent);
+    event.setDirection(Event::Inbound);
+    event.setStartTime(QDateTime::currentDateTime());
+    event.setEndTime(QDateTime::currentDateTime());
+    event.setFreeText("headers");
+    event.setGroupId(group1.id());
+
+    // Values that collide with the old text separators are kept intact
+    QHash<QString, QString> headers;
+    headers.insert("x-empty", QString());
+    headers.insert("x-separators", QString::fromLatin1("a\x1c" "b\x1d" "c\nd"));
+    headers.insert(QString::fromUtf8("x-\xc3\xa4"), QString::fromUtf8("\xe2\x82\xac"));
+    headers.insert("x-long", QString(300, QChar('h')));
+    event.setHeaders(headers);
+
+    QVERIFY(model.addEvent(event));
+    QVERIFY(watcher.waitForAdded());
+
+    Event e;
+    QVERIFY(model.databaseIO().getEvent(event.id(), e));
+    QCOMPARE(e.encodedHeaders(), event.encodedHeaders());
+    QCOMPARE(e.headers(), headers);
+
+    // Events without headers
+    Event plain = event;
+    plain.setHeaders(QHash<QString, QString>());
+    QVERIFY(plain.encodedHeaders().isEmpty());
+    QVERIFY(model.modifyEvent(plain));
+    QVERIFY(watcher.waitForUpdated());
+    QVERIFY(model.databaseIO().getEvent(event.id(), e));
+    QVERIFY(e.headers().isEmpty());
+}
+
 void EventModelTest::testStreaming_data()
 {
     QTest::addColumn<bool>("useThread");
@@ -1742,6 +1821,354 @@ void EventModelTest::testContactMatching()
     deleteTestContact(contactId);
 }
 
+void EventModelTest::testSharedContactCache()
+{
+    // Different forms of an address share a cache entry
+    QCOMPARE(ContactCache::key(RING_ACCOUNT, "+358501234567"),
+             ContactCache::key(RING_ACCOUNT, "0501234567"));
+    QCOMPARE(ContactCache::key(ACCOUNT1, "User@Localhost"),
+             ContactCache::key(ACCOUNT1, "user@localhost"));
+    QVERIFY(ContactCache::key(ACCOUNT1, "user@localhost")
+            != ContactCache::key(ACCOUNT2, "user@localhost"));
+
+    EventModel model1;
+    EventModel model2;
+    QSharedPointer<ContactCache> cache = ContactCache::instance();
+    QVERIFY(cache == ContactCache::instance());
+
+    Event event;
+    event.setType(Event::SMSEvent);
+    event.setDirection(Event::Inbound);
+    event.setLocalUid(RING_ACCOUNT);
+    event.setRemoteUid("+358501234567");
+    event.setStartTime(QDateTime::currentDateTime());
+    event.setEndTime(event.startTime());
+    event.setContacts(QList<Event::Contact>() << Event::Contact(4242, "Cached Contact"));
+    QVERIFY(model1.addEvent(event, true));
+    QCOMPARE(cache->contacts(RING_ACCOUNT, "0501234567").size(), 1);
+
+    // Contacts added by one model are seen by the others
+    Event other;
+    other.setType(Event::SMSEvent);
+    other.setDirection(Event::Inbound);
+    other.setLocalUid(RING_ACCOUNT);
+    other.setRemoteUid("0501234567");
+    other.setStartTime(event.startTime());
+    other.setEndTime(event.startTime());
+    QVERIFY(model2.addEvent(other, true));
+    QCOMPARE(model2.rowCount(), 1);
+    other = model2.event(model2.index(0, 0));
+    QCOMPARE(other.contactId(), 4242);
+    QCOMPARE(other.contactName(), QString("Cached Contact"));
+}
+
+void EventModelTest::testChangeNotifications()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    QSignalSpy rowsInserted(&model, SIGNAL(rowsInserted(const QModelIndex &, int, int)));
+    QSignalSpy rowsMoved(&model, SIGNAL(rowsMoved(const QModelIndex &, int, int, const QModelIndex &, int)));
+    QSignalSpy layoutChanged(&model, SIGNAL(layoutChanged()));
+
+    QDateTime when = QDateTime::currentDateTime();
+    QList<Event> events;
+    for (int i = 0; i < 3; i++) {
+        Event e;
+        e.setGroupId(group1.id());
+        e.setType(Event::IMEvent);
+        e.setDirection(Event::Inbound);
+        e.setStartTime(when.addSecs(i));
+        e.setEndTime(when.addSecs(i));
+        e.setLocalUid(ACCOUNT1);
+        e.setRemoteUid("td@localhost");
+        e.setFreeText(QString("notification %1").arg(i));
+        events << e;
+    }
+
+    // One insertion for all events, in the order of separate additions
+    QVERIFY(model.addEvents(events));
+    QVERIFY(watcher.waitForAdded(events.size()));
+    QCOMPARE(rowsInserted.count(), 1);
+    QCOMPARE(rowsInserted.first().at(1).toInt(), 0);
+    QCOMPARE(rowsInserted.first().at(2).toInt(), 2);
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.event(model.index(0, 0)).id(), events.at(2).id());
+    QCOMPARE(model.event(model.index(2, 0)).id(), events.at(0).id());
+
+    // A newer end time moves the row instead of changing the layout
+    Event e = model.event(model.index(2, 0));
+    e.setEndTime(when.addSecs(10));
+    QVERIFY(model.modifyEvent(e));
+    QVERIFY(watcher.waitForUpdated());
+    QCOMPARE(rowsMoved.count(), 1);
+    QCOMPARE(rowsMoved.first().at(1).toInt(), 2);
+    QCOMPARE(rowsMoved.first().at(4).toInt(), 0);
+    QCOMPARE(layoutChanged.count(), 0);
+    QCOMPARE(model.event(model.index(0, 0)).id(), e.id());
+}
+
+void EventModelTest::testPropertyUpdates()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    Event event;
+    event.setGroupId(group1.id());
+    event.setType(Event::SMSEvent);
+    event.setDirection(Event::Inbound);
+    event.setStartTime(QDateTime::currentDateTime());
+    event.setEndTime(event.startTime());
+    event.setLocalUid(RING_ACCOUNT);
+    event.setRemoteUid("+3581234567");
+    event.setFreeText("property update");
+    event.setHeaders(QHash<QString, QString>());
+    QVERIFY(model.addEvent(event));
+    QVERIFY(watcher.waitForAdded());
+
+    // Only the requested valid properties are encoded
+    Event decoded = Event::decodeProperties(event.encodeProperties(Event::PropertySet()
+                                                                   << Event::IsRead
+                                                                   << Event::FreeText
+                                                                   << Event::Cc));
+    QCOMPARE(decoded.id(), event.id());
+    QCOMPARE(decoded.type(), event.type());
+    QCOMPARE(decoded.validProperties(), Event::PropertySet() << Event::Id << Event::Type
+                                        << Event::IsRead << Event::FreeText << Event::Headers);
+    QVERIFY(decoded.modifiedProperties().isEmpty());
+    QCOMPARE(decoded.freeText(), event.freeText());
+    QVERIFY(!decoded.isRead());
+
+    decoded = Event::decodeProperties(event.encodeProperties(Event::allProperties()));
+    QVERIFY(decoded.validProperties().contains(Event::StartTime));
+    QCOMPARE(decoded.startTime(), event.startTime());
+    QCOMPARE(decoded.remoteUid(), event.remoteUid());
+    QCOMPARE(decoded.groupId(), event.groupId());
+
+    // The previous state follows the properties, and decoders that do not
+    // ask for it still get the same event
+    Event state;
+    state.setId(event.id());
+    state.setGroupId(event.groupId() + 1);
+    state.setIsRead(true);
+    QByteArray data = event.encodeProperties(Event::PropertySet() << Event::IsRead, state);
+    Event previous;
+    decoded = Event::decodeProperties(data, &previous);
+    QCOMPARE(decoded.validProperties(), Event::PropertySet() << Event::Id << Event::Type << Event::IsRead);
+    QVERIFY(!decoded.isRead());
+    QCOMPARE(previous.id(), event.id());
+    QCOMPARE(previous.groupId(), event.groupId() + 1);
+    QVERIFY(previous.isRead());
+    QCOMPARE(Event::decodeProperties(data).validProperties(), decoded.validProperties());
+
+    decoded = Event::decodeProperties(event.encodeProperties(Event::PropertySet() << Event::IsRead), &previous);
+    QCOMPARE(previous.id(), event.id());
+    QCOMPARE(previous.validProperties(), Event::PropertySet() << Event::Id << Event::Type);
+
+    // The update carries the modified property, and the model keeps the rest
+    Event modified;
+    modified.setId(event.id());
+    modified.setType(event.type());
+    modified.setIsRead(true);
+    QVERIFY(model.modifyEvent(modified));
+    QVERIFY(watcher.waitForUpdated());
+    QCOMPARE(watcher.m_lastUpdated.size(), 1);
+    QVERIFY(watcher.m_lastUpdated.first().validProperties().contains(Event::IsRead));
+    QVERIFY(!watcher.m_lastUpdated.first().validProperties().contains(Event::FreeText));
+
+    QModelIndex index = model.findEvent(event.id());
+    QVERIFY(index.isValid());
+    QVERIFY(model.event(index).isRead());
+    QCOMPARE(model.event(index).freeText(), event.freeText());
+    QCOMPARE(model.event(index).remoteUid(), event.remoteUid());
+}
+
+void EventModelTest::testUpdatesCoalescing()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    Event event;
+    event.setGroupId(group1.id());
+    event.setType(Event::IMEvent);
+    event.setDirection(Event::Outbound);
+    event.setStartTime(QDateTime::currentDateTime());
+    event.setEndTime(event.startTime());
+    event.setLocalUid(ACCOUNT1);
+    event.setRemoteUid("td@localhost");
+    event.setFreeText("coalescing");
+    QVERIFY(model.addEvent(event));
+    QVERIFY(watcher.waitForAdded());
+
+    // A long interval keeps all updates in one batch on a slow runner
+    QSharedPointer<UpdatesEmitter> emitter = UpdatesEmitter::instance();
+    int interval = emitter->flushInterval();
+    emitter->setFlushInterval(10000);
+    quint64 queued = emitter->queuedCount();
+    quint64 emitted = emitter->emittedCount();
+
+    // Updates to the same event within the flush interval are sent once,
+    // with the properties of all of them
+    event.resetModifiedProperties();
+    event.setStatus(Event::SentStatus);
+    QVERIFY(model.modifyEvent(event));
+    for (int i = 0; i < 3; i++) {
+        event.resetModifiedProperties();
+        event.setFreeText(QString("coalesced %1").arg(i));
+        QVERIFY(model.modifyEvent(event));
+    }
+
+    // Each update queues its properties and the group; full events are
+    // not sent by default
+    QVERIFY(!emitter->fullEventUpdates());
+    QCOMPARE(watcher.m_committedCount, 4);
+    QCOMPARE(emitter->queuedCount() - queued, quint64(8));
+    QCOMPARE(emitter->emittedCount(), emitted);
+
+    // One batch: the properties on the global signal and on the group
+    // feed, and the group update
+    emitter->flush();
+    QCOMPARE(emitter->emittedCount() - emitted, quint64(3));
+    emitter->setFlushInterval(interval);
+
+    QTRY_COMPARE(watcher.m_updatedCount, 1);
+    QTest::qWait(100);
+    QCOMPARE(watcher.m_updatedCount, 1);
+    QCOMPARE(watcher.m_lastUpdated.first().id(), event.id());
+    QCOMPARE(watcher.m_lastUpdated.first().status(), Event::SentStatus);
+    QCOMPARE(watcher.m_lastUpdated.first().freeText(), QString("coalesced 2"));
+
+    QModelIndex index = model.findEvent(event.id());
+    QVERIFY(index.isValid());
+    QCOMPARE(model.event(index).status(), Event::SentStatus);
+    QCOMPARE(model.event(index).freeText(), QString("coalesced 2"));
+
+    // The deprecated full events are sent only when enabled
+    emitter->setFullEventUpdates(true);
+    QSignalSpy full(emitter.data(), SIGNAL(eventsUpdated(const QList<CommHistory::Event> &)));
+    event.resetModifiedProperties();
+    event.setFreeText("full");
+    QVERIFY(model.modifyEvent(event));
+    emitter->flush();
+    emitter->setFullEventUpdates(false);
+    QCOMPARE(full.count(), 1);
+    QList<Event> events = full.first().first().value<QList<Event> >();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(events.first().freeText(), QString("full"));
+    QCOMPARE(events.first().status(), Event::SentStatus);
+    watcher.reset();
+}
+
+void EventModelTest::testLocalChangeBus()
+{
+    EventModel model;
+    watcher.setModel(&model);
+
+    QSharedPointer<UpdatesEmitter> emitter = UpdatesEmitter::instance();
+    QSignalSpy added(emitter.data(), SIGNAL(receivedEventsAdded(const QList<CommHistory::Event> &)));
+    QSignalSpy updated(emitter.data(), SIGNAL(receivedEventPropertiesUpdated(const QList<CommHistory::Event> &,
+                                                                             const QList<CommHistory::Event> &)));
+    QSignalSpy deleted(emitter.data(), SIGNAL(receivedEventsDeleted(const QList<CommHistory::Event> &)));
+
+    Event event;
+    event.setGroupId(group1.id());
+    event.setType(Event::IMEvent);
+    event.setDirection(Event::Outbound);
+    event.setStartTime(QDateTime::currentDateTime());
+    event.setEndTime(event.startTime());
+    event.setLocalUid(ACCOUNT1);
+    event.setRemoteUid("td@localhost");
+    event.setFreeText("local bus");
+    QVERIFY(model.addEvent(event));
+
+    // Own changes are delivered locally once; the echo from the bus,
+    // which the watcher sees, is dropped
+    QVERIFY(watcher.waitForAdded());
+    QTest::qWait(100);
+    QCOMPARE(added.count(), 1);
+    QList<Event> events = added.first().first().value<QList<Event> >();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(events.first().id(), event.id());
+
+    event.resetModifiedProperties();
+    event.setStatus(Event::SentStatus);
+    QVERIFY(model.modifyEvent(event));
+    QTRY_COMPARE(watcher.m_updatedCount, 1);
+    QTest::qWait(100);
+    QCOMPARE(updated.count(), 1);
+    events = updated.first().first().value<QList<Event> >();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(events.first().id(), event.id());
+    QCOMPARE(events.first().status(), Event::SentStatus);
+    // The status does not change group statistics, so no previous state
+    QList<Event> previous = updated.first().at(1).value<QList<Event> >();
+    QCOMPARE(previous.count(), 1);
+    QVERIFY(!previous.first().validProperties().contains(Event::GroupId));
+
+    event.resetModifiedProperties();
+    event.setIsRead(true);
+    QVERIFY(model.modifyEvent(event));
+    QTRY_COMPARE(watcher.m_updatedCount, 2);
+    QTest::qWait(100);
+    QCOMPARE(updated.count(), 2);
+    previous = updated.at(1).at(1).value<QList<Event> >();
+    QCOMPARE(previous.count(), 1);
+    QCOMPARE(previous.first().id(), event.id());
+    QCOMPARE(previous.first().groupId(), group1.id());
+    QCOMPARE(previous.first().direction(), Event::Outbound);
+    QVERIFY(!previous.first().isRead());
+
+    // Deletions carry the state of the event
+    QVERIFY(model.deleteEvent(event.id()));
+    QVERIFY(watcher.waitForDeleted());
+    QTest::qWait(100);
+    QCOMPARE(deleted.count(), 1);
+    events = deleted.first().first().value<QList<Event> >();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(events.first().id(), event.id());
+    QCOMPARE(events.first().groupId(), group1.id());
+    QVERIFY(events.first().isRead());
+    watcher.reset();
+}
+
+void EventModelTest::testAddedByOtherModel()
+{
+    // A long interval keeps the additions of both models in one batch
+    QSharedPointer<UpdatesEmitter> emitter = UpdatesEmitter::instance();
+    int interval = emitter->flushInterval();
+    emitter->setFlushInterval(10000);
+
+    EventModel first;
+    EventModel second;
+
+    Event event1;
+    event1.setGroupId(group1.id());
+    event1.setType(Event::IMEvent);
+    event1.setDirection(Event::Outbound);
+    event1.setStartTime(QDateTime::currentDateTime());
+    event1.setEndTime(event1.startTime());
+    event1.setLocalUid(ACCOUNT1);
+    event1.setRemoteUid("td@localhost");
+    event1.setFreeText("first model");
+    Event event2 = event1;
+    event2.setFreeText("second model");
+
+    QVERIFY(first.addEvent(event1));
+    QVERIFY(second.addEvent(event2));
+    QVERIFY(first.findEvent(event1.id()).isValid());
+    QVERIFY(!first.findEvent(event2.id()).isValid());
+    QVERIFY(second.findEvent(event2.id()).isValid());
+    QVERIFY(!second.findEvent(event1.id()).isValid());
+
+    // Each model receives [event1, event2] and already has one of them
+    emitter->flush();
+    QTRY_VERIFY(first.findEvent(event2.id()).isValid());
+    QTRY_VERIFY(second.findEvent(event1.id()).isValid());
+    QCOMPARE(first.rowCount(), second.rowCount());
+
+    emitter->setFlushInterval(interval);
+}
+
 void EventModelTest::testAddNonDigitRemoteId_data()
 {
     QTest::addColumn<QString>("localId");
@@ -1785,6 +2212,182 @@ void EventModelTest::testAddNonDigitRemoteId()
     QVERIFY(compareEvents(event, tevent));
 }
 
+namespace {
+// Reads an event on a new read connection, which migrates the database
+class EventReader : public QThread
+{
+public:
+    EventReader(int id, int reads = 1) : id(id), reads(reads), found(false) {}
+
+    void run()
+    {
+        for (int i = 0; i < reads; i++)
+            found = DatabaseIO::instance()->getEvent(id, event);
+    }
+
+    int id;
+    int reads;
+    bool found;
+    Event event;
+};
+}
+
+void EventModelTest::testMigrateHeaders()
+{
+    EventModel model;
+    int id = addTestEvent(model, Event::MMSEvent, Event::Inbound, ACCOUNT1, group1.id(), "headers");
+    QVERIFY(id != -1);
+
+    // Headers in the text format of database version 2
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), QLatin1String("ut_migration"));
+        database.setDatabaseName(QSqlDatabase::database(QLatin1String("commhistory"), false).databaseName());
+        QVERIFY(database.open());
+
+        QSqlQuery query(database);
+        QVERIFY(query.prepare(QLatin1String("UPDATE Events SET headers = :headers WHERE id = :id")));
+        query.bindValue(QLatin1String(":headers"),
+                        QString::fromLatin1("x-mms-to\x1d" "one\x1etwo\x1cx-test\x1d" "value"));
+        query.bindValue(QLatin1String(":id"), id);
+        QVERIFY(query.exec());
+        QVERIFY(query.exec(QLatin1String("PRAGMA user_version = 2")));
+
+        query.clear();
+        database.close();
+    }
+    QSqlDatabase::removeDatabase(QLatin1String("ut_migration"));
+
+    EventReader reader(id);
+    reader.start();
+    QVERIFY(reader.wait(WAIT_SIGNAL_TIMEOUT));
+    QVERIFY(reader.found);
+
+    QCOMPARE(reader.event.headers().size(), 2);
+    QCOMPARE(reader.event.headers().value("x-test"), QString("value"));
+    QCOMPARE(reader.event.toList(), QStringList() << "one" << "two");
+
+    // Headers are stored as BLOBs and the later migrations ran as well
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), QLatin1String("ut_migration"));
+        database.setDatabaseName(QSqlDatabase::database(QLatin1String("commhistory"), false).databaseName());
+        QVERIFY(database.open());
+
+        QSqlQuery query(database);
+        QVERIFY(query.exec(QString::fromLatin1("SELECT typeof(headers) FROM Events WHERE id = %1").arg(id)));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), QString("blob"));
+        QVERIFY(query.exec(QLatin1String("PRAGMA user_version")));
+        QVERIFY(query.next());
+        QVERIFY(query.value(0).toInt() > 2);
+
+        query.clear();
+        database.close();
+    }
+    QSqlDatabase::removeDatabase(QLatin1String("ut_migration"));
+}
+
+void EventModelTest::testReadQueryCache()
+{
+    EventModel model;
+    int id = addTestEvent(model, Event::IMEvent, Event::Inbound, ACCOUNT1, group1.id(), "read cache");
+    QVERIFY(id != -1);
+
+    // Reads on other threads use their own connection and cache, and
+    // are counted as well
+    DatabaseIO *database = DatabaseIO::instance();
+    int hits = database->queryCacheHits();
+    int misses = database->queryCacheMisses();
+
+    EventReader reader(id, 3);
+    reader.start();
+    QVERIFY(reader.wait(WAIT_SIGNAL_TIMEOUT));
+    QVERIFY(reader.found);
+
+    QVERIFY(database->queryCacheMisses() > misses);
+    QVERIFY(database->queryCacheHits() >= hits + 2);
+}
+
+void EventModelTest::testMaintenance()
+{
+    Group g;
+    addTestGroup(g, ACCOUNT1, "maintenance");
+
+    // Enough text to leave free pages above the vacuum threshold
+    QList<Event> events;
+    for (int i = 0; i < 2000; i++) {
+        Event event;
+        event.setGroupId(g.id());
+        event.setType(Event::SMSEvent);
+        event.setDirection(Event::Inbound);
+        event.setStartTime(QDateTime::currentDateTime());
+        event.setEndTime(QDateTime::currentDateTime());
+        event.setLocalUid(ACCOUNT1);
+        event.setRemoteUid("maintenance");
+        event.setFreeText(QString(1000, QChar('m')));
+        events << event;
+    }
+
+    DatabaseIO *database = DatabaseIO::instance();
+    QVERIFY(database->addEvents(events));
+    QVERIFY(database->deleteGroup(g.id()));
+
+    qint64 freePages = -1;
+    {
+        QSqlDatabase connection = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), QLatin1String("ut_maintenance"));
+        connection.setDatabaseName(QSqlDatabase::database(QLatin1String("commhistory"), false).databaseName());
+        QVERIFY(connection.open());
+
+        // Databases are migrated to incremental vacuum when opened
+        QSqlQuery query(connection);
+        QVERIFY(query.exec(QLatin1String("PRAGMA auto_vacuum")) && query.next());
+        if (query.value(0).toInt() != 2) {
+            query.clear();
+            connection.close();
+            connection = QSqlDatabase();
+            QSqlDatabase::removeDatabase(QLatin1String("ut_maintenance"));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+            QSKIP("Incremental vacuum is not enabled for the database");
+#else
+            QSKIP("Incremental vacuum is not enabled for the database", SkipSingle);
+#endif
+        }
+
+        QVERIFY(query.exec(QLatin1String("PRAGMA freelist_count")) && query.next());
+        freePages = query.value(0).toLongLong();
+        query.clear();
+        connection.close();
+    }
+    QSqlDatabase::removeDatabase(QLatin1String("ut_maintenance"));
+    QVERIFY(freePages > 0);
+
+    QSignalSpy finished(database, SIGNAL(maintenanceFinished(qint64,qint64,int)));
+    database->runMaintenance();
+    QVERIFY(waitSignal(finished));
+    QVERIFY(finished.first().at(2).toInt() >= 0);
+
+    // Incremental vacuum released free pages. The file size depends on a
+    // checkpoint that readers may block, the free list does not.
+    {
+        QSqlDatabase connection = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), QLatin1String("ut_maintenance"));
+        connection.setDatabaseName(QSqlDatabase::database(QLatin1String("commhistory"), false).databaseName());
+        QVERIFY(connection.open());
+
+        QSqlQuery query(connection);
+        QVERIFY(query.exec(QLatin1String("PRAGMA wal_checkpoint(TRUNCATE)")));
+        query.finish();
+        QVERIFY(query.exec(QLatin1String("PRAGMA freelist_count")) && query.next());
+        QVERIFY(query.value(0).toLongLong() < freePages);
+        query.clear();
+        connection.close();
+    }
+    QSqlDatabase::removeDatabase(QLatin1String("ut_maintenance"));
+
+    // The database stays usable while and after maintenance runs
+    int total = -1;
+    QVERIFY(database->totalEventsInGroup(group1.id(), total));
+    QVERIFY(total >= 0);
+}
+
 void EventModelTest::cleanupTestCase()
 {
     deleteAll();
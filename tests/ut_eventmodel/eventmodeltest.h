@@ -50,6 +50,7 @@ private slots:
     void testMessageParts();
     void testDeleteMessageParts();
     void testCcBcc();
+    void testHeaders();
     void testStreaming_data();
     void testStreaming();
     void testModifyInGroup();
@@ -57,8 +58,17 @@ private slots:
     void testMessagePartsQuery();
     void testContactMatching_data();
     void testContactMatching();
+    void testSharedContactCache();
+    void testChangeNotifications();
+    void testPropertyUpdates();
+    void testUpdatesCoalescing();
+    void testLocalChangeBus();
+    void testAddedByOtherModel();
     void testAddNonDigitRemoteId_data();
     void testAddNonDigitRemoteId();
+    void testMigrateHeaders();
+    void testReadQueryCache();
+    void testMaintenance();
     void cleanupTestCase();
 
     void groupsUpdatedSlot(const QList<int> &groupIds);
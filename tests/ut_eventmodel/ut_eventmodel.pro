@@ -27,5 +27,6 @@ include( ../tests.pri )
 TARGET = ut_eventmodel
 DESTDIR = ../bin
 QT -= gui
+QT += sql
 SOURCES += eventmodeltest.cpp
 HEADERS += eventmodeltest.h
@@ -1410,4 +1410,185 @@ void GroupModelTest::endTimeUpdate()
     QVERIFY(model.group(model.index(0, 0)).endTime().toTime_t() != olEvent.endTime().toTime_t());
 }
 
+void GroupModelTest::groupStats()
+{
+    EventModel eventModel;
+    DatabaseIO *database = DatabaseIO::instance();
+
+    addTestGroup(group1, "groupStats", QString("td@localhost"));
+    addTestGroup(group2, "groupStats", QString("td2@localhost"));
+    QVERIFY(group1.id() != -1);
+    QVERIFY(group2.id() != -1);
+    QVERIFY(database->checkGroupStats());
+
+    QSignalSpy eventsCommitted(&eventModel, SIGNAL(eventsCommitted(const QList<CommHistory::Event>&, bool)));
+    QDateTime when = QDateTime::currentDateTime();
+    int first = addTestEvent(eventModel, Event::SMSEvent, Event::Inbound, "groupStats",
+                             group1.id(), "first", false, false, when.addSecs(-60));
+    QVERIFY(waitSignal(eventsCommitted));
+    int second = addTestEvent(eventModel, Event::SMSEvent, Event::Outbound, "groupStats",
+                              group1.id(), "second", false, false, when);
+    QVERIFY(waitSignal(eventsCommitted));
+    QVERIFY(database->checkGroupStats());
+
+    Group g;
+    QVERIFY(database->getGroup(group1.id(), g));
+    QCOMPARE(g.totalMessages(), 2);
+    QCOMPARE(g.unreadMessages(), 2);
+    QCOMPARE(g.sentMessages(), 1);
+    QCOMPARE(g.lastEventId(), second);
+
+    Event event;
+    QVERIFY(database->getEvent(first, event));
+    event.setIsRead(true);
+    QVERIFY(database->modifyEvent(event));
+    QVERIFY(database->moveEvent(event, group2.id()));
+    QVERIFY(database->checkGroupStats());
+
+    QVERIFY(database->getGroup(group2.id(), g));
+    QCOMPARE(g.totalMessages(), 1);
+    QCOMPARE(g.unreadMessages(), 0);
+    QCOMPARE(g.lastEventId(), first);
+
+    QVERIFY(database->getEvent(second, event));
+    QVERIFY(database->deleteEvent(event));
+    QVERIFY(database->checkGroupStats());
+
+    QVERIFY(database->getGroup(group1.id(), g));
+    QCOMPARE(g.totalMessages(), 0);
+    QCOMPARE(g.lastEventId(), -1);
+
+    QVERIFY(database->rebuildGroupStats());
+    QVERIFY(database->checkGroupStats());
+}
+
+static QString statsString(const Group &group)
+{
+    return QString("total %1 unread %2 sent %3 last %4 (%5) at %6")
+        .arg(group.totalMessages())
+        .arg(group.unreadMessages())
+        .arg(group.sentMessages())
+        .arg(group.lastEventId())
+        .arg(group.lastMessageText())
+        .arg(group.startTime().toTime_t());
+}
+
+static Group modelGroup(GroupModel &model, int id)
+{
+    for (int row = 0; row < model.rowCount(); row++) {
+        Group group = model.group(model.index(row, 0));
+        if (group.id() == id)
+            return group;
+    }
+    return Group();
+}
+
+void GroupModelTest::incrementalStats()
+{
+    EventModel eventModel;
+    DatabaseIO *database = DatabaseIO::instance();
+
+    Group groups[2];
+    addTestGroup(groups[0], "incrementalStats", QString("td@localhost"));
+    addTestGroup(groups[1], "incrementalStats", QString("td2@localhost"));
+    QVERIFY(groups[0].id() != -1);
+    QVERIFY(groups[1].id() != -1);
+
+    GroupModel groupModel;
+    groupModel.enableContactChanges(false);
+    groupModel.setQueryMode(EventModel::SyncQuery);
+    QVERIFY(groupModel.getGroups("incrementalStats"));
+    QCOMPARE(groupModel.rowCount(), 2);
+
+    // Fixed seed, so that a failing sequence can be repeated. Start times
+    // fall in a short range to get events with the same time. Drafts are
+    // older than the other events, so they never become the last event,
+    // and each group keeps a message so that it is not deleted.
+    qsrand(2501);
+    QDateTime base = QDateTime::fromTime_t(QDateTime::currentDateTime().toTime_t());
+    QDateTime draftBase = base.addSecs(-3600);
+    QList<int> ids[2];
+    QSet<int> drafts;
+    Group stored;
+
+    for (int i = 0; i < 200; i++) {
+        int g = qrand() % 2;
+        int operation = qrand() % 7;
+        if (ids[0].count() < 2 || ids[1].count() < 2) {
+            operation = 0;
+            g = ids[0].count() < 2 ? 0 : 1;
+        }
+
+        Event event;
+        if (operation != 0 && operation != 5) {
+            QVERIFY(database->getEvent(ids[g].at(qrand() % ids[g].count()), event));
+
+            // Deletes and moves must leave a message in the group
+            if (operation == 4 || operation == 6) {
+                int messages = 0;
+                foreach (int id, ids[g]) {
+                    if (id != event.id() && !drafts.contains(id))
+                        messages++;
+                }
+                if (!messages)
+                    operation = 1;
+            }
+        }
+
+        switch (operation) {
+        case 0:
+            event.setType(Event::IMEvent);
+            event.setGroupId(groups[g].id());
+            event.setDirection(qrand() % 2 ? Event::Inbound : Event::Outbound);
+            event.setIsRead(qrand() % 2);
+            event.setIsDraft(qrand() % 4 == 0);
+            event.setStartTime((event.isDraft() ? draftBase : base).addSecs(qrand() % 20));
+            event.setEndTime(event.startTime());
+            event.setLocalUid("incrementalStats");
+            event.setRemoteUid(groups[g].remoteUids().first());
+            event.setFreeText(QString("incremental %1").arg(i));
+            QVERIFY(eventModel.addEvent(event));
+            ids[g].append(event.id());
+            if (event.isDraft())
+                drafts.insert(event.id());
+            break;
+        case 1:
+            event.setIsRead(!event.isRead());
+            QVERIFY(eventModel.modifyEvent(event));
+            break;
+        case 2:
+            event.setDirection(event.direction() == Event::Inbound ? Event::Outbound : Event::Inbound);
+            QVERIFY(eventModel.modifyEvent(event));
+            break;
+        case 3:
+            event.setStartTime((event.isDraft() ? draftBase : base).addSecs(qrand() % 20));
+            event.setEndTime(event.startTime());
+            QVERIFY(eventModel.modifyEvent(event));
+            break;
+        case 4:
+            QVERIFY(eventModel.deleteEvent(event.id()));
+            ids[g].removeOne(event.id());
+            drafts.remove(event.id());
+            break;
+        case 5:
+            QVERIFY(groupModel.markAsReadGroup(groups[g].id()));
+            break;
+        case 6:
+            QVERIFY(eventModel.moveEvent(event, groups[1 - g].id()));
+            ids[g].removeOne(event.id());
+            ids[1 - g].append(event.id());
+            break;
+        }
+
+        // The model is updated from the event changes; compare with the
+        // statistics in the database
+        for (int j = 0; j < 2; j++) {
+            QVERIFY(database->getGroup(groups[j].id(), stored));
+            QTRY_COMPARE(statsString(modelGroup(groupModel, groups[j].id())), statsString(stored));
+        }
+    }
+
+    QVERIFY(database->checkGroupStats());
+}
+
 QTEST_MAIN(GroupModelTest)
@@ -63,6 +63,8 @@ private slots:
     void limitOffset();
     void noRemoteId();
     void endTimeUpdate();
+    void groupStats();
+    void incrementalStats();
     void cleanupTestCase();
     void init();
     void cleanup();
@@ -513,6 +513,45 @@ void RecentContactsModelTest::contactRemoved()
     QCOMPARE(e.contacts(), QList<ContactDetails>() << qMakePair(aliceId, aliceName));
 }
 
+void RecentContactsModelTest::olderEventUpdated()
+{
+    addEvents(2);
+
+    RecentContactsModel model;
+
+    InsertionSpy insert(model);
+
+    QVERIFY(model.getEvents());
+    QTRY_COMPARE(model.resolving(), false);
+    QCOMPARE(insert.count(), 2);
+
+    Event older = model.event(model.index(0, 0));
+    QCOMPARE(older.remoteUid(), bobPhone);
+
+    for (int count = 3; count <= 5; ++count) {
+        addEvents(count, count);
+        QTRY_COMPARE(model.resolving(), false);
+        QCOMPARE(insert.count(), count);
+    }
+
+    QCOMPARE(model.rowCount(), 3);
+    Event latest = model.event(model.index(0, 0));
+    QCOMPARE(latest.remoteUid(), bobPhone);
+    QVERIFY(latest.id() != older.id());
+
+    // An update of an older event does not replace the row of its contact
+    EventModel eventsModel;
+    watcher.setModel(&eventsModel);
+    older.setIsRead(!older.isRead());
+    QVERIFY(eventsModel.modifyEvent(older));
+    QVERIFY(watcher.waitForUpdated(1));
+
+    QCOMPARE(model.resolving(), false);
+    QCOMPARE(insert.count(), 5);
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.event(model.index(0, 0)).id(), latest.id());
+}
+
 void RecentContactsModelTest::cleanup()
 {
     cleanupTestEvents();
@@ -141,6 +141,7 @@ void printUsage()
     std::cout << "                 deletegroup group-id"                                                                                                   << std::endl;
     std::cout << "                 deleteall [-groups] [-calls] [-reset]"                                                                                  << std::endl;
     std::cout << "                 markallcallsread"                                                                                                       << std::endl;
+    std::cout << "                 checkgroups [-rebuild]"                                                                                                 << std::endl;
     std::cout << "                 export [-group group-id] [-calls] [-groups] filename"
                         << std::endl;
     std::cout << "                 import filename"
@@ -927,6 +928,31 @@ int doMarkAllCallsRead(const QStringList &arguments, const QVariantMap &options)
     return 0;
 }
 
+int doCheckGroups(const QStringList &arguments, const QVariantMap &options)
+{
+    Q_UNUSED(arguments);
+
+    QList<int> groupIds;
+    if (DatabaseIO::instance()->checkGroupStats(&groupIds)) {
+        std::cout << "Group statistics are consistent" << std::endl;
+        return 0;
+    }
+
+    foreach (int groupId, groupIds)
+        std::cout << "Inconsistent statistics for group " << groupId << std::endl;
+
+    if (options.contains("-rebuild")) {
+        if (!DatabaseIO::instance()->rebuildGroupStats()) {
+            qCritical() << "Error rebuilding group statistics.";
+            return -1;
+        }
+        qWarning() << "Other clients must be restarted to refresh their view of the groups";
+        return 0;
+    }
+
+    return -1;
+}
+
 bool exportGroup(QDataStream &out, const Group &group)
 {
     ConversationModel model;
@@ -1314,6 +1340,8 @@ int main(int argc, char **argv)
             return doDeleteAll(args, options);
         } else if (args.at(1) == "markallcallsread") {
             return doMarkAllCallsRead(args, options);
+        } else if (args.at(1) == "checkgroups") {
+            return doCheckGroups(args, options);
         } else if (args.at(1) == "export" && args.count() > 2) {
             return doExport(args, options);
         } else if (args.at(1) == "import") {